@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+// Heap allocations made through operator new since some point.
+struct AllocationStats {
+	uint64_t allocations = 0;
+	uint64_t bytes = 0;
+};
+
+// Counts every allocation going through the global operator new (replaced in AllocationCounter.cpp).
+// Relaxed atomics, so it is cheap enough to always be on. Used to keep the steady state frame allocation free.
+class AllocationCounter
+{
+public:
+	// Running totals since program start. Take one as a snapshot and pass it to since() later.
+	static AllocationStats getTotals();
+	static AllocationStats since(const AllocationStats& snapshot);
+};
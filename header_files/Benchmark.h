@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Frame time samples of a benchmark run and the JSON report written from them.
+// The first warmupFrames samples of each kind are dropped (pipelines, caches and command buffers are still settling).
+// Sample storage is reserved up front so measured frames stay allocation free.
+class Benchmark
+{
+public:
+	Benchmark();
+
+	// Start over with new frame counts. Reserves the sample storage in place, the benchmark is never reassigned.
+	void reset(uint32_t newWarmupFrames, uint32_t newMeasuredFrames);
+
+	// One per drawn frame, in order. frameMs is the whole draw, cpuMs the part not spent waiting on the GPU.
+	void addFrame(double frameMs, double cpuMs);
+	// One per collected GPU frame time, in submit order.
+	void addGpuFrame(double gpuMs);
+
+	void setLoadMs(double newLoadMs);
+
+	// Peak resident memory of the process, 0 if the platform can't tell.
+	static uint64_t getPeakMemoryBytes();
+
+	static std::string escapeJson(const std::string& text);
+
+	// Run description (device, resolution, models ect.) is written as given, as a JSON object body.
+	void writeReport(const std::string& fileName, const std::string& runInfo);
+
+	~Benchmark();
+
+private:
+	struct Summary {
+		double min = 0.0;
+		double mean = 0.0;
+		double p50 = 0.0;
+		double p95 = 0.0;
+		double p99 = 0.0;
+	};
+
+	uint32_t warmupFrames = 0;
+	uint32_t measuredFrames = 0;
+
+	uint64_t seenFrames = 0;
+	uint64_t seenGpuFrames = 0;
+	std::vector<double> frameMs;
+	std::vector<double> cpuMs;
+	std::vector<double> gpuMs;
+	double loadMs = 0.0;
+
+	static Summary summarize(std::vector<double> samples);
+	static std::string toJson(const Summary& summary);
+};
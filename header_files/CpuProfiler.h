@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Scoped CPU zones, dumped as a Chrome trace (chrome://tracing, Perfetto).
+// Each thread writes finished zones into its own fixed size buffer, so recording a zone never locks or allocates
+// (only a thread's first zone registers its buffer). Zones past a buffer's capacity are dropped and counted.
+//
+// Zones are compiled out unless ENABLE_CPU_PROFILER is defined (compiler flag / project preprocessor definitions),
+// then PROFILE_ZONE costs nothing.
+class CpuProfiler
+{
+public:
+	// Nanoseconds since program start.
+	static int64_t now();
+
+	static void recordZone(const char* name, int64_t start, int64_t end);
+	static void setThreadName(const char* name);
+
+	static bool isCompiledIn();
+
+	// Call while no thread is recording zones.
+	static void writeChromeTrace(const std::string& fileName);
+};
+
+// Records the time between construction and destruction as one zone. name must outlive the profiler (string literals).
+class CpuProfileZone
+{
+public:
+	CpuProfileZone(const char* newName);
+	~CpuProfileZone();
+
+private:
+	const char* name;
+	int64_t start;
+};
+
+#ifdef ENABLE_CPU_PROFILER
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) CpuProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_THREAD(name) CpuProfiler::setThreadName(name)
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_THREAD(name)
+#endif
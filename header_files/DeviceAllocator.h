@@ -0,0 +1,114 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <set>
+#include <mutex>
+#include <cstdint>
+
+// What an allocation is for, so memory use can be broken down (see MemoryTelemetry).
+enum MemoryCategory {
+	MEMORY_GEOMETRY,
+	MEMORY_TEXTURES,
+	MEMORY_ATTACHMENTS,					// Render targets, offscreen and intermediate images.
+	MEMORY_UNIFORMS,
+	MEMORY_STAGING,						// Host visible copy sources and readback.
+	MEMORY_OTHER,
+	MEMORY_CATEGORY_COUNT
+};
+
+// A piece of a device memory block. Bind with memory + offset, free through the allocator that made it.
+struct DeviceAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;				// Requested size, the buddy node behind it may be bigger.
+	void* mapped = nullptr;				// Host visible memory only. Already at offset, stays valid until freed.
+
+	uint32_t pool = 0;
+	uint32_t block = 0;
+	uint32_t order = 0;
+	bool dedicated = false;
+	MemoryCategory category = MEMORY_OTHER;
+};
+
+struct DeviceAllocatorStats {
+	uint64_t blockCount = 0;			// Live VkDeviceMemory objects, dedicated ones included.
+	uint64_t blockBytes = 0;
+	uint64_t peakBlockBytes = 0;
+	uint64_t allocationCount = 0;		// Live sub-allocations.
+	uint64_t requestedBytes = 0;
+	uint64_t allocatedBytes = 0;		// Requested sizes rounded up to buddy nodes.
+	uint64_t dedicatedCount = 0;		// Allocations too big for a block (or lazily allocated), they got their own memory.
+	uint64_t vkAllocateCalls = 0;		// Total over the allocator's life.
+	uint64_t categoryBytes[MEMORY_CATEGORY_COUNT] = {};	// Requested bytes per category.
+	uint64_t heapBytes[VK_MAX_MEMORY_HEAPS] = {};		// Live VkDeviceMemory bytes per heap.
+};
+
+// Sub-allocates buffers and images from a few large blocks per memory type instead of one vkAllocateMemory each.
+// Each block is a buddy allocator: power of 2 nodes, aligned to their own size, so any alignment up to the node size is free.
+// bufferImageGranularity: linear resources (buffers, linear images) and optimal images get separate blocks, so they can
+// never be neighbours on one page. Skipped when the device has no granularity to respect.
+// Host visible blocks are mapped once when created, allocations hand out pointers into that mapping.
+// Thread safe.
+class DeviceAllocator
+{
+public:
+	DeviceAllocator();
+
+	void createDeviceAllocator(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice);
+
+	DeviceAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear,
+		MemoryCategory category);
+	void free(DeviceAllocation& allocation);
+
+	// Create a buffer and bind it to new memory.
+	void createBuffer(VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkMemoryPropertyFlags bufferProperties,
+		MemoryCategory category, VkBuffer* buffer, DeviceAllocation* allocation);
+	void destroyBuffer(VkBuffer buffer, DeviceAllocation& allocation);
+
+	// Is any of allowedTypes a memory type with all of properties.
+	bool hasMemoryType(uint32_t allowedTypes, VkMemoryPropertyFlags properties);
+	VkMemoryPropertyFlags getPropertyFlags(const DeviceAllocation& allocation);
+	const VkPhysicalDeviceMemoryProperties& getMemoryProperties();
+
+	DeviceAllocatorStats getStats();
+	void printStats();
+
+	void destroyDeviceAllocator();
+
+	~DeviceAllocator();
+
+private:
+	struct Block {
+		VkDeviceMemory memory = VK_NULL_HANDLE;		// VK_NULL_HANDLE = released slot, reused by the next new block.
+		uint8_t* mapped = nullptr;
+		VkDeviceSize usedBytes = 0;
+		std::vector<std::set<VkDeviceSize>> freeLists;	// [order] offsets of free nodes
+	};
+
+	struct Pool {
+		uint32_t memoryType = 0;
+		std::vector<Block> blocks;
+	};
+
+	VkDevice device;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	VkDeviceSize bufferImageGranularity = 1;
+	uint32_t maxAllocationCount = 0;
+
+	VkDeviceSize blockSize = 0;
+	uint32_t maxOrder = 0;							// blockSize = MIN_NODE_SIZE << maxOrder
+
+	std::vector<Pool> pools;						// [memory type * 2 + optimal]
+	DeviceAllocatorStats stats;
+	std::mutex mutex;
+
+	uint32_t findMemoryType(uint32_t allowedTypes, VkMemoryPropertyFlags properties);
+	VkDeviceMemory allocateMemory(uint32_t memoryType, VkDeviceSize size, uint8_t** mapped);
+	void freeMemory(uint32_t memoryType, VkDeviceMemory memory, VkDeviceSize size, bool isMapped);
+
+	bool allocateNode(Block& block, uint32_t order, VkDeviceSize* offset);
+	void freeNode(Block& block, uint32_t order, VkDeviceSize offset);
+};
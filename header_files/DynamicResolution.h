@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Utilities.h"
+
+// Picks the internal render resolution from measured GPU frame times.
+// Render targets stay allocated at the full size, only the rendered region (scale * full size) changes.
+// Hysteresis: scale drops after a few frames over the target, only goes back up after a longer run comfortably
+// under it, and every change is followed by a cooldown while frames at the old scale drain out.
+class DynamicResolution
+{
+public:
+	DynamicResolution();
+	DynamicResolution(float newTargetMs, float newMinScale, float newMaxScale);
+
+	// Feed the GPU time of one finished frame. Returns true if the scale changed.
+	bool update(double gpuMs);
+
+	float getScale();
+
+	// Scaled size inside fullExtent, never 0.
+	VkExtent2D getExtent(VkExtent2D fullExtent);
+
+	~DynamicResolution();
+
+private:
+	float targetMs = 16.6f;
+	float minScale = 0.5f;
+	float maxScale = 1.0f;
+	float scale = 1.0f;
+
+	double smoothedMs = 0.0;		// Moving average of GPU time, 0 until the first sample after a change.
+	uint32_t framesOver = 0;		// Consecutive frames over the target.
+	uint32_t framesUnder = 0;		// Consecutive frames under the lower band.
+	uint32_t cooldown = 0;			// Frames left to ignore after a change.
+
+	float quantize(float newScale);
+};
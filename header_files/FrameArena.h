@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Linear (bump) allocator for scratch data that only lives for one frame.
+// Keep one per frame in flight and reset it once that frame's fence has signalled.
+// If a frame needs more than the capacity, the overflow falls back to the heap and the
+// next reset() grows the block, so the steady state makes no heap allocations.
+class FrameArena
+{
+public:
+	FrameArena();
+	FrameArena(size_t newCapacity);
+
+	void reset();
+
+	void* allocate(size_t size, size_t alignment);
+
+	template<typename T>
+	T* allocateArray(size_t count)
+	{
+		return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	size_t getUsed();
+	size_t getCapacity();
+
+	~FrameArena();
+
+private:
+	std::vector<uint8_t> block;
+	size_t offset = 0;
+
+	std::vector<std::vector<uint8_t>> overflowBlocks;	// Heap fallback for this frame only.
+	size_t overflowBytes = 0;
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Utilities.h"
+
+// Paces frames with one timeline semaphore instead of a fence per frame.
+// Every submit signals the next value of the timeline. A frame slot (or swapchain image) is free again once the
+// timeline reached the value of the last submit that used it, so waiting is just comparing counters.
+// Binary semaphores are only kept for acquire and present, which can't take timeline semaphores.
+class FrameScheduler
+{
+public:
+	FrameScheduler();
+
+	// presenting = false for headless, then no acquire/present semaphores are made or waited on.
+	void createFrameScheduler(VkDevice newDevice, uint32_t newFrameCount, uint32_t imageCount, bool newPresenting);
+
+	uint32_t getFrameCount();
+	uint32_t getCurrentFrame();
+	uint64_t getFrameNumber();		// Frames begun so far.
+
+	// Blocks until the current frame slot's last submit finished on the GPU.
+	void beginFrame();
+
+	// Blocks until the last submit rendering to this image finished.
+	void waitForImage(uint32_t image);
+
+	// Current frame's semaphores for vkAcquireNextImageKHR / vkQueuePresentKHR.
+	VkSemaphore getImageAvailable();
+	VkSemaphore getRenderFinished();
+
+	// Submit the frame's command buffer. Waits for the acquire and signals the timeline (and present semaphore).
+	void submit(VkQueue queue, VkCommandBuffer commandBuffer, uint32_t image);
+
+	// Move on to the next frame slot.
+	void endFrame();
+
+	// Time the CPU spent blocked on the GPU in beginFrame() + waitForImage() of the last frame.
+	double getLastWaitMs();
+	double getTotalWaitMs();
+	double getMaxWaitMs();
+
+	void destroyFrameScheduler();
+
+	~FrameScheduler();
+
+private:
+	VkDevice device;
+	bool presenting = true;
+
+	VkSemaphore timeline = VK_NULL_HANDLE;
+	uint64_t submittedValue = 0;			// Last value a submit will signal.
+	std::vector<uint64_t> frameValues;		// Per frame slot, value of its last submit.
+	std::vector<uint64_t> imageValues;		// Per image, value of the last submit rendering to it.
+
+	std::vector<VkSemaphore> imageAvailable;
+	std::vector<VkSemaphore> renderFinished;
+
+	uint32_t frameCount = 0;
+	uint32_t currentFrame = 0;
+	uint64_t frameNumber = 0;
+
+	// - Wait statistics
+	double currentWaitMs = 0.0;
+	double lastWaitMs = 0.0;
+	double totalWaitMs = 0.0;
+	double maxWaitMs = 0.0;
+
+	void waitForValue(uint64_t value);
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Utilities.h"
+#include "DeviceAllocator.h"
+
+// One persistently mapped, host coherent buffer per frame in flight.
+// Each frame starts again from the beginning of its own buffer and sub-allocates everything the
+// shaders read that frame, aligned so each region can be bound with a dynamic offset.
+// Nothing is mapped or unmapped after creation.
+class FrameUniformRing
+{
+public:
+	FrameUniformRing();
+
+	void createFrameUniformRing(DeviceAllocator* newAllocator, VkPhysicalDevice physicalDevice, VkDeviceSize newFrameSize,
+		uint32_t frameCount, VkBufferUsageFlags usage);
+
+	// Start sub-allocating from the given frame's buffer. Only once that frame is no longer in flight.
+	void beginFrame(uint32_t frame);
+
+	// Offset of a new region in the current frame's buffer and where it is mapped.
+	uint32_t allocate(VkDeviceSize size);
+	void* getMapped(uint32_t offset);
+
+	VkBuffer getBuffer(uint32_t frame);
+	VkDeviceSize getAlignment();
+
+	void destroyFrameUniformRing();
+
+	~FrameUniformRing();
+
+private:
+	DeviceAllocator* allocator;
+	VkDeviceSize frameSize = 0;
+	VkDeviceSize alignment = 1;
+
+	std::vector<VkBuffer> buffers;
+	std::vector<DeviceAllocation> bufferAllocations;
+	std::vector<uint8_t*> mappedData;
+
+	uint32_t currentFrame = 0;
+	VkDeviceSize currentOffset = 0;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Utilities.h"
+
+// Model space bounds of a mesh, taken from its float vertices at import.
+struct MeshBounds {
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+	glm::vec3 sphereCenter = glm::vec3(0.0f);
+	float sphereRadius = 0.0f;
+};
+
+// Bounds of a box under transform: the transformed box's bounding box, and the sphere moved and grown by the largest axis scale.
+MeshBounds transformBounds(const MeshBounds& bounds, const glm::mat4& transform);
+
+// Tests world space boxes against the view frustum, four boxes per SSE instruction (plain loop without SSE).
+// Boxes are kept as centre/extent in structure of arrays form. Storage is reused, so after the first frames
+// a cull makes no heap allocations.
+class FrustumCuller
+{
+public:
+	FrustumCuller();
+
+	// Starts a new set of boxes tested against viewProjection's frustum.
+	void begin(const glm::mat4& viewProjection);
+
+	// Model space box under transform. The world box is the transformed box's bounding box.
+	void addBox(const MeshBounds& bounds, const glm::mat4& transform);
+
+	// visible[i] = 1 if box i may be in view, 0 if it is certainly outside. Returns the visible count.
+	size_t cull(uint8_t* visible);
+
+	size_t getBoxCount();
+
+	// Normalized planes (xyz pointing inwards, w distance) in the space clip maps from. Vulkan depth is 0..1.
+	static void extractPlanes(const glm::mat4& clip, glm::vec4 planes[6]);
+
+	~FrustumCuller();
+
+private:
+	glm::vec4 planes[6];
+	size_t boxCount = 0;
+
+	// Padded to a multiple of 4 so the SIMD loop never reads past the end.
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+};
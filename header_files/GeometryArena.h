@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Utilities.h"
+#include "DeviceAllocator.h"
+#include "UploadManager.h"
+
+// Bytes [offset, offset + count) of one of the arena's buffers.
+struct GeometryRange {
+	uint32_t offset = 0;
+	uint32_t count = 0;
+};
+
+// Vertices and indices of every mesh packed into one device local vertex buffer and one index buffer.
+// Recording binds both once, meshes are drawn with firstIndex/vertexOffset. Meshes of any vertex layout share the
+// vertex buffer, each mesh's vertices start at a multiple of its stride so vertexOffset stays a whole vertex count.
+// 16 and 32 bit indices share the index buffer the same way, recording rebinds it when the index type changes.
+// Ranges are handed out first fit from a list of free ranges sorted by offset, freed ranges merge with free neighbours.
+// A buffer that runs out of space is replaced by one at least twice as big, the used ranges are copied over on the GPU.
+// Offsets stay the same, but command buffers recorded with the old buffer must be re-recorded after adding meshes.
+class GeometryArena
+{
+public:
+	GeometryArena();
+
+	// Capacities are only the starting sizes.
+	void createGeometryArena(DeviceAllocator* newAllocator, UploadManager* newUploadManager, uint32_t newVertexByteCapacity, uint32_t newIndexByteCapacity);
+
+	// Queue a mesh's copy on the upload manager. Usable by anything submitted to its queue after the next flush.
+	// vertexData is already in the mesh's layout, vertexStride bytes per vertex. indexData is indexSize (2 or 4) bytes per index.
+	void addMesh(const std::vector<uint8_t>& vertexData, uint32_t vertexStride, const std::vector<uint8_t>& indexData, uint32_t indexSize,
+		GeometryRange* vertexRange, GeometryRange* indexRange);
+
+	// Ranges can be reused right away, so only free them once no frame in flight draws them.
+	void freeMesh(GeometryRange& vertexRange, GeometryRange& indexRange);
+
+	VkBuffer getVertexBuffer();
+	VkBuffer getIndexBuffer();
+
+	uint32_t getUsedVertexBytes();
+	uint32_t getUsedIndexBytes();
+	uint32_t getVertexByteCapacity();
+	uint32_t getIndexByteCapacity();
+
+	// Call every frame after waiting for its slot. frameNumber counts frames begun, every frame up to completedFrame
+	// finished on the GPU. Buffers replaced by growth are destroyed once no frame begun before the growth can use them.
+	void destroyRetiredBuffers(uint64_t frameNumber, uint64_t completedFrame);
+
+	void destroyGeometryArena();
+
+	~GeometryArena();
+
+private:
+	DeviceAllocator* allocator;
+	UploadManager* uploadManager;
+
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	DeviceAllocation vertexBufferAllocation;
+	uint32_t vertexByteCapacity = 0;
+	uint32_t usedVertexBytes = 0;
+	std::vector<GeometryRange> freeVertexRanges;
+
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	DeviceAllocation indexBufferAllocation;
+	uint32_t indexByteCapacity = 0;
+	uint32_t usedIndexBytes = 0;
+	std::vector<GeometryRange> freeIndexRanges;
+
+	struct RetiredBuffer {
+		VkBuffer buffer;
+		DeviceAllocation allocation;
+		uint64_t frame;					// First frame begun after it was replaced, 0 until a frame began.
+	};
+	std::vector<RetiredBuffer> retiredBuffers;
+
+	void growBuffer(VkBuffer* buffer, DeviceAllocation* allocation, uint32_t* capacity, std::vector<GeometryRange>& freeRanges,
+		VkBufferUsageFlags usage, uint32_t count, uint32_t alignment);
+	static bool allocateRange(std::vector<GeometryRange>& freeRanges, uint32_t count, uint32_t alignment, GeometryRange* range);
+	static void freeRange(std::vector<GeometryRange>& freeRanges, const GeometryRange& range);
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Utilities.h"
+#include "DeviceAllocator.h"
+#include "Mesh.h"
+
+// One mesh as the cull shader and the indirect vertex shader read it. Matches DrawRecord in cull.comp and shader.vert (std430).
+struct GpuDrawRecord {
+	glm::vec4 sphere;				// Model space bounding sphere around every instance, xyz centre, w radius.
+	VertexDequantize dequantize;
+	uint32_t model;					// Transform index.
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t batch;
+	uint32_t batchFirstCommand;
+	uint32_t firstInstance;			// The model's first transform in the instance buffer.
+	uint32_t instanceCount;
+	uint32_t texture;				// Index into the bindless texture array, passed on to the fragment shader.
+	uint32_t padding[3];
+};
+
+// Meshes sharing a pipeline, index type and texture (any texture with bindless textures, texId is then -1). Drawn with one indirect call of up to maxDrawCount commands.
+struct GpuDrawBatch {
+	VertexLayout layout;
+	VkIndexType indexType;
+	int texId;
+	uint32_t firstCommand;
+	uint32_t maxDrawCount;
+};
+
+// GPU driven subpass 0. Every mesh's draw record and bounds live in a storage buffer, a compute pass tests the bounding
+// spheres against the frustum and writes VkDrawIndexedIndirectCommands, and each batch is one indirect draw.
+// With drawIndirectCount, visible commands are compacted and counted per batch. Without it every mesh keeps its
+// command slot and culled ones get instanceCount 0.
+// firstInstance is the record index. The vertex shader finds its record through gl_BaseInstance (shaderDrawParameters),
+// and its instance transform at record.firstInstance + gl_InstanceIndex - gl_BaseInstance.
+// Records, frustum and transforms are host written per frame in flight, command buffers never change with the camera.
+class GpuCuller
+{
+public:
+	GpuCuller();
+
+	void createGpuCuller(DeviceAllocator* newAllocator, VkDevice newDevice, uint32_t newFrameCount,
+		bool newDrawIndirectCount, bool newMultiDrawIndirect, bool newBindlessTextures);
+
+	// - Scene, whenever meshes are added. Records are sorted into batches by finishDraws().
+	void clearDraws();
+	// bounds = the mesh's bounds around all instances, in the model's space.
+	void addDraw(Mesh* mesh, const MeshBounds& bounds, uint32_t model, uint32_t firstInstance, uint32_t instanceCount);
+	void finishDraws();
+	// Instances moved: replace a draw's sphere in place, batches and command slots stay. draw = index of its addDraw() call.
+	void setDrawBounds(uint32_t draw, const MeshBounds& bounds);
+
+	// - Per frame, once the frame slot is no longer in flight.
+	void beginFrame(uint32_t frame, const glm::mat4& viewProjection);
+	void setTransform(uint32_t model, const glm::mat4& transform);
+
+	// - Recording
+	// Clears the counts and runs the cull shader. Outside a render pass.
+	void recordCull(VkCommandBuffer commandBuffer, uint32_t frame);
+	// The batch's indirect draw. Pipeline, index buffer and descriptor sets are the caller's.
+	void recordBatch(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t batch);
+
+	// Set 2 of the indirect graphics pipelines, the cull shader's only set.
+	VkDescriptorSetLayout getDescriptorSetLayout();
+	VkDescriptorSet getDescriptorSet(uint32_t frame);
+
+	const std::vector<GpuDrawBatch>& getBatches();
+	size_t getDrawCount();
+	bool usesDrawCount();
+
+	void destroyGpuCuller();
+
+	~GpuCuller();
+
+private:
+	DeviceAllocator* allocator;
+	VkDevice device;
+	uint32_t frameCount = 0;
+	bool drawIndirectCount = false;
+	bool multiDrawIndirect = false;
+	bool bindlessTextures = false;					// Don't split batches by texture.
+
+	VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> descriptorSets;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+
+	// Per frame in flight.
+	std::vector<VkBuffer> recordBuffers;			// Host visible GpuDrawRecords.
+	std::vector<DeviceAllocation> recordAllocations;
+	std::vector<VkBuffer> sceneBuffers;				// Host visible frustum planes followed by one transform per model.
+	std::vector<DeviceAllocation> sceneAllocations;
+	std::vector<VkBuffer> commandBuffers;			// VkDrawIndexedIndirectCommands written by the cull shader.
+	std::vector<DeviceAllocation> commandAllocations;
+	std::vector<VkBuffer> countBuffers;				// Draw count per batch.
+	std::vector<DeviceAllocation> countAllocations;
+	std::vector<uint64_t> frameDrawVersions;		// drawVersion each frame's record buffer holds.
+	std::vector<uint32_t> frameDirtyBegin;			// Records [begin, end) whose spheres changed since the frame's buffer was written.
+	std::vector<uint32_t> frameDirtyEnd;
+
+	std::vector<GpuDrawRecord> records;
+	std::vector<GpuDrawBatch> recordKeys;			// Batch each record belongs in, until finishDraws() sorts them.
+	std::vector<GpuDrawBatch> batches;
+	std::vector<uint32_t> drawRecords;				// Sorted record index of each draw, in addDraw() order.
+	std::vector<uint32_t> sortOrder;				// finishDraws() scratch, kept so rebuilds reuse the space.
+	std::vector<GpuDrawRecord> sortedRecords;
+	uint64_t drawVersion = 0;
+	uint32_t currentFrame = 0;
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "Utilities.h"
+
+// Timestamp scopes written into the command buffers and read back once the frame finished.
+// Every frame slot owns a block of MAX_GPU_SCOPES begin/end query pairs. Scopes are reserved per command buffer
+// while recording it (cached command buffers keep their scopes until re-recorded), and collected when the frame
+// slot comes round again, after its timeline wait, so reading results never stalls.
+// Scope 0 of every command buffer is the whole frame. Scopes are also VK_EXT_debug_utils labels when the instance enabled it.
+// Captured scopes go into a buffer reserved up front, frames that don't fit are dropped and counted.
+class GpuProfiler
+{
+public:
+	static const uint32_t NO_SCOPE = UINT32_MAX;
+
+	GpuProfiler();
+
+	// Returns false and stays disabled if the queue family can't write timestamps.
+	// capture = keep every collected scope for writeCsv()/writeChromeTrace(), otherwise only the frame time is kept.
+	// debugUtils = the instance enabled VK_EXT_debug_utils, scopes are labelled only then.
+	bool createGpuProfiler(VkPhysicalDevice physicalDevice, VkDevice newDevice, VkInstance instance, uint32_t queueFamily,
+		uint32_t newFrameCount, uint32_t commandBufferCount, bool newCapture, bool debugUtils);
+
+	bool isEnabled();
+	bool isCapturing();
+
+	// Names used for per model scopes. Call before recording with more models.
+	void setModelCount(uint32_t count);
+
+	// - Recording, main thread
+	// Forget the scopes of a command buffer about to be re-recorded.
+	void beginRecording(uint32_t commandBufferIndex);
+	// First of count new scopes, NO_SCOPE if the frame's block is full.
+	uint32_t reserveScopes(uint32_t commandBufferIndex, uint32_t count);
+	// Reset the command buffer's queries. Outside a render pass, before any scope is written.
+	void resetQueries(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t commandBufferIndex);
+
+	// - Recording, any thread. A scope must only be written by one thread.
+	// model >= 0 names the scope after that model instead of name.
+	void beginScope(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t commandBufferIndex, uint32_t scope, const char* name, int32_t model = -1);
+	void endScope(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t scope);
+	void writeBeginTimestamp(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t commandBufferIndex, uint32_t scope, const char* name, int32_t model = -1);
+	void writeEndTimestamp(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t scope);
+	void beginLabel(VkCommandBuffer commandBuffer, const char* name, int32_t model = -1);
+	void endLabel(VkCommandBuffer commandBuffer);
+
+	// - Frames
+	void submitted(uint32_t frame, uint32_t commandBufferIndex);
+	// Read back the frame slot's last submit. Only once its timeline value was reached.
+	// Returns true if there was a new frame time.
+	bool collect(uint32_t frame);
+	double getLastFrameMs();
+
+	void writeCsv(const std::string& fileName);
+	void writeChromeTrace(const std::string& fileName);
+
+	void destroyGpuProfiler();
+
+	~GpuProfiler();
+
+private:
+	struct Scope {
+		const char* name;
+		int32_t model;
+	};
+
+	struct Event {
+		uint64_t frame;
+		const char* name;
+		int32_t model;
+		double startMs;			// Since the first collected frame.
+		double durationMs;
+	};
+
+	VkDevice device;
+	bool enabled = false;
+	bool capture = false;
+
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	uint32_t frameCount = 0;
+	float timestampPeriod = 1.0f;				// Nanoseconds per tick.
+	uint64_t timestampMask = ~0ull;				// Valid bits of a timestamp.
+
+	std::vector<std::vector<Scope>> scopes;		// [command buffer][scope]
+	std::vector<uint32_t> pendingCommandBuffer;	// Per frame slot, command buffer submitted last and not collected. UINT32_MAX if none.
+	std::vector<uint64_t> results;				// Readback space for one frame's queries.
+
+	std::vector<std::string> modelNames;
+
+	uint64_t collectedFrames = 0;
+	uint64_t baseTimestamp = 0;
+	double lastFrameMs = 0.0;
+	std::vector<Event> events;
+	uint64_t droppedFrames = 0;				// Captured frames that didn't fit into events.
+
+	PFN_vkCmdBeginDebugUtilsLabelEXT cmdBeginLabel = nullptr;
+	PFN_vkCmdEndDebugUtilsLabelEXT cmdEndLabel = nullptr;
+
+	const char* getScopeName(const char* name, int32_t model);
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Utilities.h"
+#include "DeviceAllocator.h"
+
+struct MemoryHeapReport {
+	VkDeviceSize size = 0;
+	VkDeviceSize budget = 0;			// What this process may use. Heap size without VK_EXT_memory_budget.
+	VkDeviceSize usage = 0;				// Driver reported (all of the process), our own blocks without the extension.
+	bool deviceLocal = false;
+};
+
+struct MemoryReport {
+	MemoryHeapReport heaps[VK_MAX_MEMORY_HEAPS];	// Fixed size like the device's own heap list, so a report never allocates.
+	uint32_t heapCount = 0;
+	VkDeviceSize categoryBytes[MEMORY_CATEGORY_COUNT] = {};
+	VkDeviceSize allocatedBytes = 0;	// All VkDeviceMemory the allocator holds, block slack included.
+	VkDeviceSize deviceLocalBytes = 0;	// The part of it on device local heaps.
+	bool driverBudget = false;			// Heap budget/usage came from VK_EXT_memory_budget.
+};
+
+// Device memory use per heap and per category, against the driver's budget (VK_EXT_memory_budget when the device
+// has it, heap sizes and the allocator's own accounting otherwise) and an optional budget of our own.
+// update() once per frame logs every few frames and warns when a budget is exceeded (once per crossing).
+class MemoryTelemetry
+{
+public:
+	MemoryTelemetry();
+
+	// newBudget: bytes of device local memory the app should stay under, 0 = driver budget only.
+	// newLogInterval: frames between log lines, 0 = never.
+	void createMemoryTelemetry(DeviceAllocator* newAllocator, VkPhysicalDevice newPhysicalDevice, bool newHasBudgetExtension,
+		VkDeviceSize newBudget, uint32_t newLogInterval);
+
+	// Fills the telemetry's own report in place and returns it. Valid until the next query()/update().
+	const MemoryReport& query();
+	void update();
+
+	void printReport(const MemoryReport& report);
+	static const char* getCategoryName(MemoryCategory category);
+
+	~MemoryTelemetry();
+
+private:
+	DeviceAllocator* allocator = nullptr;
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	bool hasBudgetExtension = false;
+	VkDeviceSize budget = 0;
+	uint32_t logInterval = 0;
+
+	uint64_t frame = 0;
+	bool overBudget = false;			// Warned already, quiet until usage drops below again.
+	MemoryReport lastReport;			// Filled by query(), never reallocated.
+
+	void checkBudget(const MemoryReport& report);
+};
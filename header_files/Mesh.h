@@ -6,6 +6,10 @@
 #include <vector>
 
 #include "Utilities.h"
+#include "GeometryArena.h"
+#include "VertexLayout.h"
+#include "Meshlet.h"
+#include "FrustumCuller.h"
 
 struct Model {
 	glm::mat4 model;
@@ -15,21 +19,31 @@ class Mesh
 {
 public:
 	Mesh();
-	Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice,
-		VkQueue transferQueue, VkCommandPool transferCommandPool,
+	Mesh(GeometryArena* newArena, VertexLayout newLayout,
 		std::vector<Vertex>* vertices, std::vector<uint32_t>* indices,
 		int newTexId);
 
 	void setModel(glm::mat4 newModel);
-	Model getModel();
+	const Model& getModel();
 
 	int getTexId();
 
+	VertexLayout getVertexLayout();
+	const VertexDequantize& getDequantize();
+
+	// Where the mesh lives in the geometry arena's buffers.
 	int getVertexCount();
-	VkBuffer getVertexBuffer();
+	int32_t getVertexOffset();
 
 	int getIndexCount();
-	VkBuffer getIndexBuffer();
+	uint32_t getFirstIndex();
+	VkIndexType getIndexType();
+
+	const MeshBounds& getBounds();
+
+	// Empty unless meshlets were built at load.
+	void setMeshlets(std::vector<Meshlet> newMeshlets);
+	const std::vector<Meshlet>& getMeshlets();
 
 	void destroyBuffers();
 
@@ -39,18 +53,17 @@ private:
 	Model model;
 	int texId;
 
-	int vertexCount;
-	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
+	VertexLayout layout;
+	VertexDequantize dequantize;
+	VkIndexType indexType;
+	std::vector<Meshlet> meshlets;
+	MeshBounds bounds;
 
-	int indexCount;
-	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
+	GeometryRange vertexRange;
+	GeometryRange indexRange;
 
-	VkPhysicalDevice physicalDevice;
-	VkDevice device;
+	GeometryArena* arena;
 
-	void createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex>* vertices);
-	void createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t>* indices);
+	uint32_t getIndexSize();
 };
 
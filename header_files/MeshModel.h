@@ -8,6 +8,13 @@
 
 #include "Mesh.h"
 
+// How LoadNode/LoadMesh prepare each mesh.
+struct MeshLoadOptions {
+	VertexLayout vertexLayout = VERTEX_LAYOUT_FULL;
+	bool optimize = false;			// Run the mesh optimizer and print its before/after numbers.
+	bool buildMeshlets = false;		// Split into meshlets for cluster culling.
+};
+
 class MeshModel
 {
 public:
@@ -20,17 +27,29 @@ public:
 	glm::mat4 getModel();
 	void setModel(glm::mat4 newModel);
 
+	// Every mesh is drawn once per instance, each instance placed by getModel() * its transform.
+	// A model starts with one identity instance.
+	uint32_t addInstance(const glm::mat4& transform);
+	void setInstance(uint32_t index, const glm::mat4& transform);
+	const std::vector<glm::mat4>& getInstances();
+	uint32_t getInstanceCount();
+
+	// Bounds of the mesh under every instance's transform, in the model's space. Recomputed after instances change.
+	const MeshBounds& getInstanceBounds(size_t index);
+
 	void destroyMeshModel();
 
 	static std::vector<std::string> LoadMaterials(const aiScene* scene);
-	static std::vector<Mesh> LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool,
-		aiNode* node, const aiScene* scene, std::vector<int> matToTex);
-	static Mesh LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool,
-		aiMesh* mesh, const aiScene* scene, std::vector<int> matToTex);
+	static std::vector<Mesh> LoadNode(GeometryArena* arena, const MeshLoadOptions& options, aiNode* node, const aiScene* scene, std::vector<int> matToTex);
+	static Mesh LoadMesh(GeometryArena* arena, const MeshLoadOptions& options, aiMesh* mesh, const aiScene* scene, std::vector<int> matToTex);
 
 	~MeshModel();
 
 private:
 	std::vector<Mesh> meshList;
 	glm::mat4 model;
+
+	std::vector<glm::mat4> instances;
+	std::vector<MeshBounds> instanceBounds;		// One per mesh.
+	bool instanceBoundsDirty = true;
 };
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Utilities.h"
+
+// Before/after numbers of one optimized mesh. ACMR = vertex shader invocations per triangle with a
+// VERTEX_CACHE_SIZE FIFO post-transform cache (0.5 is the ideal for large grids, 3 is no reuse at all).
+struct MeshOptimizeStats {
+	uint32_t triangles = 0;
+	uint32_t verticesBefore = 0;
+	uint32_t verticesAfter = 0;
+	float acmrBefore = 0.0f;
+	float acmrAfter = 0.0f;
+	uint64_t bytesBefore = 0;		// Vertices plus 32 bit indices as loaded.
+	uint64_t bytesAfter = 0;		// Vertices plus indices at the width the mesh ends up with.
+};
+
+// Triangle list reordering done once at import:
+// 1. vertex cache: Forsyth's linear speed greedy ordering, so triangles reuse recently transformed vertices.
+// 2. overdraw: splits the cache friendly order where the simulated cache starts over and draws the pieces
+//    facing away from the mesh centre first, so outer surfaces fill depth before what they hide.
+// 3. vertex fetch: renumbers vertices in first use order (dropping unused ones) so fetches walk memory forwards.
+float computeAcmr(const std::vector<uint32_t>& indices, uint32_t vertexCount);
+
+void optimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount);
+void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices);
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+// All three passes. vertexStride is the GPU layout's, for the byte counts.
+MeshOptimizeStats optimizeMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t vertexStride);
+
+// Meshes with fewer than 65536 vertices get 16 bit indices.
+bool useShortIndices(uint32_t vertexCount);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Utilities.h"
+
+// A run of a mesh's triangles, at most MESHLET_MAX_VERTICES unique vertices and MESHLET_MAX_TRIANGLES triangles.
+// Meshlets are consecutive ranges of the mesh's index list, so visible neighbours still draw as one range.
+// Bounds are in model space.
+struct Meshlet {
+	glm::vec3 center;
+	float radius;
+	glm::vec3 coneAxis;		// Average facing of its triangles.
+	float coneCutoff;		// sin of the cone's half angle. 1 = normals too spread out to ever cull.
+	uint32_t firstIndex;	// Relative to the mesh's first index.
+	uint32_t indexCount;
+};
+
+// What a meshlet is tested against: one model's frustum planes and the camera, both in that model's space.
+struct ClusterCullView {
+	glm::vec4 planes[6];	// xyz normal pointing inwards, w distance. Normalized.
+	glm::vec3 cameraPosition;
+};
+
+enum ClusterVisibility {
+	CLUSTER_VISIBLE,
+	CLUSTER_BACKFACING,
+	CLUSTER_OUTSIDE_FRUSTUM
+};
+
+struct ClusterCullStats {
+	uint64_t visible = 0;
+	uint64_t backfacing = 0;
+	uint64_t outsideFrustum = 0;
+	uint64_t draws = 0;			// Draw calls the visible meshlets merged into.
+};
+
+// Splits a triangle list into meshlets in index order. Works best on cache optimized meshes, whose runs are compact.
+std::vector<Meshlet> buildMeshlets(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+
+// View of the model with transform model. cameraPosition is in world space.
+ClusterCullView makeClusterCullView(const glm::mat4& viewProjection, const glm::mat4& model, const glm::vec3& cameraPosition);
+
+ClusterVisibility testCluster(const Meshlet& meshlet, const ClusterCullView& view);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "Utilities.h"
+
+// 64 bit sort key of one CPU draw. Most significant first, so sorted draws group by the state they bind:
+//   63-60  vertex layout (pipeline)
+//   59     index type (index buffer binding)
+//   58-43  texture (descriptor set 1), or whatever else the caller rebinds per draw
+//   42-27  view depth of the mesh's nearest point, so each state group draws front to back
+//   26-0   the draw's index. Keys are unique, ties keep scene order, and the key is its own payload.
+uint64_t makeDrawKey(VertexLayout layout, VkIndexType indexType, uint32_t texture, float depth, uint32_t draw);
+uint32_t getDrawKeyIndex(uint64_t key);
+
+// LSD radix sort, one byte per pass. Passes where every key has the same byte are skipped, so a scene with few
+// pipelines and textures costs fewer passes. scratch must hold count keys.
+void radixSortKeys(uint64_t* keys, uint64_t* scratch, size_t count);
+
+// State binds while recording the CPU draw list, and the ones skipped because the previous draw left it bound.
+struct BindStats {
+	uint64_t binds = 0;
+	uint64_t skipped = 0;
+};
@@ -17,11 +17,31 @@
 #include <set>
 #include <algorithm>
 #include <array>
+#include <memory>
+#include <chrono>
 
 #include "stb_image.h"
 
 #include "Mesh.h"
 #include "MeshModel.h"
+#include "ThreadPool.h"
+#include "FrameArena.h"
+#include "AllocationCounter.h"
+#include "DeviceAllocator.h"
+#include "UploadManager.h"
+#include "MemoryTelemetry.h"
+#include "GeometryArena.h"
+#include "VertexLayout.h"
+#include "Meshlet.h"
+#include "FrustumCuller.h"
+#include "GpuCuller.h"
+#include "RenderQueue.h"
+#include "FrameUniformRing.h"
+#include "FrameScheduler.h"
+#include "DynamicResolution.h"
+#include "GpuProfiler.h"
+#include "CpuProfiler.h"
+#include "Benchmark.h"
 #include <cstring>
 #include <cstdlib>
 #include "Utilities.h"
@@ -29,11 +49,15 @@
 class ShaderApplication
 {
 private:
+    AppSettings settings;
+
     GLFWwindow* window;
-    int currentFrame = 0;
+    int currentFrame = 0;                       // Frame slot in flight, mirrors frameScheduler.getCurrentFrame().
+    uint32_t lastImageIndex = 0;
 
     //Scene Objects
     std::vector<MeshModel> modelList;
+    GeometryArena geometryArena;                // Vertices and indices of every mesh in modelList.
 
 
     // Scene Settings
@@ -47,27 +71,45 @@ private:
 
     VkInstance instance;
     VkDebugUtilsMessengerEXT debugMessenger;
+    bool debugUtilsEnabled = false;                     // VK_EXT_debug_utils enabled on the instance.
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
 
     struct {
         VkPhysicalDevice physicalDevice;
         VkDevice logicalDevice;
     } mainDevice;
+    DeviceAllocator deviceAllocator;                    // Every buffer and image allocates through this.
+    UploadManager uploadManager;                        // Every host to device copy goes through its staging ring.
+    UploadToken sceneUploadToken;                       // Completes once every model and texture loaded so far is on the GPU.
+    MemoryTelemetry memoryTelemetry;
+    bool memoryBudgetSupported = false;                 // VK_EXT_memory_budget enabled on the device.
     VkQueue graphicQueue;
     VkQueue presentationQueue;
+    VkQueue transferQueue;                              // Dedicated copy queue if the device has one, graphicQueue otherwise.
     VkSurfaceKHR surface;
     VkSwapchainKHR swapchain;
 
     std::vector<SwapchainImage> swapchainImages;
+    std::vector<DeviceAllocation> offscreenImageMemory; // Only used headless, swapchainImages are then our own images.
     std::vector<VkFramebuffer> swapchainFramebuffers;
-    std::vector<VkCommandBuffer> commandBuffers;
+    std::vector<VkCommandBuffer> commandBuffers;        // One per frame in flight per swapchain image, see getCommandBufferIndex().
+
+    // - Dynamic resolution
+    // Both subpasses render renderExtent sized regions of full size targets. With dynamic resolution on, attachment 0 is
+    // a scene image instead of the swapchain image, and the region is blitted (upscaled) into the swapchain image after the pass.
+    DynamicResolution dynamicResolution;
+    VkExtent2D renderExtent;
+    std::vector<VkImage> sceneImages;
+    std::vector<DeviceAllocation> sceneImageMemory;
+    std::vector<VkImageView> sceneImageViews;
+
 
     std::vector<VkImage> colourBufferImage;
-    std::vector<VkDeviceMemory> colourBufferImageMemory;
+    std::vector<DeviceAllocation> colourBufferImageMemory;
     std::vector<VkImageView> colourBufferImageView;
 
     std::vector<VkImage> depthBufferImage;
-    std::vector<VkDeviceMemory> depthBufferImageMemory;
+    std::vector<DeviceAllocation> depthBufferImageMemory;
     std::vector<VkImageView> depthBufferImageView;
 
     VkSampler textureSampler;
@@ -77,37 +119,46 @@ private:
     VkDescriptorSetLayout samplerSetLayout;
     VkDescriptorSetLayout inputSetLayout;
 
-    VkPushConstantRange pushConstantRange;
-
 
     VkDescriptorPool descriptorPool;
     VkDescriptorPool samplerDescriptorPool;
     VkDescriptorPool inputDescriptorPool;
 
-    std::vector<VkDescriptorSet> descriptorSets;
+    std::vector<VkDescriptorSet> descriptorSets;        // One per frame in flight, pointing at that frame's uniform ring.
     std::vector<VkDescriptorSet> samplerDescriptorSets;
+    VkDescriptorSet bindlessDescriptorSet = VK_NULL_HANDLE;            // --bindless-textures: set 1 of every draw, one array element per texture.
+    uint32_t bindlessTextureCapacity = 0;                              // Array size, MAX_BINDLESS_TEXTURES or less if the device's limits are lower.
+    uint32_t bindlessTextureCount = 0;
     std::vector<VkDescriptorSet> inputDescriptorSets;
 
 
-    std::vector<VkBuffer> vpUniformBuffer;
-    std::vector<VkDeviceMemory> vpUniformBufferMemory;
-
-    std::vector<VkBuffer> modelDynUniformBuffer;
-    std::vector<VkDeviceMemory> modelDynUniformBufferMemory;
+    // - Per frame constant data
+    // View projection and every model transform are written into the frame's ring each frame and bound with dynamic offsets.
+    // Sub-allocation order is the same every frame, so offsets baked into cached command buffers stay valid.
+    FrameUniformRing frameUniformRing;
+    uint32_t vpUniformOffset = 0;
+    std::vector<uint32_t> modelUniformOffsets;         // One per model in modelList.
 
-    //VkDeviceSize minUniformBufferOffset;
-    //size_t modelUniformAlignment;
-
-    //UboModel * modelTransferSpace;
+    // - Instances
+    // Every model's instance transforms back to back, one storage buffer per frame in flight, indexed by gl_InstanceIndex.
+    // A frame's copy is only rewritten when an instance changed since it was last written.
+    std::vector<VkBuffer> instanceBuffers;
+    std::vector<DeviceAllocation> instanceBufferAllocations;
+    std::vector<uint64_t> instanceBufferVersions;     // instanceVersion each frame's buffer holds.
+    std::vector<uint32_t> modelFirstInstances;         // One per model in modelList, its first transform in the instance buffer.
+    uint64_t instanceVersion = 1;                       // Bumped whenever an instance is added or moved.
+    uint32_t totalInstances = 0;
 
     // - Assets
     std::vector<VkImage> textureImages;
-    std::vector<VkDeviceMemory> textureImageMemory;
+    std::vector<DeviceAllocation> textureImageMemory;
     std::vector<VkImageView> textureImageViews;
 
     // - Pipeline
-    VkPipeline graphicsPipeline;
+    std::array<VkPipeline, VERTEX_LAYOUT_COUNT> graphicsPipelines;    // Subpass 0, one per vertex layout.
     VkPipelineLayout pipelineLayout;
+    std::array<VkPipeline, VERTEX_LAYOUT_COUNT> indirectPipelines;    // Subpass 0 with GPU culling, one per vertex layout.
+    VkPipelineLayout indirectPipelineLayout;                          // Sets of pipelineLayout plus the GPU culler's, no push constants.
 
     VkPipeline secondPipeline;
     VkPipelineLayout secondPipelineLayout;
@@ -118,22 +169,103 @@ private:
     // - Pools
     VkCommandPool graphicsCommandPool;
 
+    // - Multi-threaded recording
+    // Subpass 0 is split over the thread pool. Each thread records one secondary command buffer per primary command buffer,
+    // from its own pool so threads never share a pool.
+    struct DrawItem {
+        uint32_t model;
+        uint32_t mesh;
+    };
+    struct RecordContext {
+        ShaderApplication* app;
+        uint32_t currentImage;
+    };
+    DrawItem* drawList = nullptr;                                      // Flattened model/mesh list split between threads. Lives in the frame arena.
+    size_t drawCount = 0;
+    std::unique_ptr<ThreadPool> recordThreadPool;
+    std::vector<std::vector<VkCommandPool>> secondaryCommandPools;     // [command buffer][thread]
+    std::vector<std::vector<VkCommandBuffer>> secondaryCommandBuffers; // [command buffer][thread]
+
+    // - GPU profiling
+    // Frame scope feeds dynamic resolution. Subpass and per model scopes only with --gpu-profile.
+    GpuProfiler gpuProfiler;
+    uint32_t subpassScope = GpuProfiler::NO_SCOPE;                     // Subpass 0, begun by the first recording thread, ended by the last.
+    uint32_t* threadModelScopes = nullptr;                             // First model scope of each recording thread. Lives in the frame arena.
+
+    // - Cluster culling (--cluster-culling)
+    ClusterCullView* modelCullViews = nullptr;                         // One per model, for the recording threads. Lives in the frame arena.
+    ClusterCullStats* threadCullStats = nullptr;                       // One per recording thread. Lives in the frame arena.
+    ClusterCullStats clusterCullTotals;
+    uint64_t clusterCullRecordings = 0;
+
+    // - Frustum culling (--frustum-culling)
+    FrustumCuller frustumCuller;
+    std::vector<uint8_t> meshVisibility;                               // 1 per mesh of every model, in draw list order. Filled by cullMeshes().
+    std::vector<std::vector<uint8_t>> recordedVisibility;              // meshVisibility each command buffer was last recorded with.
+    uint64_t visibleMeshes = 0;
+    uint64_t culledMeshes = 0;
+    uint64_t frustumCullFrames = 0;
+
+    // - Draw sorting (--sort-draws)
+    std::vector<uint32_t> drawOrder;                                   // Visible meshes by sort key, as draw list order indices. Filled by sortDraws().
+    std::vector<std::vector<uint32_t>> recordedDrawOrder;              // drawOrder each command buffer was last recorded with.
+    BindStats* threadBindStats = nullptr;                              // One per recording thread. Lives in the frame arena.
+    BindStats bindTotals;
+    uint64_t bindRecordings = 0;
+
+    // - GPU culling (--gpu-culling)
+    GpuCuller gpuCuller;
+    bool drawIndirectCountSupported = false;
+    bool multiDrawIndirectSupported = false;
+    uint64_t gpuDrawVersion = 0;                                       // sceneVersion the GPU culler's draw records were built at.
+    std::vector<uint32_t> gpuModelFirstDraws;                          // Each model's first draw in the GPU culler, meshes follow in order.
+    std::vector<uint8_t> gpuModelBoundsDirty;                          // Per model, instances moved since its draw bounds were written.
+    std::vector<uint32_t> gpuBoundsDirtyModels;                        // Those models. Reserved for every model, so moving instances never allocates.
+
     // - Utility
     VkFormat swapchainImageFormat;
     VkExtent2D swapchainExtent;
 
 
-    std::vector<VkSemaphore> imageAvailable;
-    std::vector<VkSemaphore> renderFinished;
-    std::vector<VkFence> drawFences;
+    // - Frame pacing, timeline semaphore per frame slot and swapchain image.
+    FrameScheduler frameScheduler;
+
+    // - Per frame scratch memory, one arena per frame in flight.
+    std::vector<FrameArena> frameArenas;
+
+    // - Allocation tracking (--alloc-stats)
+    struct {
+        uint64_t frames = 0;            // Steady state frames measured.
+        uint64_t allocatingFrames = 0;  // Of those, frames that made at least one heap allocation.
+        uint64_t allocations = 0;
+        uint64_t bytes = 0;
+        uint64_t maxAllocations = 0;    // Most allocations seen in a single frame.
+    } steadyStateAllocations;
+
+    // - Benchmark (--benchmark)
+    Benchmark benchmark;
+
+    // - Command buffer caching
+    uint64_t sceneVersion = 1;                  // Bumped whenever anything recorded into the command buffers changes.
+    std::vector<uint64_t> recordedSceneVersion; // Scene version each command buffer was last recorded at. 0 = never recorded.
 
     void initWindow(std::string wName, const int width, const int height);
     int initVulkan();
 
     void updateModel(int modelID, glm::mat4 newModel);
+    void createInstanceGrid(int modelID, uint32_t count);
+    void markSceneDirty();
 
     void draw();
+    void trackFrameAllocations(uint64_t frame, const AllocationStats& frameAllocations);
+    void reportAllocations();
+    void reportFrameWaits();
+    void reportCulling();
+    void reportBinds();
     void mainLoop();
+    void runBenchmark();
+    void updateCamera(float time);
+    void writeBenchmarkReport();
     void cleanup();
 
     void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo);
@@ -156,15 +288,20 @@ private:
     void createLogicalDevice();
     void createSurface();
     void createSwapChain();
+    void createOffscreenImages();
     void createRenderPass();
     void createDescriptorSetLayout();
-    void createPushConstantRange();
     void createGraphicsPipeline();
     void createColourBufferImage();
     void createDepthBufferImage();
+    void createSceneImages();
     void createFramebuffers();
     void createCommandPool();
+    void createGpuProfiler();
+    void checkDynamicResolutionSupport();
     void createCommandBuffers();
+    void createRecordThreads();
+    void destroyRecordThreads();
     void createSynchronisation();
     void createTextureSampler();
 
@@ -174,25 +311,41 @@ private:
     void createInputDescriptorSets();
 
 
-    void updateUniformBuffers(uint32_t imageIndex);
+    void updateUniformBuffers();
+    void updateInstanceBuffer();
+    void cullMeshes();
+    void sortDraws();
+    void buildGpuDraws();
+    void updateGpuDrawBounds();
+    void updateResolution();
+
+    void saveOffscreenImage(std::string fileName);
+    void writeGpuProfile();
+    void writeCpuProfile();
 
 
     // - Record functions
+    uint32_t getCommandBufferIndex(uint32_t frame, uint32_t image);
     void recordCommands(uint32_t currentImage);
+    void recordSceneDraws(uint32_t currentImage, uint32_t threadIndex);
+    void recordUpscale(VkCommandBuffer commandBuffer, uint32_t currentImage);
+    static void recordSceneDrawsJob(void* context, uint32_t threadIndex);
+
+    void benchmarkRecording();
 
 
     // - Get functions
     void getPhysicalDevice();
     QueueFamilyIndices getQueueFamilies(VkPhysicalDevice device);
     SwapChainDetails getSwapChainDetails(VkPhysicalDevice device);
-
-    // - Allocate Functions
-    void allocateDynamicBufferTransferSpace();
+    std::vector<const char*> getDeviceExtensions();
 
 
     // - Support Functions
     // -- Checkers
+    bool checkInstanceExtensionSupport(const char* extensionName);
     bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+    bool hasDeviceExtension(VkPhysicalDevice device, const char* extensionName);
     bool checkValidationLayerSupport();
     bool checkDeviceSuitable(VkPhysicalDevice device);
 
@@ -204,22 +357,26 @@ private:
 
     // -- Create funcitons
     VkImage createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, 
-        VkMemoryPropertyFlags propFlags, VkDeviceMemory *imageMemory);
+        VkMemoryPropertyFlags propFlags, MemoryCategory category, DeviceAllocation *imageAllocation);
     VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
     VkShaderModule createShaderModule(const std::vector<char> &code);
 
     int createTextureImage(std::string fileName);
     int createTexture(std::string fileName);
     int createTextureDescriptor(VkImageView textureImage);
+    int createBindlessTextureDescriptor(VkImageView textureImage);
 
     // -- Loader function.
     stbi_uc * loadTextureFile(std::string fileName, int * width, int * height, VkDeviceSize * imageSize);
 
 
 public:
-    int createMeshModel(std::string modelFile);
+    int createMeshModel(std::string modelFile, VertexLayout layout = VERTEX_LAYOUT_FULL);
+    // Another instance of a loaded model, drawn by the same draw calls. Returns its index within the model.
+    int createInstance(int modelID, glm::mat4 transform);
+    void updateInstance(int modelID, int instanceID, glm::mat4 transform);
 
-    ShaderApplication();
+    ShaderApplication(AppSettings newSettings = AppSettings());
     ~ShaderApplication();
 
     void run();
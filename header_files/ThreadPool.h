@@ -0,0 +1,43 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <vector>
+#include <cstdint>
+
+// Fixed group of threads that all run the same job once per dispatch.
+// Every thread gets its own index so it can use per-thread resources (command pools ect).
+// Index 0 is the thread calling dispatch(), so a pool of 1 never starts a thread.
+class ThreadPool
+{
+public:
+	typedef void (*Job)(void* context, uint32_t threadIndex);
+
+	ThreadPool(uint32_t newThreadCount);
+
+	uint32_t getThreadCount();
+
+	// Run job on every thread and block until all of them finished.
+	void dispatch(Job job, void* context);
+
+	~ThreadPool();
+
+private:
+	uint32_t threadCount;
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable startCondition;
+	std::condition_variable doneCondition;
+
+	Job currentJob = nullptr;
+	void* currentContext = nullptr;
+	uint64_t generation = 0;		// Bumped per dispatch so workers know there is new work.
+	uint32_t pending = 0;			// Workers still running the current job.
+	bool stopping = false;
+	std::exception_ptr workerError;	// First exception thrown by a worker, rethrown by dispatch().
+
+	void workerLoop(uint32_t threadIndex);
+};
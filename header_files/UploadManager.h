@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <cstdint>
+
+#include "Utilities.h"
+#include "DeviceAllocator.h"
+
+struct UploadStats {
+	uint64_t bytes = 0;					// Copied through the ring.
+	uint64_t uploads = 0;				// uploadBuffer/uploadImage calls.
+	uint64_t batches = 0;				// Submits.
+	uint64_t ringStalls = 0;			// Times an upload had to wait for the GPU to free ring space.
+};
+
+// Handed out by flush(). Complete once the GPU finished every upload recorded before that flush.
+struct UploadToken {
+	uint64_t value = 0;					// Upload timeline value. 0 = nothing to wait for.
+};
+
+// All host to device copies go through one persistently mapped staging ring.
+// Uploads are recorded into the open batch (one command buffer) and submitted together on flush(), or when the ring
+// runs out of space. Every submit signals the next value of the manager's timeline semaphore, ring space of a batch is
+// reclaimed once its value is reached. Uploads bigger than a quarter of the ring are split (images by rows).
+// Copies run on a dedicated transfer queue if the device has one. Each batch then releases what it wrote to the graphics
+// family and a small graphics queue submit (waiting on the transfer) acquires it. Otherwise everything runs on the graphics queue.
+// Main thread only.
+class UploadManager
+{
+public:
+	UploadManager();
+
+	// Pass the graphics queue as transfer queue too when there is no dedicated one.
+	void createUploadManager(DeviceAllocator* newAllocator, VkPhysicalDevice physicalDevice, VkDevice newDevice,
+		VkQueue newTransferQueue, uint32_t newTransferFamily, VkQueue newGraphicsQueue, uint32_t newGraphicsFamily,
+		VkDeviceSize newRingSize);
+
+	// Copy size bytes of data to dstBuffer at dstOffset.
+	void uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+	// Fill a whole single mip 2D colour image (tightly packed rows) and leave it SHADER_READ_ONLY_OPTIMAL.
+	void uploadImage(VkImage image, uint32_t width, uint32_t height, uint32_t texelSize, const void* data);
+	// Copy regions of a buffer the graphics queue already owns into another, on the graphics queue, after every upload
+	// queued so far. Uploads queued afterwards must not write the destination regions, they may run alongside the copy.
+	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, const std::vector<VkBufferCopy>& regions);
+
+	// Submit the open batch without waiting for it. The token completes with it (or with the last batch if there was nothing to submit).
+	UploadToken flush();
+	// Poll without blocking. Also recycles ring space of finished batches.
+	bool isComplete(UploadToken token);
+	// Block until the token completed.
+	void wait(UploadToken token);
+	// Block until everything flushed so far finished.
+	void waitIdle();
+
+	UploadStats getStats();
+	bool usesTransferQueue();
+
+	void destroyUploadManager();
+
+	~UploadManager();
+
+private:
+	struct Batch {
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE;	// Graphics queue side of the ownership transfer.
+		uint64_t value = 0;				// Timeline value signalled when done (and acquired).
+		VkDeviceSize ringBegin = 0;		// Ring space used by the batch, [ringBegin, ringEnd) possibly wrapping.
+		VkDeviceSize ringEnd = 0;
+		bool hasData = false;
+		std::vector<VkBufferMemoryBarrier> bufferBarriers;	// Ranges written, released at flush. Ownership transfer only.
+		std::vector<VkImageMemoryBarrier> imageBarriers;	// Images finished, released at flush. Ownership transfer only.
+	};
+
+	DeviceAllocator* allocator;
+	VkDevice device;
+	VkQueue queue;
+	uint32_t queueFamily = 0;
+	VkQueue graphicsQueue;
+	uint32_t graphicsFamily = 0;
+	bool ownershipTransfer = false;		// Copies run on another family than the one drawing.
+	uint32_t rowGranularity = 1;		// Image copy rows must start at a multiple of this. 0 = whole images only.
+
+	VkBuffer ringBuffer = VK_NULL_HANDLE;
+	DeviceAllocation ringAllocation;
+	VkDeviceSize ringSize = 0;
+	VkDeviceSize alignment = 16;
+	VkDeviceSize head = 0;				// Next free byte.
+	VkDeviceSize tail = 0;				// Oldest byte still used by a batch. head == tail only when the ring is empty.
+
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> freeCommandBuffers;
+	VkCommandPool acquireCommandPool = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> freeAcquireCommandBuffers;
+
+	VkSemaphore timeline = VK_NULL_HANDLE;
+	uint64_t submittedValue = 0;
+
+	Batch openBatch;
+	bool batchOpen = false;
+	std::deque<Batch> pendingBatches;	// Submitted, oldest first.
+
+	UploadStats stats;
+
+	VkCommandBuffer getCommandBuffer();
+	static VkCommandBuffer takeCommandBuffer(VkDevice device, VkCommandPool pool, std::vector<VkCommandBuffer>& freeList);
+	void addBufferRange(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+	void submit(VkQueue submitQueue, VkCommandBuffer commandBuffer, uint64_t waitValue, VkPipelineStageFlags waitStages, uint64_t signalValue);
+	VkDeviceSize reserve(VkDeviceSize size);
+	bool tryReserve(VkDeviceSize size, VkDeviceSize* offset);
+	void waitForValue(uint64_t value);
+	void retireOldestBatch();
+	void retireFinishedBatches();
+	void updateTail();
+};
@@ -1,19 +1,95 @@
 #pragma once
 
 #include <fstream>
+#include <string>
+#include <vector>
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
 #include <glm/glm.hpp>
 
 
-const int MAX_FRAME_DRAWS = 2;
-const int MAX_OBJECTS = 2;
+const int MAX_TEXTURES = 256;					// Texture descriptor sets the sampler pool has room for.
+const uint32_t MAX_BINDLESS_TEXTURES = 65536;	// Upper bound on the bindless texture array, lowered to the device's update after bind limits.
+const uint32_t MAX_INSTANCES = 65536;			// Instance transforms over all models. 4 MiB per frame in flight.
+const uint64_t FRAME_WAIT_TIMEOUT = 5000000000;	// Nanoseconds. Waiting longer than this on a frame counts as a GPU hang.
+const uint32_t MAX_GPU_SCOPES = 512;				// GPU profiler timestamp scopes per frame. Scopes past this are dropped.
+const uint32_t MAX_GPU_PROFILE_EVENTS = 262144;	// Scopes --gpu-profile keeps for the output files, 10 MiB reserved up front. Later frames are dropped.
+
+const size_t FRAME_ARENA_SIZE = 256 * 1024;	// Starting size of each per frame scratch arena. Grows if ever exceeded.
+const VkDeviceSize FRAME_UNIFORM_RING_SIZE = 4 * 1024 * 1024;	// Per frame in flight. Holds view projection + one transform per model.
+
+const uint32_t GEOMETRY_ARENA_VERTEX_BYTES = 64 * 1024 * 1024;	// Starting size of the vertex data all loaded meshes share, whatever their layout. Grows when full.
+const uint32_t GEOMETRY_ARENA_INDEX_BYTES = 24 * 1024 * 1024;	// Starting size of the index data all loaded meshes share, 16 and 32 bit alike. Grows when full.
+const uint32_t VERTEX_CACHE_SIZE = 16;	// Post-transform cache entries the mesh optimizer orders triangles for and measures ACMR with.
+const uint32_t MESHLET_MAX_VERTICES = 64;		// Unique vertices per meshlet.
+const uint32_t MESHLET_MAX_TRIANGLES = 124;		// Triangles per meshlet.
+const uint32_t RENDER_QUEUE_MAX_DRAWS = 1 << 27;	// Meshes --sort-draws can order. A sort key's low 27 bits are its draw's index.
+const uint32_t GPU_CULL_MAX_DRAWS = 16384;		// Meshes the GPU cull pass has record and command slots for.
+const uint32_t GPU_CULL_MAX_MODELS = 1024;		// Transforms the GPU cull pass has room for.
+const uint32_t GPU_CULL_MAX_BATCHES = 256;		// Indirect draws (layout, index type, texture combinations) per frame.
+const uint32_t GPU_CULL_GROUP_SIZE = 64;		// local_size_x of cull.comp.
+const VkDeviceSize STAGING_RING_SIZE = 32 * 1024 * 1024;	// Host visible staging space every upload goes through.
+
+const uint32_t MEMORY_BUDGET_CHECK_FRAMES = 120;	// Frames between memory budget checks.
+
+const float BENCHMARK_TIMESTEP = 1.0f / 60.0f;	// Seconds the benchmark camera path advances per frame, whatever the real frame time.
+const float BENCHMARK_ORBIT_SPEED = 30.0f;		// Degrees per second the benchmark camera orbits the origin.
 
 const std::vector<const char*> deviceExtensions = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+// How a mesh's vertices are stored on the GPU. Chosen per model, see VertexLayout.h.
+enum VertexLayout {
+	VERTEX_LAYOUT_FULL,					// Float position, colour and tex coords. 32 bytes.
+	VERTEX_LAYOUT_COMPACT,				// 16 bit position and tex coords quantized to the mesh's bounds, 8 bit colour. 16 bytes.
+	VERTEX_LAYOUT_COMPACT_NO_COLOUR,	// Compact without colour, shaders see white. 12 bytes.
+	VERTEX_LAYOUT_COUNT
+};
+
+// Runtime settings, filled in from the command line.
+struct AppSettings {
+	uint32_t width = 500;
+	uint32_t height = 500;
+
+	bool headless = false;				// Render into offscreen images. No window, surface or swapchain.
+	uint32_t headlessFrameCount = 1;	// Frames to render before exiting when headless.
+	std::string outputImage;			// If set, the last headless frame is written to this file (PPM).
+
+	uint32_t recordThreadCount = 0;		// Threads recording subpass 0. 0 = one per hardware thread.
+	bool recordBenchmark = false;		// Time command recording across thread counts instead of running normally.
+
+	bool allocationStats = false;		// Report heap allocations per frame and a steady state summary on exit.
+
+	uint32_t framesInFlight = 2;		// Frames the CPU may queue ahead of the GPU. More = throughput, fewer = latency.
+	uint32_t swapchainImageCount = 0;	// Requested swapchain (or offscreen) images. 0 = driver minimum + 1.
+	bool frameStats = false;			// Report how long the CPU waited on the GPU per frame.
+
+	bool dynamicResolution = false;		// Render the scene at a scale picked from GPU frame time, upscale into the swapchain.
+	float targetFrameMs = 16.6f;		// GPU time per frame dynamic resolution aims for.
+	float minResolutionScale = 0.5f;	// Lowest scale (per axis) dynamic resolution may pick.
+
+	std::string gpuProfilePath;			// If set, GPU scopes are written to <path>.csv and <path>.json (Chrome trace) on exit.
+	std::string cpuProfilePath;			// If set, CPU zones are written to this file as a Chrome trace on exit (needs ENABLE_CPU_PROFILER).
+
+	std::vector<std::string> modelFiles;	// Models loaded at startup. Default model if none are given.
+	std::vector<VertexLayout> modelVertexLayouts;	// Vertex layout of each of modelFiles.
+	bool optimizeMeshes = false;			// Reorder triangles and vertices at import and report the gain per mesh.
+	bool clusterCulling = false;			// Split meshes into meshlets, skip back facing and off screen ones. Re-records every frame.
+	bool frustumCulling = false;			// Skip meshes whose world bounding box is outside the view frustum.
+	bool gpuCulling = false;				// Cull meshes in a compute pass and draw them with indirect draws.
+	bool sortDraws = false;					// Draw by pipeline, index type and texture, front to back within each, to skip redundant binds.
+	uint32_t modelInstances = 1;			// Instances of every loaded model, laid out on a grid.
+	bool bindlessTextures = false;			// Every texture in one descriptor array, indexed per draw. Needs descriptor indexing.
+	std::string benchmarkPath;				// If set, run the benchmark camera path and write the JSON report here instead of the normal loop.
+	uint32_t benchmarkFrames = 500;			// Measured benchmark frames.
+	uint32_t benchmarkWarmup = 60;			// Frames drawn (and thrown away) before measuring.
+
+	uint32_t memoryBudgetMiB = 0;			// Warn when device local memory use goes over this. 0 = only the driver's budget.
+	uint32_t memoryLogInterval = 0;			// Frames between memory usage log lines. 0 = never.
+};
+
 
 // Vertex representation
 struct Vertex {
@@ -23,16 +99,30 @@ struct Vertex {
 	glm::vec2 tex; // Texture coords (u, v)
 };
 
+// Vertex push constant turning a mesh's stored position/tex coords back into model space: value * scale + offset.
+// Identity for the full layout.
+struct VertexDequantize {
+	glm::vec4 positionScale;	// xyz used
+	glm::vec4 positionOffset;	// xyz used
+	glm::vec4 texScaleOffset;	// xy scale, zw offset
+};
+
 // Locations of queueFamilies if they exist at all.
 struct QueueFamilyIndices {
 
 	int graphicsFamily = -1;
 	int presentationFamily = -1;
+	int transferFamily = -1;	// Family that can copy but not draw. Optional, uploads use the graphics queue without it.
 
 
 	bool isValid() {
 		return graphicsFamily >= 0 && presentationFamily >=0;
 	}
+
+	// Headless rendering never presents, so only a graphics family is needed.
+	bool isValidHeadless() {
+		return graphicsFamily >= 0;
+	}
 };
 
 struct SwapChainDetails {
@@ -73,63 +163,6 @@ static std::vector<char> readfile (const std::string &filename){
 
 	return fileBuffer;
 }
-static uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice, uint32_t allowedTypes, VkMemoryPropertyFlags properties)
-{
-	// Get properties of physical device memory
-	VkPhysicalDeviceMemoryProperties memorryProperties;
-	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memorryProperties);
-
-	for (uint32_t i = 0; i < memorryProperties.memoryTypeCount; i++)
-	{
-		if ((allowedTypes & (1 << i))	//Index of memory type must match corresponding bit in allowedTypes.
-			&& (memorryProperties.memoryTypes[i].propertyFlags & properties) == properties)	// Desired property bit flags are part of memory type's property flags.
-		{
-			// This memory type is valid. Return its index.
-			return i;
-		}
-	}
-}
-
-static void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize bufferSize,
-	VkBufferUsageFlags bufferUsage, VkMemoryPropertyFlags bufferProperties,
-	VkBuffer* buffer, VkDeviceMemory* bufferMemory)
-{
-	//_________CREATE BUFFER________________
-//Information to create a buffer (does not include assigning memory)
-	VkBufferCreateInfo bufferInfo = {};
-	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	bufferInfo.size = bufferSize;	// Size of buffer.
-	bufferInfo.usage = bufferUsage;	// Multiple types of buffer possible. We want vertex buffer.
-	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-	VkResult result = vkCreateBuffer(device, &bufferInfo, nullptr, buffer);
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to create a Buffer!");
-	}
-
-	// Get buffer memory requirements
-	VkMemoryRequirements memRequirements;
-	vkGetBufferMemoryRequirements(device, *buffer, &memRequirements);
-
-	// Allocate memory to buffer
-	VkMemoryAllocateInfo memoryAllocInfo = {};
-	memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memoryAllocInfo.allocationSize = memRequirements.size;
-	memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(physicalDevice, memRequirements.memoryTypeBits, bufferProperties);
-
-
-	//Allocate memory to VkDeviceMemory
-	result = vkAllocateMemory(device, &memoryAllocInfo, nullptr, bufferMemory);
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to allocate buffer memory!");
-	}
-
-	// Allocate memory to given vertex buffer.
-	vkBindBufferMemory(device, *buffer, *bufferMemory, 0);
-}
-
 static VkCommandBuffer beginCommandBuffer(VkDevice device, VkCommandPool commandPool) 
 {
 
@@ -176,95 +209,3 @@ static void endSubmitDestroyCommandBuffer(VkDevice device, VkCommandPool command
 	// Free tmp command buffer back to pool
 	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
 }
-
-static void copyBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool,
-	VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize bufferSize)
-{
-	// create buffer
-	VkCommandBuffer transferCommandBuffer = beginCommandBuffer(device, transferCommandPool);
-
-	// Region of data to copy from and to.
-	VkBufferCopy bufferCopyRegion = {};
-	bufferCopyRegion.srcOffset = 0;
-	bufferCopyRegion.dstOffset = 0;
-	bufferCopyRegion.size = bufferSize;
-
-	// Command to copy srcbuffer to dst buffer.
-	vkCmdCopyBuffer(transferCommandBuffer, srcBuffer, dstBuffer, 1, &bufferCopyRegion);
-
-	endSubmitDestroyCommandBuffer(device, transferCommandPool, transferQueue, transferCommandBuffer);
-}
-
-static void copyImageBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool,
-	VkBuffer srcBuffer, VkImage image, uint32_t width, uint32_t height)
-{
-	VkCommandBuffer transferCommandBuffer = beginCommandBuffer(device, transferCommandPool);
-
-	VkBufferImageCopy imageRegion = {};
-	imageRegion.bufferOffset = 0;
-	imageRegion.bufferRowLength = 0;
-	imageRegion.bufferImageHeight = 0;
-
-	imageRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	imageRegion.imageSubresource.mipLevel = 0;
-	imageRegion.imageSubresource.baseArrayLayer = 0;
-	imageRegion.imageSubresource.layerCount = 1;
-	imageRegion.imageOffset = {0, 0, 0};
-	imageRegion.imageExtent = {width, height, 1};
-
-	vkCmdCopyBufferToImage(transferCommandBuffer, srcBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageRegion);
-
-	endSubmitDestroyCommandBuffer(device, transferCommandPool, transferQueue, transferCommandBuffer);
-
-}
-
-static void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool commandPool, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout)
-{
-	VkCommandBuffer commandBuffer = beginCommandBuffer(device, commandPool);
-
-	VkImageMemoryBarrier imageMemoryBarrier = {};
-	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	imageMemoryBarrier.oldLayout = oldLayout;
-	imageMemoryBarrier.newLayout = newLayout;
-	imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	imageMemoryBarrier.image = image;
-	imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
-	imageMemoryBarrier.subresourceRange.levelCount = 1;
-	imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
-	imageMemoryBarrier.subresourceRange.layerCount = 1;
-
-	VkPipelineStageFlags srcStage;
-	VkPipelineStageFlags dstStage;
-
-
-	if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-	{
-		imageMemoryBarrier.srcAccessMask = 0;
-		imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-		srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-	}
-	else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) 
-	{
-		imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-		srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-	}
-
-	vkCmdPipelineBarrier(
-		commandBuffer, 
-		srcStage, dstStage,		// Pipeline Stages (match to src and dst access mask.
-		0,						// Dependency flags
-		0, nullptr,				// Global Memory barrier count + data
-		0, nullptr,				// Buffer Memory Barrier count + data
-		1, &imageMemoryBarrier	// Image Memory Barriet count + data
-	);
-
-
-	endSubmitDestroyCommandBuffer(device, commandPool, queue, commandBuffer);
-}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "Utilities.h"
+
+// Vertex as stored by VERTEX_LAYOUT_COMPACT. Position is snorm16 over the mesh's bounds (w pads to 8 bytes,
+// 3 component 16 bit formats are rarely supported for vertex input), tex coords unorm16 over the mesh's uv range.
+struct CompactVertex {
+	int16_t pos[4];
+	uint16_t tex[2];
+	uint8_t col[4];
+};
+
+// VERTEX_LAYOUT_COMPACT_NO_COLOUR.
+struct CompactVertexNoColour {
+	int16_t pos[4];
+	uint16_t tex[2];
+};
+
+// Bytes per vertex of a layout.
+uint32_t getVertexStride(VertexLayout layout);
+
+// Binding 0 and attributes for shader locations 0 (pos), 1 (col, not for the no colour layout) and 2 (tex).
+void getVertexInputDescription(VertexLayout layout, VkVertexInputBindingDescription* binding,
+	std::vector<VkVertexInputAttributeDescription>* attributes);
+
+// SPIR-V vertex shader matching the layout's inputs. indirect = the GPU culling variant, see GpuCuller.h.
+const char* getVertexShaderFile(VertexLayout layout, bool indirect = false);
+
+// Converts vertices into the layout's packed form, returns the transform the vertex shader undoes the quantization with.
+VertexDequantize packVertices(VertexLayout layout, const std::vector<Vertex>& vertices, std::vector<uint8_t>* packed);
+
+const char* getVertexLayoutName(VertexLayout layout);
+bool parseVertexLayout(const std::string& name, VertexLayout* layout);
@@ -1,5 +1,10 @@
 D:/VulkanSDK/1.2.154.1/Bin32/glslangValidator.exe -V shader.vert
+D:/VulkanSDK/1.2.154.1/Bin32/glslangValidator.exe -DNO_VERTEX_COLOUR -o vert_no_colour.spv -V shader.vert
+D:/VulkanSDK/1.2.154.1/Bin32/glslangValidator.exe -DINDIRECT_DRAW -o vert_indirect.spv -V shader.vert
+D:/VulkanSDK/1.2.154.1/Bin32/glslangValidator.exe -DINDIRECT_DRAW -DNO_VERTEX_COLOUR -o vert_indirect_no_colour.spv -V shader.vert
 D:/VulkanSDK/1.2.154.1/Bin32/glslangValidator.exe -V shader.frag
+D:/VulkanSDK/1.2.154.1/Bin32/glslangValidator.exe -DBINDLESS_TEXTURES -o frag_bindless.spv -V shader.frag
 D:/VulkanSDK/1.2.154.1/Bin32/glslangValidator.exe -o second_vert.spv -V second.vert
 D:/VulkanSDK/1.2.154.1/Bin32/glslangValidator.exe -o second_frag.spv -V second.frag
+D:/VulkanSDK/1.2.154.1/Bin32/glslangValidator.exe -o cull.spv -V cull.comp
 pause
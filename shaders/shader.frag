@@ -1,12 +1,28 @@
 #version 450
+#ifdef BINDLESS_TEXTURES
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
 
+// Compiled twice: frag.spv with one texture per descriptor set, frag_bindless.spv (-DBINDLESS_TEXTURES) indexing
+// every texture in one array.
 layout(location = 0) in vec3 fragCol;
 layout(location = 1) in vec2 fragTex;
+layout(location = 2) flat in uint fragTexture;
 
+#ifdef BINDLESS_TEXTURES
+// Partially bound, only the first textures loaded are valid.
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+#else
 layout(set = 1, binding = 0) uniform sampler2D textureSampler; 
+#endif
 
 layout(location = 0) out vec4 outColour;	//Final output colour. Must have location.
 
 void main(){
+#ifdef BINDLESS_TEXTURES
+	// Not uniform: one indirect multi draw can put meshes with different textures in the same subgroup.
+	outColour = texture(textures[nonuniformEXT(fragTexture)], fragTex);
+#else
 	outColour = texture(textureSampler, fragTex);
+#endif
 }
@@ -1,7 +1,14 @@
 #version 450 // Use GLSL 4.5
+#ifdef INDIRECT_DRAW
+#extension GL_ARB_shader_draw_parameters : require
+#endif
 
+// Compiled twice: vert.spv with colour, vert_no_colour.spv (-DNO_VERTEX_COLOUR) for layouts that don't store it.
+// And both again with -DINDIRECT_DRAW for GPU culling, which takes the transform and dequantization from the draw record.
 layout(location = 0) in vec3 pos;
+#ifndef NO_VERTEX_COLOUR
 layout(location = 1) in vec3 col;
+#endif
 layout(location = 2) in vec2 tex;
 
 layout(set = 0, binding = 0) uniform UboViewProjection {
@@ -9,16 +16,78 @@ layout(set = 0, binding = 0) uniform UboViewProjection {
 	mat4 view;
 } uboViewProjection;
 
+// Every model's instance transforms, gl_InstanceIndex picks this vertex's.
+layout(set = 0, binding = 2) readonly buffer Instances {
+	mat4 instances[];
+};
 
-layout(push_constant) uniform PushModel {
+#ifdef INDIRECT_DRAW
+// GpuDrawRecord in GpuCuller.h. firstInstance of each indirect draw is its record's index, gl_BaseInstance here.
+struct DrawRecord {
+	vec4 sphere;
+	vec4 positionScale;
+	vec4 positionOffset;
+	vec4 texScaleOffset;
+	uint model;
+	uint indexCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint batch;
+	uint batchFirstCommand;
+	uint firstInstance;
+	uint instanceCount;
+	uint texture;
+	uint padding[3];
+};
+
+layout(set = 2, binding = 0) readonly buffer DrawRecords {
+	DrawRecord records[];
+};
+
+layout(set = 2, binding = 1) readonly buffer Scene {
+	vec4 frustumPlanes[6];
+	mat4 transforms[];
+};
+#else
+layout(set = 0, binding = 1) uniform UboModel {
 	mat4 model;
-} pushModel;
+} uboModel;
+
+// Undoes the mesh's vertex quantization (identity for float vertices), and the mesh's texture.
+layout(push_constant) uniform Dequantize {
+	vec4 positionScale;
+	vec4 positionOffset;
+	vec4 texScaleOffset;
+	uint texture;		// Index into the bindless texture array.
+} dequantize;
+#endif
 
 layout(location = 0) out vec3 fragCol;
 layout(location = 1) out vec2 fragTex;
+layout(location = 2) flat out uint fragTexture;
 
 void main(){
-	gl_Position = uboViewProjection.projection * uboViewProjection.view * pushModel.model * vec4(pos, 1.0);
+#ifdef INDIRECT_DRAW
+	DrawRecord record = records[gl_BaseInstanceARB];
+	mat4 model = transforms[record.model] * instances[record.firstInstance + gl_InstanceIndex - gl_BaseInstanceARB];
+	vec4 positionScale = record.positionScale;
+	vec4 positionOffset = record.positionOffset;
+	vec4 texScaleOffset = record.texScaleOffset;
+	fragTexture = record.texture;
+#else
+	mat4 model = uboModel.model * instances[gl_InstanceIndex];
+	vec4 positionScale = dequantize.positionScale;
+	vec4 positionOffset = dequantize.positionOffset;
+	vec4 texScaleOffset = dequantize.texScaleOffset;
+	fragTexture = dequantize.texture;
+#endif
+
+	vec3 modelPos = pos * positionScale.xyz + positionOffset.xyz;
+	gl_Position = uboViewProjection.projection * uboViewProjection.view * model * vec4(modelPos, 1.0);
+#ifdef NO_VERTEX_COLOUR
+	fragCol = vec3(1.0);
+#else
 	fragCol = col;
-	fragTex = tex;
+#endif
+	fragTex = tex * texScaleOffset.xy + texScaleOffset.zw;
 }
@@ -0,0 +1,150 @@
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+
+
+static std::atomic<uint64_t> allocationCount(0);
+static std::atomic<uint64_t> allocationBytes(0);
+
+AllocationStats AllocationCounter::getTotals()
+{
+	AllocationStats stats;
+	stats.allocations = allocationCount.load(std::memory_order_relaxed);
+	stats.bytes = allocationBytes.load(std::memory_order_relaxed);
+	return stats;
+}
+
+AllocationStats AllocationCounter::since(const AllocationStats& snapshot)
+{
+	AllocationStats now = getTotals();
+	now.allocations -= snapshot.allocations;
+	now.bytes -= snapshot.bytes;
+	return now;
+}
+
+
+// GLOBAL OPERATOR NEW / DELETE REPLACEMENTS
+// Everything ends up in malloc/free as before, we only count on the way through.
+
+static void* countedAllocate(std::size_t size)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	allocationBytes.fetch_add(size, std::memory_order_relaxed);
+	return std::malloc(size > 0 ? size : 1);
+}
+
+static void* countedAllocateAligned(std::size_t size, std::size_t alignment)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	allocationBytes.fetch_add(size, std::memory_order_relaxed);
+
+#ifdef _WIN32
+	return _aligned_malloc(size > 0 ? size : 1, alignment);
+#else
+	// aligned_alloc wants the size to be a multiple of the alignment.
+	std::size_t alignedSize = ((size > 0 ? size : 1) + alignment - 1) & ~(alignment - 1);
+	return std::aligned_alloc(alignment, alignedSize);
+#endif
+}
+
+static void freeAligned(void* ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	std::free(ptr);
+#endif
+}
+
+void* operator new(std::size_t size)
+{
+	void* ptr = countedAllocate(size);
+	if (!ptr)
+	{
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return countedAllocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return countedAllocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	void* ptr = countedAllocateAligned(size, static_cast<std::size_t>(alignment));
+	if (!ptr)
+	{
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+	freeAligned(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+	freeAligned(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept
+{
+	freeAligned(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept
+{
+	freeAligned(ptr);
+}
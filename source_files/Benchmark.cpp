@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "Benchmark.h"
+
+
+
+Benchmark::Benchmark()
+{
+}
+
+void Benchmark::reset(uint32_t newWarmupFrames, uint32_t newMeasuredFrames)
+{
+	warmupFrames = newWarmupFrames;
+	measuredFrames = newMeasuredFrames;
+	seenFrames = 0;
+	seenGpuFrames = 0;
+	loadMs = 0.0;
+
+	frameMs.clear();
+	cpuMs.clear();
+	gpuMs.clear();
+	frameMs.reserve(measuredFrames);
+	cpuMs.reserve(measuredFrames);
+	gpuMs.reserve(measuredFrames);
+}
+
+void Benchmark::addFrame(double newFrameMs, double newCpuMs)
+{
+	if (seenFrames++ < warmupFrames || frameMs.size() >= measuredFrames) return;
+
+	frameMs.push_back(newFrameMs);
+	cpuMs.push_back(newCpuMs);
+}
+
+void Benchmark::addGpuFrame(double newGpuMs)
+{
+	if (seenGpuFrames++ < warmupFrames || gpuMs.size() >= measuredFrames) return;
+
+	gpuMs.push_back(newGpuMs);
+}
+
+void Benchmark::setLoadMs(double newLoadMs)
+{
+	loadMs = newLoadMs;
+}
+
+uint64_t Benchmark::getPeakMemoryBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters = {};
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		return counters.PeakWorkingSetSize;
+	}
+	return 0;
+#else
+	struct rusage usage = {};
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+	{
+		return 0;
+	}
+	// Kilobytes on Linux, bytes on macOS.
+#ifdef __APPLE__
+	return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+	return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+void Benchmark::writeReport(const std::string& fileName, const std::string& runInfo)
+{
+	std::ofstream file(fileName);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open a file! (" + fileName + ")");
+	}
+
+	file << std::fixed << std::setprecision(4);
+	file << "{\n";
+	file << runInfo << ",\n";
+	file << "  \"warmupFrames\": " << warmupFrames << ",\n";
+	file << "  \"measuredFrames\": " << frameMs.size() << ",\n";
+	file << "  \"loadMs\": " << loadMs << ",\n";
+	file << "  \"peakMemoryBytes\": " << getPeakMemoryBytes() << ",\n";
+	file << "  \"frameMs\": " << toJson(summarize(frameMs)) << ",\n";
+	file << "  \"cpuMs\": " << toJson(summarize(cpuMs)) << ",\n";
+	// No timestamps on this queue (or nothing collected), null rather than made up zeros.
+	file << "  \"gpuMs\": " << (gpuMs.empty() ? std::string("null") : toJson(summarize(gpuMs))) << "\n";
+	file << "}\n";
+}
+
+std::string Benchmark::escapeJson(const std::string& text)
+{
+	std::string escaped;
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+Benchmark::~Benchmark()
+{
+}
+
+Benchmark::Summary Benchmark::summarize(std::vector<double> samples)
+{
+	Summary summary;
+	if (samples.empty()) return summary;
+
+	std::sort(samples.begin(), samples.end());
+
+	// Nearest rank percentiles.
+	auto percentile = [&samples](double p) {
+		size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * samples.size()));
+		return samples[std::min(std::max(rank, (size_t)1), samples.size()) - 1];
+	};
+
+	double sum = 0.0;
+	for (double sample : samples)
+	{
+		sum += sample;
+	}
+
+	summary.min = samples.front();
+	summary.mean = sum / samples.size();
+	summary.p50 = percentile(50.0);
+	summary.p95 = percentile(95.0);
+	summary.p99 = percentile(99.0);
+	return summary;
+}
+
+std::string Benchmark::toJson(const Summary& summary)
+{
+	std::ostringstream stream;
+	stream << std::fixed << std::setprecision(4);
+	stream << "{ \"min\": " << summary.min << ", \"mean\": " << summary.mean << ", \"p50\": " << summary.p50
+		<< ", \"p95\": " << summary.p95 << ", \"p99\": " << summary.p99 << " }";
+	return stream.str();
+}
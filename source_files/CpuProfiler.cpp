@@ -0,0 +1,140 @@
+#include "CpuProfiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+
+
+static const uint32_t ZONES_PER_THREAD = 1 << 16;
+
+struct Zone {
+	const char* name;
+	int64_t start;
+	int64_t end;
+};
+
+// One per thread that ever recorded a zone. Only its own thread writes it.
+struct ThreadBuffer {
+	uint32_t threadId = 0;
+	const char* threadName = nullptr;
+	std::unique_ptr<Zone[]> zones;
+	std::atomic<uint32_t> count{ 0 };		// Published with release, so a reader sees complete zones.
+	uint64_t dropped = 0;
+};
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+// Buffers outlive their threads, the trace is written after worker threads may have gone.
+static std::mutex registryMutex;
+static std::vector<std::unique_ptr<ThreadBuffer>> registry;
+
+static thread_local ThreadBuffer* threadBuffer = nullptr;
+
+static ThreadBuffer* getThreadBuffer()
+{
+	if (threadBuffer == nullptr)
+	{
+		std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer());
+		buffer->zones.reset(new Zone[ZONES_PER_THREAD]);
+
+		std::lock_guard<std::mutex> lock(registryMutex);
+		buffer->threadId = static_cast<uint32_t>(registry.size());
+		threadBuffer = buffer.get();
+		registry.push_back(std::move(buffer));
+	}
+	return threadBuffer;
+}
+
+int64_t CpuProfiler::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void CpuProfiler::recordZone(const char* name, int64_t start, int64_t end)
+{
+	ThreadBuffer* buffer = getThreadBuffer();
+
+	uint32_t index = buffer->count.load(std::memory_order_relaxed);
+	if (index >= ZONES_PER_THREAD)
+	{
+		buffer->dropped++;
+		return;
+	}
+
+	buffer->zones[index] = { name, start, end };
+	buffer->count.store(index + 1, std::memory_order_release);
+}
+
+void CpuProfiler::setThreadName(const char* name)
+{
+	getThreadBuffer()->threadName = name;
+}
+
+bool CpuProfiler::isCompiledIn()
+{
+#ifdef ENABLE_CPU_PROFILER
+	return true;
+#else
+	return false;
+#endif
+}
+
+void CpuProfiler::writeChromeTrace(const std::string& fileName)
+{
+	std::ofstream file(fileName);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open a file! (" + fileName + ")");
+	}
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+
+	// Complete ("X") events in microseconds, one track per thread.
+	file << std::fixed << std::setprecision(3);
+	file << "{\"traceEvents\":[\n";
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"CPU\"}}";
+
+	uint64_t dropped = 0;
+	for (const auto& buffer : registry)
+	{
+		if (buffer->threadName)
+		{
+			file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << buffer->threadId
+				<< ",\"args\":{\"name\":\"" << buffer->threadName << "\"}}";
+		}
+
+		uint32_t count = buffer->count.load(std::memory_order_acquire);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const Zone& zone = buffer->zones[i];
+			file << ",\n{\"name\":\"" << zone.name << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->threadId
+				<< ",\"ts\":" << zone.start / 1000.0 << ",\"dur\":" << (zone.end - zone.start) / 1000.0 << "}";
+		}
+		dropped += buffer->dropped;
+	}
+	file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+	if (dropped > 0)
+	{
+		printf("CPU profiler: %llu zones dropped, thread buffers full.\n", (unsigned long long)dropped);
+	}
+}
+
+
+CpuProfileZone::CpuProfileZone(const char* newName)
+{
+	name = newName;
+	start = CpuProfiler::now();
+}
+
+CpuProfileZone::~CpuProfileZone()
+{
+	CpuProfiler::recordZone(name, start, CpuProfiler::now());
+}
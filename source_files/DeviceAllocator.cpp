@@ -0,0 +1,397 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+
+#include "DeviceAllocator.h"
+
+// Tuning
+static const VkDeviceSize MIN_NODE_SIZE = 256;					// Smallest buddy node. Smaller requests are rounded up to it.
+static const VkDeviceSize MAX_BLOCK_SIZE = 64 * 1024 * 1024;	// Size of every block, unless a heap is too small for 8 of them.
+static const VkDeviceSize HEAP_BLOCK_FRACTION = 8;
+
+
+
+DeviceAllocator::DeviceAllocator()
+{
+}
+
+void DeviceAllocator::createDeviceAllocator(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice)
+{
+	device = newDevice;
+
+	vkGetPhysicalDeviceMemoryProperties(newPhysicalDevice, &memoryProperties);
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(newPhysicalDevice, &deviceProperties);
+	bufferImageGranularity = deviceProperties.limits.bufferImageGranularity;
+	maxAllocationCount = deviceProperties.limits.maxMemoryAllocationCount;
+
+	// Small heaps (integrated GPUs, BAR) get smaller blocks so one block can't take a big part of the heap.
+	VkDeviceSize smallestHeap = MAX_BLOCK_SIZE * HEAP_BLOCK_FRACTION;
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+	{
+		smallestHeap = std::min(smallestHeap, memoryProperties.memoryHeaps[i].size);
+	}
+
+	blockSize = MAX_BLOCK_SIZE;
+	while (blockSize > MIN_NODE_SIZE && blockSize * HEAP_BLOCK_FRACTION > smallestHeap)
+	{
+		blockSize /= 2;
+	}
+
+	maxOrder = 0;
+	while ((MIN_NODE_SIZE << maxOrder) < blockSize)
+	{
+		maxOrder++;
+	}
+
+	pools.resize(memoryProperties.memoryTypeCount * 2);
+	for (uint32_t i = 0; i < pools.size(); i++)
+	{
+		pools[i].memoryType = i / 2;
+	}
+}
+
+DeviceAllocation DeviceAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear,
+	MemoryCategory category)
+{
+	uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+	VkDeviceSize nodeSize = std::max(std::max(requirements.size, requirements.alignment), MIN_NODE_SIZE);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	DeviceAllocation allocation;
+	allocation.size = requirements.size;
+	allocation.category = category;
+	stats.categoryBytes[category] += requirements.size;
+
+	// Too big for a block, give it its own memory.
+	// Lazily allocated memory too: the driver commits it per VkDeviceMemory, if at all, so sharing a block defeats it.
+	bool lazy = (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+	if (nodeSize > blockSize || lazy)
+	{
+		uint8_t* mapped = nullptr;
+		allocation.memory = allocateMemory(memoryType, requirements.size, &mapped);
+		allocation.mapped = mapped;
+		allocation.pool = memoryType * 2;
+		allocation.dedicated = true;
+
+		stats.allocationCount++;
+		stats.dedicatedCount++;
+		stats.requestedBytes += requirements.size;
+		stats.allocatedBytes += requirements.size;
+		return allocation;
+	}
+
+	uint32_t order = 0;
+	while ((MIN_NODE_SIZE << order) < nodeSize)
+	{
+		order++;
+	}
+
+	bool optimal = !linear && bufferImageGranularity > 1;
+	allocation.pool = memoryType * 2 + (optimal ? 1 : 0);
+	Pool& pool = pools[allocation.pool];
+
+	// First block with a big enough free node. Blocks fill up in order, which keeps the later ones free to release.
+	VkDeviceSize offset = 0;
+	uint32_t blockIndex = UINT32_MAX;
+	for (uint32_t i = 0; i < pool.blocks.size(); i++)
+	{
+		if (pool.blocks[i].memory != VK_NULL_HANDLE && allocateNode(pool.blocks[i], order, &offset))
+		{
+			blockIndex = i;
+			break;
+		}
+	}
+
+	// All full, new block (in a released slot if there is one).
+	if (blockIndex == UINT32_MAX)
+	{
+		for (uint32_t i = 0; i < pool.blocks.size() && blockIndex == UINT32_MAX; i++)
+		{
+			if (pool.blocks[i].memory == VK_NULL_HANDLE)
+			{
+				blockIndex = i;
+			}
+		}
+		if (blockIndex == UINT32_MAX)
+		{
+			blockIndex = static_cast<uint32_t>(pool.blocks.size());
+			pool.blocks.push_back(Block());
+		}
+
+		Block& block = pool.blocks[blockIndex];
+		block.memory = allocateMemory(memoryType, blockSize, &block.mapped);
+		block.freeLists.assign(maxOrder + 1, std::set<VkDeviceSize>());
+		block.freeLists[maxOrder].insert(0);
+		allocateNode(block, order, &offset);
+	}
+
+	Block& block = pool.blocks[blockIndex];
+	block.usedBytes += MIN_NODE_SIZE << order;
+
+	allocation.memory = block.memory;
+	allocation.offset = offset;
+	allocation.mapped = block.mapped ? block.mapped + offset : nullptr;
+	allocation.block = blockIndex;
+	allocation.order = order;
+
+	stats.allocationCount++;
+	stats.requestedBytes += requirements.size;
+	stats.allocatedBytes += MIN_NODE_SIZE << order;
+	return allocation;
+}
+
+void DeviceAllocator::free(DeviceAllocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE) return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	stats.allocationCount--;
+	stats.requestedBytes -= allocation.size;
+	stats.categoryBytes[allocation.category] -= allocation.size;
+
+	if (allocation.dedicated)
+	{
+		freeMemory(allocation.pool / 2, allocation.memory, allocation.size, allocation.mapped != nullptr);
+		stats.dedicatedCount--;
+		stats.allocatedBytes -= allocation.size;
+		allocation = DeviceAllocation();
+		return;
+	}
+
+	Pool& pool = pools[allocation.pool];
+	Block& block = pool.blocks[allocation.block];
+	VkDeviceSize nodeSize = MIN_NODE_SIZE << allocation.order;
+
+	freeNode(block, allocation.order, allocation.offset);
+	block.usedBytes -= nodeSize;
+	stats.allocatedBytes -= nodeSize;
+
+	// Release empty blocks, but keep the pool's last one so loading and unloading doesn't allocate every time.
+	if (block.usedBytes == 0)
+	{
+		uint32_t liveBlocks = 0;
+		for (const Block& other : pool.blocks)
+		{
+			liveBlocks += other.memory != VK_NULL_HANDLE ? 1 : 0;
+		}
+
+		if (liveBlocks > 1)
+		{
+			freeMemory(pool.memoryType, block.memory, blockSize, block.mapped != nullptr);
+			block = Block();
+		}
+	}
+
+	allocation = DeviceAllocation();
+}
+
+void DeviceAllocator::createBuffer(VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkMemoryPropertyFlags bufferProperties,
+	MemoryCategory category, VkBuffer* buffer, DeviceAllocation* allocation)
+{
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = bufferSize;
+	bufferInfo.usage = bufferUsage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkResult result = vkCreateBuffer(device, &bufferInfo, nullptr, buffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a Buffer!");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, *buffer, &memRequirements);
+
+	*allocation = allocate(memRequirements, bufferProperties, true, category);
+
+	result = vkBindBufferMemory(device, *buffer, allocation->memory, allocation->offset);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to bind buffer memory!");
+	}
+}
+
+void DeviceAllocator::destroyBuffer(VkBuffer buffer, DeviceAllocation& allocation)
+{
+	vkDestroyBuffer(device, buffer, nullptr);
+	free(allocation);
+}
+
+bool DeviceAllocator::hasMemoryType(uint32_t allowedTypes, VkMemoryPropertyFlags properties)
+{
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		if ((allowedTypes & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+VkMemoryPropertyFlags DeviceAllocator::getPropertyFlags(const DeviceAllocation& allocation)
+{
+	return memoryProperties.memoryTypes[allocation.pool / 2].propertyFlags;
+}
+
+const VkPhysicalDeviceMemoryProperties& DeviceAllocator::getMemoryProperties()
+{
+	return memoryProperties;
+}
+
+DeviceAllocatorStats DeviceAllocator::getStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+void DeviceAllocator::printStats()
+{
+	DeviceAllocatorStats current = getStats();
+	const double MiB = 1024.0 * 1024.0;
+
+	printf("Device memory: %llu blocks (%.1f MiB, peak %.1f MiB), %llu allocations (%.1f MiB requested, %.1f MiB in nodes), %llu dedicated, %llu vkAllocateMemory calls.\n",
+		(unsigned long long)current.blockCount, current.blockBytes / MiB, current.peakBlockBytes / MiB,
+		(unsigned long long)current.allocationCount, current.requestedBytes / MiB, current.allocatedBytes / MiB,
+		(unsigned long long)current.dedicatedCount, (unsigned long long)current.vkAllocateCalls);
+}
+
+void DeviceAllocator::destroyDeviceAllocator()
+{
+	if (stats.allocationCount > 0)
+	{
+		printf("Device allocator destroyed with %llu allocations still live.\n", (unsigned long long)stats.allocationCount);
+	}
+
+	for (Pool& pool : pools)
+	{
+		for (Block& block : pool.blocks)
+		{
+			if (block.memory != VK_NULL_HANDLE)
+			{
+				freeMemory(pool.memoryType, block.memory, blockSize, block.mapped != nullptr);
+			}
+		}
+	}
+	pools.clear();
+}
+
+DeviceAllocator::~DeviceAllocator()
+{
+}
+
+uint32_t DeviceAllocator::findMemoryType(uint32_t allowedTypes, VkMemoryPropertyFlags properties)
+{
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		if ((allowedTypes & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return i;
+		}
+	}
+
+	throw std::runtime_error("Failed to find a suitable memory type!");
+}
+
+VkDeviceMemory DeviceAllocator::allocateMemory(uint32_t memoryType, VkDeviceSize size, uint8_t** mapped)
+{
+	if (stats.blockCount >= maxAllocationCount)
+	{
+		throw std::runtime_error("Reached maxMemoryAllocationCount!");
+	}
+
+	VkMemoryAllocateInfo memoryAllocInfo = {};
+	memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memoryAllocInfo.allocationSize = size;
+	memoryAllocInfo.memoryTypeIndex = memoryType;
+
+	VkDeviceMemory memory;
+	VkResult result = vkAllocateMemory(device, &memoryAllocInfo, nullptr, &memory);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate device memory!");
+	}
+
+	// Map host visible memory once, a VkDeviceMemory can't be mapped twice at the same time.
+	*mapped = nullptr;
+	if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		void* data;
+		result = vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &data);
+		if (result != VK_SUCCESS)
+		{
+			vkFreeMemory(device, memory, nullptr);
+			throw std::runtime_error("Failed to map device memory!");
+		}
+		*mapped = static_cast<uint8_t*>(data);
+	}
+
+	stats.blockCount++;
+	stats.blockBytes += size;
+	stats.heapBytes[memoryProperties.memoryTypes[memoryType].heapIndex] += size;
+	stats.peakBlockBytes = std::max(stats.peakBlockBytes, stats.blockBytes);
+	stats.vkAllocateCalls++;
+	return memory;
+}
+
+void DeviceAllocator::freeMemory(uint32_t memoryType, VkDeviceMemory memory, VkDeviceSize size, bool isMapped)
+{
+	if (isMapped)
+	{
+		vkUnmapMemory(device, memory);
+	}
+	vkFreeMemory(device, memory, nullptr);
+
+	stats.blockCount--;
+	stats.blockBytes -= size;
+	stats.heapBytes[memoryProperties.memoryTypes[memoryType].heapIndex] -= size;
+}
+
+bool DeviceAllocator::allocateNode(Block& block, uint32_t order, VkDeviceSize* offset)
+{
+	// Smallest free node that fits, split down to the requested size. Lowest offsets first, keeps blocks compact.
+	uint32_t current = order;
+	while (current <= maxOrder && block.freeLists[current].empty())
+	{
+		current++;
+	}
+	if (current > maxOrder)
+	{
+		return false;
+	}
+
+	VkDeviceSize node = *block.freeLists[current].begin();
+	block.freeLists[current].erase(block.freeLists[current].begin());
+
+	// Upper halves go back on the free lists.
+	while (current > order)
+	{
+		current--;
+		block.freeLists[current].insert(node + (MIN_NODE_SIZE << current));
+	}
+
+	*offset = node;
+	return true;
+}
+
+void DeviceAllocator::freeNode(Block& block, uint32_t order, VkDeviceSize offset)
+{
+	// Merge with the buddy for as long as it is free too.
+	while (order < maxOrder)
+	{
+		VkDeviceSize buddy = offset ^ (MIN_NODE_SIZE << order);
+		if (block.freeLists[order].erase(buddy) == 0)
+		{
+			break;
+		}
+		offset = std::min(offset, buddy);
+		order++;
+	}
+
+	block.freeLists[order].insert(offset);
+}
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <cmath>
+
+#include "DynamicResolution.h"
+
+// Tuning
+static const double SMOOTHING = 0.2;			// Weight of a new sample in the moving average.
+static const double LOWER_BAND = 0.8;			// Only scale up when under this fraction of the target.
+static const uint32_t FRAMES_TO_DROP = 4;		// Frames over the target before scaling down.
+static const uint32_t FRAMES_TO_RAISE = 30;		// Frames under the lower band before scaling up.
+static const uint32_t COOLDOWN_FRAMES = 8;		// Frames ignored after a change, covers frames in flight at the old scale.
+static const float SCALE_STEP = 0.05f;			// Scales are multiples of this, so small noise can't cause a change.
+
+
+
+DynamicResolution::DynamicResolution()
+{
+}
+
+DynamicResolution::DynamicResolution(float newTargetMs, float newMinScale, float newMaxScale)
+{
+	targetMs = newTargetMs;
+	minScale = std::min(newMinScale, newMaxScale);
+	maxScale = newMaxScale;
+	scale = maxScale;
+}
+
+bool DynamicResolution::update(double gpuMs)
+{
+	if (cooldown > 0)
+	{
+		cooldown--;
+		return false;
+	}
+
+	smoothedMs = smoothedMs > 0.0 ? smoothedMs + (gpuMs - smoothedMs) * SMOOTHING : gpuMs;
+
+	framesOver = smoothedMs > targetMs ? framesOver + 1 : 0;
+	framesUnder = smoothedMs < targetMs * LOWER_BAND ? framesUnder + 1 : 0;
+
+	float newScale = scale;
+	if (framesOver >= FRAMES_TO_DROP)
+	{
+		// GPU time is roughly proportional to pixel count, so scale each axis by the square root.
+		// Drop straight to the estimate, at least one step.
+		float estimate = scale * static_cast<float>(std::sqrt(targetMs / smoothedMs));
+		newScale = std::min(quantize(estimate), scale - SCALE_STEP);
+	}
+	else if (framesUnder >= FRAMES_TO_RAISE)
+	{
+		// Come back up one step at a time.
+		newScale = scale + SCALE_STEP;
+	}
+
+	newScale = std::max(minScale, std::min(maxScale, newScale));
+	if (std::fabs(newScale - scale) < SCALE_STEP * 0.5f)
+	{
+		return false;
+	}
+
+	scale = newScale;
+	smoothedMs = 0.0;
+	framesOver = 0;
+	framesUnder = 0;
+	cooldown = COOLDOWN_FRAMES;
+	return true;
+}
+
+float DynamicResolution::getScale()
+{
+	return scale;
+}
+
+VkExtent2D DynamicResolution::getExtent(VkExtent2D fullExtent)
+{
+	VkExtent2D extent = {};
+	extent.width = std::max(1u, static_cast<uint32_t>(fullExtent.width * scale + 0.5f));
+	extent.height = std::max(1u, static_cast<uint32_t>(fullExtent.height * scale + 0.5f));
+	extent.width = std::min(extent.width, fullExtent.width);
+	extent.height = std::min(extent.height, fullExtent.height);
+	return extent;
+}
+
+float DynamicResolution::quantize(float newScale)
+{
+	return std::floor(newScale / SCALE_STEP + 0.5f) * SCALE_STEP;
+}
+
+DynamicResolution::~DynamicResolution()
+{
+}
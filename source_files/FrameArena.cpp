@@ -0,0 +1,64 @@
+#include "FrameArena.h"
+
+
+
+FrameArena::FrameArena()
+{
+}
+
+FrameArena::FrameArena(size_t newCapacity)
+{
+	block.resize(newCapacity);
+}
+
+void FrameArena::reset()
+{
+	// Last frame didn't fit. Grow so that it would have, with some headroom.
+	if (!overflowBlocks.empty())
+	{
+		size_t newCapacity = (block.size() + overflowBytes) * 2;
+		block.clear();
+		block.shrink_to_fit();
+		block.resize(newCapacity);
+
+		overflowBlocks.clear();
+		overflowBytes = 0;
+	}
+
+	offset = 0;
+}
+
+void* FrameArena::allocate(size_t size, size_t alignment)
+{
+	// Round the offset up to the alignment (which is always a power of 2).
+	uintptr_t base = reinterpret_cast<uintptr_t>(block.data());
+	uintptr_t aligned = (base + offset + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+	size_t newOffset = (aligned - base) + size;
+
+	if (!block.empty() && newOffset <= block.size())
+	{
+		offset = newOffset;
+		return reinterpret_cast<void*>(aligned);
+	}
+
+	// Out of space. Give this allocation its own heap block until the next reset.
+	overflowBlocks.emplace_back(size + alignment);
+	overflowBytes += size + alignment;
+
+	uintptr_t overflowBase = reinterpret_cast<uintptr_t>(overflowBlocks.back().data());
+	return reinterpret_cast<void*>((overflowBase + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1));
+}
+
+size_t FrameArena::getUsed()
+{
+	return offset + overflowBytes;
+}
+
+size_t FrameArena::getCapacity()
+{
+	return block.size();
+}
+
+FrameArena::~FrameArena()
+{
+}
@@ -0,0 +1,225 @@
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+
+#include "FrameScheduler.h"
+#include "CpuProfiler.h"
+
+
+
+FrameScheduler::FrameScheduler()
+{
+}
+
+void FrameScheduler::createFrameScheduler(VkDevice newDevice, uint32_t newFrameCount, uint32_t imageCount, bool newPresenting)
+{
+	if (newFrameCount == 0)
+	{
+		throw std::runtime_error("Need at least one frame in flight!");
+	}
+
+	device = newDevice;
+	frameCount = newFrameCount;
+	presenting = newPresenting;
+
+	frameValues.assign(frameCount, 0);
+	imageValues.assign(imageCount, 0);
+
+	// Timeline starts at 0, which every slot and image counts as already finished.
+	VkSemaphoreTypeCreateInfo timelineCreateInfo = {};
+	timelineCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	timelineCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineCreateInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreCreateInfo.pNext = &timelineCreateInfo;
+
+	if (vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &timeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the frame timeline semaphore!");
+	}
+
+	if (!presenting)
+	{
+		return;
+	}
+
+	// Binary semaphores for acquire/present.
+	semaphoreCreateInfo.pNext = nullptr;
+	imageAvailable.resize(frameCount);
+	renderFinished.resize(frameCount);
+
+	for (uint32_t i = 0; i < frameCount; i++)
+	{
+		if (vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &imageAvailable[i]) != VK_SUCCESS ||
+			vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &renderFinished[i]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create a Semaphore!");
+		}
+	}
+}
+
+uint32_t FrameScheduler::getFrameCount()
+{
+	return frameCount;
+}
+
+uint32_t FrameScheduler::getCurrentFrame()
+{
+	return currentFrame;
+}
+
+uint64_t FrameScheduler::getFrameNumber()
+{
+	return frameNumber;
+}
+
+void FrameScheduler::beginFrame()
+{
+	currentWaitMs = 0.0;
+	waitForValue(frameValues[currentFrame]);
+	frameNumber++;
+}
+
+void FrameScheduler::waitForImage(uint32_t image)
+{
+	waitForValue(imageValues[image]);
+}
+
+VkSemaphore FrameScheduler::getImageAvailable()
+{
+	return imageAvailable[currentFrame];
+}
+
+VkSemaphore FrameScheduler::getRenderFinished()
+{
+	return renderFinished[currentFrame];
+}
+
+void FrameScheduler::submit(VkQueue queue, VkCommandBuffer commandBuffer, uint32_t image)
+{
+	uint64_t signalValue = submittedValue + 1;
+
+	// Timeline first, binary present semaphore second. Value for a binary semaphore is ignored.
+	VkSemaphore signalSemaphores[] = { timeline, VK_NULL_HANDLE };
+	uint64_t signalValues[] = { signalValue, 0 };
+	uint32_t signalCount = 1;
+	if (presenting)
+	{
+		signalSemaphores[1] = renderFinished[currentFrame];
+		signalCount = 2;
+	}
+
+	VkTimelineSemaphoreSubmitInfo timelineSubmitInfo = {};
+	timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineSubmitInfo.waitSemaphoreValueCount = 0;			// Only waiting on the binary acquire semaphore.
+	timelineSubmitInfo.pWaitSemaphoreValues = nullptr;
+	timelineSubmitInfo.signalSemaphoreValueCount = signalCount;
+	timelineSubmitInfo.pSignalSemaphoreValues = signalValues;
+
+	// Transfer too, the upscale blit writes the swapchain image outside the render pass.
+	VkPipelineStageFlags waitStages[] = {
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT
+	};
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineSubmitInfo;
+	submitInfo.waitSemaphoreCount = presenting ? 1 : 0;
+	submitInfo.pWaitSemaphores = presenting ? &imageAvailable[currentFrame] : nullptr;
+	submitInfo.pWaitDstStageMask = waitStages;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = signalCount;
+	submitInfo.pSignalSemaphores = signalSemaphores;
+
+	VkResult result = vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to submit commandbuffer to queue!");
+	}
+
+	submittedValue = signalValue;
+	frameValues[currentFrame] = signalValue;
+	imageValues[image] = signalValue;
+}
+
+void FrameScheduler::endFrame()
+{
+	lastWaitMs = currentWaitMs;
+	totalWaitMs += currentWaitMs;
+	maxWaitMs = std::max(maxWaitMs, currentWaitMs);
+
+	currentFrame = (currentFrame + 1) % frameCount;
+}
+
+double FrameScheduler::getLastWaitMs()
+{
+	return lastWaitMs;
+}
+
+double FrameScheduler::getTotalWaitMs()
+{
+	return totalWaitMs;
+}
+
+double FrameScheduler::getMaxWaitMs()
+{
+	return maxWaitMs;
+}
+
+void FrameScheduler::waitForValue(uint64_t value)
+{
+	// Already done, don't bother the driver.
+	uint64_t completedValue = 0;
+	vkGetSemaphoreCounterValue(device, timeline, &completedValue);
+	if (completedValue >= value)
+	{
+		return;
+	}
+
+	VkSemaphoreWaitInfo waitInfo = {};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &timeline;
+	waitInfo.pValues = &value;
+
+	PROFILE_ZONE("Wait for GPU");
+	auto start = std::chrono::steady_clock::now();
+	VkResult result = vkWaitSemaphores(device, &waitInfo, FRAME_WAIT_TIMEOUT);
+	auto end = std::chrono::steady_clock::now();
+
+	currentWaitMs += std::chrono::duration<double, std::milli>(end - start).count();
+
+	// A frame taking this long means the GPU hung or the device is lost, don't block forever.
+	if (result == VK_TIMEOUT)
+	{
+		throw std::runtime_error("Timed out waiting for the GPU to finish a frame!");
+	}
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to wait for the frame timeline semaphore!");
+	}
+}
+
+void FrameScheduler::destroyFrameScheduler()
+{
+	for (size_t i = 0; i < imageAvailable.size(); i++)
+	{
+		vkDestroySemaphore(device, renderFinished[i], nullptr);
+		vkDestroySemaphore(device, imageAvailable[i], nullptr);
+	}
+	imageAvailable.clear();
+	renderFinished.clear();
+
+	if (timeline != VK_NULL_HANDLE)
+	{
+		vkDestroySemaphore(device, timeline, nullptr);
+		timeline = VK_NULL_HANDLE;
+	}
+}
+
+FrameScheduler::~FrameScheduler()
+{
+}
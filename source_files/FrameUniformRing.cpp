@@ -0,0 +1,93 @@
+#include <stdexcept>
+#include <algorithm>
+
+#include "FrameUniformRing.h"
+
+
+
+FrameUniformRing::FrameUniformRing()
+{
+}
+
+void FrameUniformRing::createFrameUniformRing(DeviceAllocator* newAllocator, VkPhysicalDevice physicalDevice, VkDeviceSize newFrameSize,
+	uint32_t frameCount, VkBufferUsageFlags usage)
+{
+	allocator = newAllocator;
+	frameSize = newFrameSize;
+
+	// Dynamic offsets must be multiples of the device's minimum offset alignment (always a power of 2).
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+	alignment = 1;
+	if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+	{
+		alignment = std::max(alignment, deviceProperties.limits.minUniformBufferOffsetAlignment);
+	}
+	if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+	{
+		alignment = std::max(alignment, deviceProperties.limits.minStorageBufferOffsetAlignment);
+	}
+
+	buffers.resize(frameCount);
+	bufferAllocations.resize(frameCount);
+	mappedData.resize(frameCount);
+
+	for (uint32_t i = 0; i < frameCount; i++)
+	{
+		allocator->createBuffer(frameSize, usage,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MEMORY_UNIFORMS, &buffers[i], &bufferAllocations[i]);
+
+		// Host visible memory stays mapped by the allocator until freed.
+		mappedData[i] = static_cast<uint8_t*>(bufferAllocations[i].mapped);
+	}
+}
+
+void FrameUniformRing::beginFrame(uint32_t frame)
+{
+	currentFrame = frame;
+	currentOffset = 0;
+}
+
+uint32_t FrameUniformRing::allocate(VkDeviceSize size)
+{
+	VkDeviceSize offset = (currentOffset + alignment - 1) & ~(alignment - 1);
+	if (offset + size > frameSize)
+	{
+		throw std::runtime_error("Frame uniform ring is full!");
+	}
+
+	currentOffset = offset + size;
+	return static_cast<uint32_t>(offset);
+}
+
+void* FrameUniformRing::getMapped(uint32_t offset)
+{
+	return mappedData[currentFrame] + offset;
+}
+
+VkBuffer FrameUniformRing::getBuffer(uint32_t frame)
+{
+	return buffers[frame];
+}
+
+VkDeviceSize FrameUniformRing::getAlignment()
+{
+	return alignment;
+}
+
+void FrameUniformRing::destroyFrameUniformRing()
+{
+	for (size_t i = 0; i < buffers.size(); i++)
+	{
+		allocator->destroyBuffer(buffers[i], bufferAllocations[i]);
+	}
+
+	buffers.clear();
+	bufferAllocations.clear();
+	mappedData.clear();
+}
+
+FrameUniformRing::~FrameUniformRing()
+{
+}
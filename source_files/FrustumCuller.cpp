@@ -0,0 +1,165 @@
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRUSTUM_CULLER_SSE 1
+#include <xmmintrin.h>
+#endif
+
+#include "FrustumCuller.h"
+
+
+
+MeshBounds transformBounds(const MeshBounds& bounds, const glm::mat4& transform)
+{
+	// Centre transforms as a point, extent by the absolute 3x3 part (Arvo).
+	glm::vec3 center = (bounds.boundsMin + bounds.boundsMax) * 0.5f;
+	glm::vec3 extent = (bounds.boundsMax - bounds.boundsMin) * 0.5f;
+	glm::vec3 worldCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+	glm::vec3 worldExtent;
+	for (int row = 0; row < 3; row++)
+	{
+		worldExtent[row] = std::fabs(transform[0][row]) * extent.x + std::fabs(transform[1][row]) * extent.y + std::fabs(transform[2][row]) * extent.z;
+	}
+
+	float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+
+	MeshBounds result;
+	result.boundsMin = worldCenter - worldExtent;
+	result.boundsMax = worldCenter + worldExtent;
+	result.sphereCenter = glm::vec3(transform * glm::vec4(bounds.sphereCenter, 1.0f));
+	result.sphereRadius = bounds.sphereRadius * scale;
+	return result;
+}
+
+FrustumCuller::FrustumCuller()
+{
+}
+
+void FrustumCuller::begin(const glm::mat4& viewProjection)
+{
+	extractPlanes(viewProjection, planes);
+	boxCount = 0;
+}
+
+void FrustumCuller::addBox(const MeshBounds& bounds, const glm::mat4& transform)
+{
+	MeshBounds world = transformBounds(bounds, transform);
+	glm::vec3 worldCenter = (world.boundsMin + world.boundsMax) * 0.5f;
+	glm::vec3 worldExtent = (world.boundsMax - world.boundsMin) * 0.5f;
+
+	size_t paddedCount = (boxCount + 4) & ~size_t(3);
+	if (centerX.size() < paddedCount)
+	{
+		centerX.resize(paddedCount, 0.0f);
+		centerY.resize(paddedCount, 0.0f);
+		centerZ.resize(paddedCount, 0.0f);
+		extentX.resize(paddedCount, 0.0f);
+		extentY.resize(paddedCount, 0.0f);
+		extentZ.resize(paddedCount, 0.0f);
+	}
+
+	centerX[boxCount] = worldCenter.x;
+	centerY[boxCount] = worldCenter.y;
+	centerZ[boxCount] = worldCenter.z;
+	extentX[boxCount] = worldExtent.x;
+	extentY[boxCount] = worldExtent.y;
+	extentZ[boxCount] = worldExtent.z;
+	boxCount++;
+}
+
+size_t FrustumCuller::cull(uint8_t* visible)
+{
+	size_t visibleCount = 0;
+
+#ifdef FRUSTUM_CULLER_SSE
+	// A box is outside if, for some plane, centre distance < -(box extent projected on the plane normal).
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+	for (int p = 0; p < 6; p++)
+	{
+		planeX[p] = _mm_set1_ps(planes[p].x);
+		planeY[p] = _mm_set1_ps(planes[p].y);
+		planeZ[p] = _mm_set1_ps(planes[p].z);
+		planeW[p] = _mm_set1_ps(planes[p].w);
+		absX[p] = _mm_set1_ps(std::fabs(planes[p].x));
+		absY[p] = _mm_set1_ps(std::fabs(planes[p].y));
+		absZ[p] = _mm_set1_ps(std::fabs(planes[p].z));
+	}
+	const __m128 zero = _mm_setzero_ps();
+
+	for (size_t i = 0; i < boxCount; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(&centerX[i]);
+		__m128 cy = _mm_loadu_ps(&centerY[i]);
+		__m128 cz = _mm_loadu_ps(&centerZ[i]);
+		__m128 ex = _mm_loadu_ps(&extentX[i]);
+		__m128 ey = _mm_loadu_ps(&extentY[i]);
+		__m128 ez = _mm_loadu_ps(&extentZ[i]);
+
+		__m128 outside = zero;
+		for (int p = 0; p < 6; p++)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], cx), _mm_mul_ps(planeY[p], cy)),
+				_mm_add_ps(_mm_mul_ps(planeZ[p], cz), planeW[p]));
+			__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absX[p], ex), _mm_mul_ps(absY[p], ey)), _mm_mul_ps(absZ[p], ez));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+		}
+
+		int outsideMask = _mm_movemask_ps(outside);
+		for (size_t j = 0; j < 4 && i + j < boxCount; j++)
+		{
+			visible[i + j] = (outsideMask & (1 << j)) ? 0 : 1;
+			visibleCount += visible[i + j];
+		}
+	}
+#else
+	for (size_t i = 0; i < boxCount; i++)
+	{
+		bool outside = false;
+		for (int p = 0; p < 6 && !outside; p++)
+		{
+			float distance = planes[p].x * centerX[i] + planes[p].y * centerY[i] + planes[p].z * centerZ[i] + planes[p].w;
+			float radius = std::fabs(planes[p].x) * extentX[i] + std::fabs(planes[p].y) * extentY[i] + std::fabs(planes[p].z) * extentZ[i];
+			outside = distance + radius < 0.0f;
+		}
+		visible[i] = outside ? 0 : 1;
+		visibleCount += visible[i];
+	}
+#endif
+
+	return visibleCount;
+}
+
+size_t FrustumCuller::getBoxCount()
+{
+	return boxCount;
+}
+
+void FrustumCuller::extractPlanes(const glm::mat4& clip, glm::vec4 planes[6])
+{
+	// Gribb/Hartmann: each plane is a sum or difference of rows of the clip matrix.
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++)
+	{
+		rows[i] = glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+	}
+	planes[0] = rows[3] + rows[0];
+	planes[1] = rows[3] - rows[0];
+	planes[2] = rows[3] + rows[1];
+	planes[3] = rows[3] - rows[1];
+	planes[4] = rows[2];
+	planes[5] = rows[3] - rows[2];
+
+	for (int i = 0; i < 6; i++)
+	{
+		float length = glm::length(glm::vec3(planes[i]));
+		if (length > 0.0f)
+		{
+			planes[i] = planes[i] / length;
+		}
+	}
+}
+
+FrustumCuller::~FrustumCuller()
+{
+}
@@ -0,0 +1,237 @@
+#include <stdexcept>
+#include <algorithm>
+
+#include "GeometryArena.h"
+
+
+
+static const VkBufferUsageFlags GEOMETRY_TRANSFER_USAGE = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+GeometryArena::GeometryArena()
+{
+}
+
+void GeometryArena::createGeometryArena(DeviceAllocator* newAllocator, UploadManager* newUploadManager, uint32_t newVertexByteCapacity, uint32_t newIndexByteCapacity)
+{
+	allocator = newAllocator;
+	uploadManager = newUploadManager;
+	vertexByteCapacity = newVertexByteCapacity;
+	indexByteCapacity = newIndexByteCapacity;
+
+	// Transfer source too, growing copies the old buffer's contents.
+	allocator->createBuffer(vertexByteCapacity, GEOMETRY_TRANSFER_USAGE | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_GEOMETRY, &vertexBuffer, &vertexBufferAllocation);
+	allocator->createBuffer(indexByteCapacity, GEOMETRY_TRANSFER_USAGE | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_GEOMETRY, &indexBuffer, &indexBufferAllocation);
+
+	// Everything starts out free.
+	freeVertexRanges.assign(1, { 0, vertexByteCapacity });
+	freeIndexRanges.assign(1, { 0, indexByteCapacity });
+	usedVertexBytes = 0;
+	usedIndexBytes = 0;
+}
+
+void GeometryArena::addMesh(const std::vector<uint8_t>& vertexData, uint32_t vertexStride, const std::vector<uint8_t>& indexData, uint32_t indexSize,
+	GeometryRange* vertexRange, GeometryRange* indexRange)
+{
+	uint32_t vertexBytes = static_cast<uint32_t>(vertexData.size());
+	uint32_t indexBytes = static_cast<uint32_t>(indexData.size());
+
+	if (!allocateRange(freeVertexRanges, vertexBytes, vertexStride, vertexRange))
+	{
+		growBuffer(&vertexBuffer, &vertexBufferAllocation, &vertexByteCapacity, freeVertexRanges, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBytes, vertexStride);
+		allocateRange(freeVertexRanges, vertexBytes, vertexStride, vertexRange);
+	}
+	if (!allocateRange(freeIndexRanges, indexBytes, indexSize, indexRange))
+	{
+		growBuffer(&indexBuffer, &indexBufferAllocation, &indexByteCapacity, freeIndexRanges, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBytes, indexSize);
+		allocateRange(freeIndexRanges, indexBytes, indexSize, indexRange);
+	}
+	usedVertexBytes += vertexBytes;
+	usedIndexBytes += indexBytes;
+
+	uploadManager->uploadBuffer(vertexBuffer, vertexRange->offset, vertexData.data(), vertexBytes);
+	uploadManager->uploadBuffer(indexBuffer, indexRange->offset, indexData.data(), indexBytes);
+}
+
+void GeometryArena::freeMesh(GeometryRange& vertexRange, GeometryRange& indexRange)
+{
+	freeRange(freeVertexRanges, vertexRange);
+	freeRange(freeIndexRanges, indexRange);
+	usedVertexBytes -= vertexRange.count;
+	usedIndexBytes -= indexRange.count;
+
+	vertexRange = GeometryRange();
+	indexRange = GeometryRange();
+}
+
+VkBuffer GeometryArena::getVertexBuffer()
+{
+	return vertexBuffer;
+}
+
+VkBuffer GeometryArena::getIndexBuffer()
+{
+	return indexBuffer;
+}
+
+uint32_t GeometryArena::getUsedVertexBytes()
+{
+	return usedVertexBytes;
+}
+
+uint32_t GeometryArena::getUsedIndexBytes()
+{
+	return usedIndexBytes;
+}
+
+uint32_t GeometryArena::getVertexByteCapacity()
+{
+	return vertexByteCapacity;
+}
+
+uint32_t GeometryArena::getIndexByteCapacity()
+{
+	return indexByteCapacity;
+}
+
+void GeometryArena::destroyRetiredBuffers(uint64_t frameNumber, uint64_t completedFrame)
+{
+	for (size_t i = 0; i < retiredBuffers.size();)
+	{
+		// Frames begun before this one may have been recorded with the old buffer. The copy out of it was submitted before this frame.
+		if (retiredBuffers[i].frame == 0)
+		{
+			retiredBuffers[i].frame = frameNumber;
+		}
+
+		if (retiredBuffers[i].frame <= completedFrame)
+		{
+			allocator->destroyBuffer(retiredBuffers[i].buffer, retiredBuffers[i].allocation);
+			retiredBuffers[i] = retiredBuffers.back();
+			retiredBuffers.pop_back();
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+void GeometryArena::destroyGeometryArena()
+{
+	allocator->destroyBuffer(vertexBuffer, vertexBufferAllocation);
+	allocator->destroyBuffer(indexBuffer, indexBufferAllocation);
+	for (auto& retired : retiredBuffers)
+	{
+		allocator->destroyBuffer(retired.buffer, retired.allocation);
+	}
+	retiredBuffers.clear();
+
+	freeVertexRanges.clear();
+	freeIndexRanges.clear();
+}
+
+GeometryArena::~GeometryArena()
+{
+}
+
+void GeometryArena::growBuffer(VkBuffer* buffer, DeviceAllocation* allocation, uint32_t* capacity, std::vector<GeometryRange>& freeRanges,
+	VkBufferUsageFlags usage, uint32_t count, uint32_t alignment)
+{
+	// Doubling keeps the number of copies logarithmic in the scene size. Enough for the range even if no free space is at the end.
+	uint64_t newCapacity = std::max((uint64_t)*capacity * 2, (uint64_t)*capacity + count + alignment);
+	if (newCapacity > UINT32_MAX)
+	{
+		throw std::runtime_error("Geometry arena can't grow past 4 GiB!");
+	}
+
+	VkBuffer newBuffer;
+	DeviceAllocation newAllocation;
+	allocator->createBuffer(newCapacity, GEOMETRY_TRANSFER_USAGE | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_GEOMETRY,
+		&newBuffer, &newAllocation);
+
+	// Only the used ranges (the gaps between free ones), uploads into free ranges may run while the copy does.
+	std::vector<VkBufferCopy> regions;
+	uint32_t usedBegin = 0;
+	for (const auto& range : freeRanges)
+	{
+		if (range.offset > usedBegin)
+		{
+			regions.push_back({ usedBegin, usedBegin, range.offset - usedBegin });
+		}
+		usedBegin = range.offset + range.count;
+	}
+	if (*capacity > usedBegin)
+	{
+		regions.push_back({ usedBegin, usedBegin, *capacity - usedBegin });
+	}
+	uploadManager->copyBuffer(*buffer, newBuffer, regions);
+
+	retiredBuffers.push_back({ *buffer, *allocation, 0 });
+	*buffer = newBuffer;
+	*allocation = newAllocation;
+
+	freeRange(freeRanges, { *capacity, static_cast<uint32_t>(newCapacity) - *capacity });
+	*capacity = static_cast<uint32_t>(newCapacity);
+}
+
+bool GeometryArena::allocateRange(std::vector<GeometryRange>& freeRanges, uint32_t count, uint32_t alignment, GeometryRange* range)
+{
+	// Empty meshes take no space.
+	if (count == 0)
+	{
+		*range = GeometryRange();
+		return true;
+	}
+
+	for (size_t i = 0; i < freeRanges.size(); i++)
+	{
+		// Alignment need not be a power of two (12 byte vertices).
+		uint32_t alignedOffset = (freeRanges[i].offset + alignment - 1) / alignment * alignment;
+		uint32_t padding = alignedOffset - freeRanges[i].offset;
+		if (freeRanges[i].count < padding + count) continue;
+
+		range->offset = alignedOffset;
+		range->count = count;
+
+		// The padding stays free in front of the range, the rest after it.
+		GeometryRange tail = { alignedOffset + count, freeRanges[i].count - padding - count };
+		freeRanges[i].count = padding;
+		if (tail.count > 0)
+		{
+			freeRanges.insert(freeRanges.begin() + i + 1, tail);
+		}
+		if (padding == 0)
+		{
+			freeRanges.erase(freeRanges.begin() + i);
+		}
+		return true;
+	}
+
+	return false;
+}
+
+void GeometryArena::freeRange(std::vector<GeometryRange>& freeRanges, const GeometryRange& range)
+{
+	if (range.count == 0) return;
+
+	// Keep sorted by offset, then merge with the neighbours it touches.
+	size_t i = 0;
+	while (i < freeRanges.size() && freeRanges[i].offset < range.offset)
+	{
+		i++;
+	}
+	freeRanges.insert(freeRanges.begin() + i, range);
+
+	if (i + 1 < freeRanges.size() && freeRanges[i].offset + freeRanges[i].count == freeRanges[i + 1].offset)
+	{
+		freeRanges[i].count += freeRanges[i + 1].count;
+		freeRanges.erase(freeRanges.begin() + i + 1);
+	}
+	if (i > 0 && freeRanges[i - 1].offset + freeRanges[i - 1].count == freeRanges[i].offset)
+	{
+		freeRanges[i - 1].count += freeRanges[i].count;
+		freeRanges.erase(freeRanges.begin() + i);
+	}
+}
@@ -0,0 +1,420 @@
+#include <stdexcept>
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "GpuCuller.h"
+#include "FrustumCuller.h"
+
+// Push constants of cull.comp.
+struct CullParams {
+	uint32_t drawCount;
+	uint32_t compact;		// 1 = append visible commands and count them, 0 = keep every slot, instanceCount 0 when culled.
+};
+
+static const VkDeviceSize SCENE_PLANES_BYTES = 6 * sizeof(glm::vec4);
+
+
+
+GpuCuller::GpuCuller()
+{
+}
+
+void GpuCuller::createGpuCuller(DeviceAllocator* newAllocator, VkDevice newDevice, uint32_t newFrameCount,
+	bool newDrawIndirectCount, bool newMultiDrawIndirect, bool newBindlessTextures)
+{
+	allocator = newAllocator;
+	device = newDevice;
+	frameCount = newFrameCount;
+	drawIndirectCount = newDrawIndirectCount;
+	multiDrawIndirect = newMultiDrawIndirect;
+	bindlessTextures = newBindlessTextures;
+
+	// Records and scene are also read by the indirect vertex shader, commands and counts only by the cull shader.
+	std::array<VkDescriptorSetLayoutBinding, 4> bindings = {};
+	for (uint32_t i = 0; i < bindings.size(); i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = i < 2 ? VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT : VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutCreateInfo.pBindings = bindings.data();
+
+	VkResult result = vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &descriptorSetLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the GPU cull Descriptor Set Layout!");
+	}
+
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = frameCount * static_cast<uint32_t>(bindings.size());
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = frameCount;
+	poolCreateInfo.poolSizeCount = 1;
+	poolCreateInfo.pPoolSizes = &poolSize;
+
+	result = vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &descriptorPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the GPU cull Descriptor Pool!");
+	}
+
+	// Compute pipeline.
+	VkPushConstantRange paramsRange = {};
+	paramsRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	paramsRange.offset = 0;
+	paramsRange.size = sizeof(CullParams);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &paramsRange;
+
+	result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the GPU cull pipeline layout!");
+	}
+
+	std::vector<char> shaderCode = readfile("Shaders/cull.spv");
+	VkShaderModuleCreateInfo shaderCreateInfo = {};
+	shaderCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderCreateInfo.codeSize = shaderCode.size();
+	shaderCreateInfo.pCode = reinterpret_cast<const uint32_t*>(shaderCode.data());
+
+	VkShaderModule shaderModule;
+	result = vkCreateShaderModule(device, &shaderCreateInfo, nullptr, &shaderModule);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the GPU cull shader module!");
+	}
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = shaderModule;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.layout = pipelineLayout;
+
+	result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &pipeline);
+	vkDestroyShaderModule(device, shaderModule, nullptr);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the GPU cull pipeline!");
+	}
+
+	// Buffers and descriptor sets, one of each per frame in flight.
+	VkDeviceSize recordBytes = GPU_CULL_MAX_DRAWS * sizeof(GpuDrawRecord);
+	VkDeviceSize sceneBytes = SCENE_PLANES_BYTES + GPU_CULL_MAX_MODELS * sizeof(glm::mat4);
+	VkDeviceSize commandBytes = GPU_CULL_MAX_DRAWS * sizeof(VkDrawIndexedIndirectCommand);
+	VkDeviceSize countBytes = GPU_CULL_MAX_BATCHES * sizeof(uint32_t);
+
+	recordBuffers.resize(frameCount);
+	recordAllocations.resize(frameCount);
+	sceneBuffers.resize(frameCount);
+	sceneAllocations.resize(frameCount);
+	commandBuffers.resize(frameCount);
+	commandAllocations.resize(frameCount);
+	countBuffers.resize(frameCount);
+	countAllocations.resize(frameCount);
+	frameDrawVersions.assign(frameCount, 0);
+	frameDirtyBegin.assign(frameCount, UINT32_MAX);
+	frameDirtyEnd.assign(frameCount, 0);
+
+	std::vector<VkDescriptorSetLayout> setLayouts(frameCount, descriptorSetLayout);
+	descriptorSets.resize(frameCount);
+
+	VkDescriptorSetAllocateInfo setAllocInfo = {};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = descriptorPool;
+	setAllocInfo.descriptorSetCount = frameCount;
+	setAllocInfo.pSetLayouts = setLayouts.data();
+
+	result = vkAllocateDescriptorSets(device, &setAllocInfo, descriptorSets.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate the GPU cull Descriptor Sets!");
+	}
+
+	for (uint32_t i = 0; i < frameCount; i++)
+	{
+		allocator->createBuffer(recordBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MEMORY_UNIFORMS, &recordBuffers[i], &recordAllocations[i]);
+		allocator->createBuffer(sceneBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MEMORY_UNIFORMS, &sceneBuffers[i], &sceneAllocations[i]);
+		allocator->createBuffer(commandBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_OTHER, &commandBuffers[i], &commandAllocations[i]);
+		allocator->createBuffer(countBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_OTHER, &countBuffers[i], &countAllocations[i]);
+
+		std::array<VkDescriptorBufferInfo, 4> bufferInfos = {};
+		bufferInfos[0] = { recordBuffers[i], 0, recordBytes };
+		bufferInfos[1] = { sceneBuffers[i], 0, sceneBytes };
+		bufferInfos[2] = { commandBuffers[i], 0, commandBytes };
+		bufferInfos[3] = { countBuffers[i], 0, countBytes };
+
+		std::array<VkWriteDescriptorSet, 4> setWrites = {};
+		for (uint32_t b = 0; b < setWrites.size(); b++)
+		{
+			setWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			setWrites[b].dstSet = descriptorSets[i];
+			setWrites[b].dstBinding = b;
+			setWrites[b].dstArrayElement = 0;
+			setWrites[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			setWrites[b].descriptorCount = 1;
+			setWrites[b].pBufferInfo = &bufferInfos[b];
+		}
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
+	}
+}
+
+void GpuCuller::clearDraws()
+{
+	records.clear();
+	recordKeys.clear();
+}
+
+void GpuCuller::addDraw(Mesh* mesh, const MeshBounds& bounds, uint32_t model, uint32_t firstInstance, uint32_t instanceCount)
+{
+	if (records.size() >= GPU_CULL_MAX_DRAWS || model >= GPU_CULL_MAX_MODELS)
+	{
+		throw std::runtime_error("Failed to fit the scene into the GPU cull buffers!");
+	}
+
+	GpuDrawRecord record = {};
+	record.sphere = glm::vec4(bounds.sphereCenter, bounds.sphereRadius);
+	record.dequantize = mesh->getDequantize();
+	record.model = model;
+	record.indexCount = static_cast<uint32_t>(mesh->getIndexCount());
+	record.firstIndex = mesh->getFirstIndex();
+	record.vertexOffset = mesh->getVertexOffset();
+	record.firstInstance = firstInstance;
+	record.instanceCount = instanceCount;
+	record.texture = static_cast<uint32_t>(mesh->getTexId());
+	records.push_back(record);
+
+	GpuDrawBatch key = {};
+	key.layout = mesh->getVertexLayout();
+	key.indexType = mesh->getIndexType();
+	key.texId = bindlessTextures ? -1 : mesh->getTexId();
+	recordKeys.push_back(key);
+}
+
+void GpuCuller::finishDraws()
+{
+	// Sort by batch so each batch's command slots are one contiguous range. Scene order is kept within a batch.
+	// Ties fall back to the draw index, std::sort then keeps scene order without stable_sort's temporary buffer.
+	sortOrder.resize(records.size());
+	for (uint32_t i = 0; i < sortOrder.size(); i++)
+	{
+		sortOrder[i] = i;
+	}
+	const std::vector<GpuDrawBatch>& keys = recordKeys;
+	std::sort(sortOrder.begin(), sortOrder.end(), [&keys](uint32_t a, uint32_t b) {
+		if (keys[a].layout != keys[b].layout) return keys[a].layout < keys[b].layout;
+		if (keys[a].indexType != keys[b].indexType) return keys[a].indexType < keys[b].indexType;
+		if (keys[a].texId != keys[b].texId) return keys[a].texId < keys[b].texId;
+		return a < b;
+	});
+
+	sortedRecords.resize(records.size());
+	drawRecords.resize(records.size());
+	batches.clear();
+	for (uint32_t i = 0; i < sortOrder.size(); i++)
+	{
+		const GpuDrawBatch& key = keys[sortOrder[i]];
+		if (batches.empty() || key.layout != batches.back().layout || key.indexType != batches.back().indexType ||
+			key.texId != batches.back().texId)
+		{
+			if (batches.size() >= GPU_CULL_MAX_BATCHES)
+			{
+				throw std::runtime_error("Failed to fit the scene's draw batches into the GPU cull buffers!");
+			}
+			GpuDrawBatch batch = key;
+			batch.firstCommand = i;
+			batch.maxDrawCount = 0;
+			batches.push_back(batch);
+		}
+		batches.back().maxDrawCount++;
+
+		sortedRecords[i] = records[sortOrder[i]];
+		sortedRecords[i].batch = static_cast<uint32_t>(batches.size() - 1);
+		sortedRecords[i].batchFirstCommand = batches.back().firstCommand;
+		drawRecords[sortOrder[i]] = i;
+	}
+
+	records.swap(sortedRecords);
+	recordKeys.clear();
+	drawVersion++;
+}
+
+void GpuCuller::setDrawBounds(uint32_t draw, const MeshBounds& bounds)
+{
+	if (draw >= drawRecords.size()) return;
+
+	uint32_t record = drawRecords[draw];
+	records[record].sphere = glm::vec4(bounds.sphereCenter, bounds.sphereRadius);
+
+	// Each frame slot copies the changed range when it next begins, frames in flight keep their own copy.
+	for (uint32_t i = 0; i < frameCount; i++)
+	{
+		frameDirtyBegin[i] = std::min(frameDirtyBegin[i], record);
+		frameDirtyEnd[i] = std::max(frameDirtyEnd[i], record + 1);
+	}
+}
+
+void GpuCuller::beginFrame(uint32_t frame, const glm::mat4& viewProjection)
+{
+	currentFrame = frame;
+
+	// The frame slot finished, its records can be replaced if the scene changed since.
+	if (frameDrawVersions[frame] != drawVersion)
+	{
+		memcpy(recordAllocations[frame].mapped, records.data(), records.size() * sizeof(GpuDrawRecord));
+		frameDrawVersions[frame] = drawVersion;
+	}
+	else if (frameDirtyBegin[frame] < frameDirtyEnd[frame])
+	{
+		// Only spheres changed since, copy just the records between the first and last one.
+		uint8_t* mapped = static_cast<uint8_t*>(recordAllocations[frame].mapped);
+		memcpy(mapped + frameDirtyBegin[frame] * sizeof(GpuDrawRecord), records.data() + frameDirtyBegin[frame],
+			(frameDirtyEnd[frame] - frameDirtyBegin[frame]) * sizeof(GpuDrawRecord));
+	}
+	frameDirtyBegin[frame] = UINT32_MAX;
+	frameDirtyEnd[frame] = 0;
+
+	glm::vec4 planes[6];
+	FrustumCuller::extractPlanes(viewProjection, planes);
+	memcpy(sceneAllocations[frame].mapped, planes, SCENE_PLANES_BYTES);
+}
+
+void GpuCuller::setTransform(uint32_t model, const glm::mat4& transform)
+{
+	if (model >= GPU_CULL_MAX_MODELS) return;
+
+	uint8_t* transforms = static_cast<uint8_t*>(sceneAllocations[currentFrame].mapped) + SCENE_PLANES_BYTES;
+	memcpy(transforms + model * sizeof(glm::mat4), &transform, sizeof(glm::mat4));
+}
+
+void GpuCuller::recordCull(VkCommandBuffer commandBuffer, uint32_t frame)
+{
+	if (records.empty()) return;
+
+	if (drawIndirectCount)
+	{
+		vkCmdFillBuffer(commandBuffer, countBuffers[frame], 0, batches.size() * sizeof(uint32_t), 0);
+
+		VkMemoryBarrier clearBarrier = {};
+		clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			1, &clearBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	CullParams params = {};
+	params.drawCount = static_cast<uint32_t>(records.size());
+	params.compact = drawIndirectCount ? 1 : 0;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[frame], 0, nullptr);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullParams), &params);
+	vkCmdDispatch(commandBuffer, (params.drawCount + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, 1, 1);
+
+	// Commands and counts are read as indirect parameters in subpass 0.
+	VkMemoryBarrier cullBarrier = {};
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0,
+		1, &cullBarrier, 0, nullptr, 0, nullptr);
+}
+
+void GpuCuller::recordBatch(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t batch)
+{
+	const GpuDrawBatch& drawBatch = batches[batch];
+	VkDeviceSize offset = drawBatch.firstCommand * sizeof(VkDrawIndexedIndirectCommand);
+	uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+	if (drawIndirectCount)
+	{
+		vkCmdDrawIndexedIndirectCount(commandBuffer, commandBuffers[frame], offset, countBuffers[frame], batch * sizeof(uint32_t),
+			drawBatch.maxDrawCount, stride);
+	}
+	else if (multiDrawIndirect)
+	{
+		vkCmdDrawIndexedIndirect(commandBuffer, commandBuffers[frame], offset, drawBatch.maxDrawCount, stride);
+	}
+	else
+	{
+		// Without multiDrawIndirect each call may only draw one command.
+		for (uint32_t i = 0; i < drawBatch.maxDrawCount; i++)
+		{
+			vkCmdDrawIndexedIndirect(commandBuffer, commandBuffers[frame], offset + i * stride, 1, stride);
+		}
+	}
+}
+
+VkDescriptorSetLayout GpuCuller::getDescriptorSetLayout()
+{
+	return descriptorSetLayout;
+}
+
+VkDescriptorSet GpuCuller::getDescriptorSet(uint32_t frame)
+{
+	return descriptorSets[frame];
+}
+
+const std::vector<GpuDrawBatch>& GpuCuller::getBatches()
+{
+	return batches;
+}
+
+size_t GpuCuller::getDrawCount()
+{
+	return records.size();
+}
+
+bool GpuCuller::usesDrawCount()
+{
+	return drawIndirectCount;
+}
+
+void GpuCuller::destroyGpuCuller()
+{
+	for (uint32_t i = 0; i < recordBuffers.size(); i++)
+	{
+		allocator->destroyBuffer(recordBuffers[i], recordAllocations[i]);
+		allocator->destroyBuffer(sceneBuffers[i], sceneAllocations[i]);
+		allocator->destroyBuffer(commandBuffers[i], commandAllocations[i]);
+		allocator->destroyBuffer(countBuffers[i], countAllocations[i]);
+	}
+	recordBuffers.clear();
+	sceneBuffers.clear();
+	commandBuffers.clear();
+	countBuffers.clear();
+
+	if (pipeline != VK_NULL_HANDLE)
+	{
+		vkDestroyPipeline(device, pipeline, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+		pipeline = VK_NULL_HANDLE;
+	}
+}
+
+GpuCuller::~GpuCuller()
+{
+}
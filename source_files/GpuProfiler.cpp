@@ -0,0 +1,295 @@
+#include <stdexcept>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+
+#include "GpuProfiler.h"
+
+
+
+GpuProfiler::GpuProfiler()
+{
+}
+
+bool GpuProfiler::createGpuProfiler(VkPhysicalDevice physicalDevice, VkDevice newDevice, VkInstance instance, uint32_t queueFamily,
+	uint32_t newFrameCount, uint32_t commandBufferCount, bool newCapture, bool debugUtils)
+{
+	device = newDevice;
+	frameCount = newFrameCount;
+	capture = newCapture;
+
+	// Timestamp support is per queue family.
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilyList(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilyList.data());
+
+	uint32_t timestampValidBits = queueFamilyList[queueFamily].timestampValidBits;
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+	if (timestampValidBits == 0 || deviceProperties.limits.timestampPeriod <= 0.0f)
+	{
+		return false;
+	}
+
+	timestampPeriod = deviceProperties.limits.timestampPeriod;
+	timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+
+	VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+	queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolCreateInfo.queryCount = 2 * MAX_GPU_SCOPES * frameCount;
+
+	VkResult result = vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &queryPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a timestamp query pool!");
+	}
+
+	// Reserved up front, so reserving and collecting scopes never allocates.
+	scopes.resize(commandBufferCount);
+	for (auto& commandBufferScopes : scopes)
+	{
+		commandBufferScopes.reserve(MAX_GPU_SCOPES);
+	}
+	pendingCommandBuffer.assign(frameCount, UINT32_MAX);
+	results.resize(2 * MAX_GPU_SCOPES);
+	if (capture)
+	{
+		events.reserve(MAX_GPU_PROFILE_EVENTS);
+	}
+
+	// Labels are optional. The loader may hand out the functions even when the extension isn't enabled, so don't ask then.
+	if (debugUtils)
+	{
+		cmdBeginLabel = (PFN_vkCmdBeginDebugUtilsLabelEXT)vkGetInstanceProcAddr(instance, "vkCmdBeginDebugUtilsLabelEXT");
+		cmdEndLabel = (PFN_vkCmdEndDebugUtilsLabelEXT)vkGetInstanceProcAddr(instance, "vkCmdEndDebugUtilsLabelEXT");
+	}
+
+	enabled = true;
+	return true;
+}
+
+bool GpuProfiler::isEnabled()
+{
+	return enabled;
+}
+
+bool GpuProfiler::isCapturing()
+{
+	return enabled && capture;
+}
+
+void GpuProfiler::setModelCount(uint32_t count)
+{
+	for (uint32_t i = static_cast<uint32_t>(modelNames.size()); i < count; i++)
+	{
+		modelNames.push_back("MeshModel " + std::to_string(i));
+	}
+}
+
+void GpuProfiler::beginRecording(uint32_t commandBufferIndex)
+{
+	if (!enabled) return;
+
+	scopes[commandBufferIndex].clear();
+}
+
+uint32_t GpuProfiler::reserveScopes(uint32_t commandBufferIndex, uint32_t count)
+{
+	if (!enabled || count == 0) return NO_SCOPE;
+
+	std::vector<Scope>& commandBufferScopes = scopes[commandBufferIndex];
+	if (commandBufferScopes.size() + count > MAX_GPU_SCOPES)
+	{
+		return NO_SCOPE;
+	}
+
+	uint32_t first = static_cast<uint32_t>(commandBufferScopes.size());
+	commandBufferScopes.resize(first + count, { "", -1 });
+	return first;
+}
+
+void GpuProfiler::resetQueries(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t commandBufferIndex)
+{
+	if (!enabled) return;
+
+	uint32_t queryCount = 2 * static_cast<uint32_t>(scopes[commandBufferIndex].size());
+	if (queryCount > 0)
+	{
+		vkCmdResetQueryPool(commandBuffer, queryPool, frame * 2 * MAX_GPU_SCOPES, queryCount);
+	}
+}
+
+void GpuProfiler::beginScope(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t commandBufferIndex, uint32_t scope, const char* name, int32_t model)
+{
+	beginLabel(commandBuffer, name, model);
+	writeBeginTimestamp(commandBuffer, frame, commandBufferIndex, scope, name, model);
+}
+
+void GpuProfiler::endScope(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t scope)
+{
+	writeEndTimestamp(commandBuffer, frame, scope);
+	endLabel(commandBuffer);
+}
+
+void GpuProfiler::writeBeginTimestamp(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t commandBufferIndex, uint32_t scope, const char* name, int32_t model)
+{
+	if (scope == NO_SCOPE) return;
+
+	scopes[commandBufferIndex][scope] = { name, model };
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, frame * 2 * MAX_GPU_SCOPES + scope * 2);
+}
+
+void GpuProfiler::writeEndTimestamp(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t scope)
+{
+	if (scope == NO_SCOPE) return;
+
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, frame * 2 * MAX_GPU_SCOPES + scope * 2 + 1);
+}
+
+void GpuProfiler::beginLabel(VkCommandBuffer commandBuffer, const char* name, int32_t model)
+{
+	if (!cmdBeginLabel) return;
+
+	VkDebugUtilsLabelEXT label = {};
+	label.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
+	label.pLabelName = getScopeName(name, model);
+	cmdBeginLabel(commandBuffer, &label);
+}
+
+void GpuProfiler::endLabel(VkCommandBuffer commandBuffer)
+{
+	if (!cmdEndLabel) return;
+
+	cmdEndLabel(commandBuffer);
+}
+
+void GpuProfiler::submitted(uint32_t frame, uint32_t commandBufferIndex)
+{
+	if (!enabled) return;
+
+	pendingCommandBuffer[frame] = commandBufferIndex;
+}
+
+bool GpuProfiler::collect(uint32_t frame)
+{
+	if (!enabled || pendingCommandBuffer[frame] == UINT32_MAX) return false;
+
+	const std::vector<Scope>& frameScopes = scopes[pendingCommandBuffer[frame]];
+	pendingCommandBuffer[frame] = UINT32_MAX;
+	if (frameScopes.empty()) return false;
+
+	// No wait flag. The frame already finished, and if a result is still missing we'd rather drop the frame than block.
+	uint32_t queryCount = 2 * static_cast<uint32_t>(frameScopes.size());
+	VkResult result = vkGetQueryPoolResults(device, queryPool, frame * 2 * MAX_GPU_SCOPES, queryCount,
+		queryCount * sizeof(uint64_t), results.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	if (result != VK_SUCCESS) return false;
+
+	if (collectedFrames == 0)
+	{
+		baseTimestamp = results[0];
+	}
+
+	double msPerTick = timestampPeriod / 1000000.0;
+	lastFrameMs = ((results[1] - results[0]) & timestampMask) * msPerTick;
+
+	// Whole frames only, never past the reserved space.
+	if (capture && events.size() + frameScopes.size() > MAX_GPU_PROFILE_EVENTS)
+	{
+		droppedFrames++;
+	}
+	else if (capture)
+	{
+		for (size_t i = 0; i < frameScopes.size(); i++)
+		{
+			uint64_t begin = results[i * 2];
+			uint64_t end = results[i * 2 + 1];
+
+			Event event = {};
+			event.frame = collectedFrames;
+			event.name = frameScopes[i].name;
+			event.model = frameScopes[i].model;
+			event.startMs = ((begin - baseTimestamp) & timestampMask) * msPerTick;
+			event.durationMs = ((end - begin) & timestampMask) * msPerTick;
+			events.push_back(event);
+		}
+	}
+
+	collectedFrames++;
+	return true;
+}
+
+double GpuProfiler::getLastFrameMs()
+{
+	return lastFrameMs;
+}
+
+void GpuProfiler::writeCsv(const std::string& fileName)
+{
+	std::ofstream file(fileName);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open a file! (" + fileName + ")");
+	}
+
+	file << std::fixed << std::setprecision(6);
+	file << "frame,scope,start_ms,duration_ms\n";
+	for (const Event& event : events)
+	{
+		file << event.frame << "," << getScopeName(event.name, event.model) << "," << event.startMs << "," << event.durationMs << "\n";
+	}
+}
+
+void GpuProfiler::writeChromeTrace(const std::string& fileName)
+{
+	std::ofstream file(fileName);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open a file! (" + fileName + ")");
+	}
+
+	// Complete ("X") events in microseconds. Scopes nest by time, so the viewer stacks them on one track.
+	file << std::fixed << std::setprecision(3);
+	file << "{\"traceEvents\":[\n";
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"GPU\"}}";
+	for (const Event& event : events)
+	{
+		file << ",\n{\"name\":\"" << getScopeName(event.name, event.model) << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":0"
+			<< ",\"ts\":" << event.startMs * 1000.0 << ",\"dur\":" << event.durationMs * 1000.0
+			<< ",\"args\":{\"frame\":" << event.frame << "}}";
+	}
+	file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+	if (droppedFrames > 0)
+	{
+		printf("GPU profiler: %llu frames dropped, event buffer full.\n", (unsigned long long)droppedFrames);
+	}
+}
+
+void GpuProfiler::destroyGpuProfiler()
+{
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(device, queryPool, nullptr);
+		queryPool = VK_NULL_HANDLE;
+	}
+	cmdBeginLabel = nullptr;
+	cmdEndLabel = nullptr;
+	enabled = false;
+}
+
+const char* GpuProfiler::getScopeName(const char* name, int32_t model)
+{
+	if (model >= 0 && model < static_cast<int32_t>(modelNames.size()))
+	{
+		return modelNames[model].c_str();
+	}
+	return name;
+}
+
+GpuProfiler::~GpuProfiler()
+{
+}
@@ -0,0 +1,144 @@
+#include <cstdio>
+
+#include "MemoryTelemetry.h"
+
+
+
+MemoryTelemetry::MemoryTelemetry()
+{
+}
+
+void MemoryTelemetry::createMemoryTelemetry(DeviceAllocator* newAllocator, VkPhysicalDevice newPhysicalDevice, bool newHasBudgetExtension,
+	VkDeviceSize newBudget, uint32_t newLogInterval)
+{
+	allocator = newAllocator;
+	physicalDevice = newPhysicalDevice;
+	hasBudgetExtension = newHasBudgetExtension;
+	budget = newBudget;
+	logInterval = newLogInterval;
+	frame = 0;
+	overBudget = false;
+}
+
+const MemoryReport& MemoryTelemetry::query()
+{
+	DeviceAllocatorStats stats = allocator->getStats();
+	const VkPhysicalDeviceMemoryProperties& memoryProperties = allocator->getMemoryProperties();
+
+	for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+	{
+		lastReport.categoryBytes[i] = stats.categoryBytes[i];
+	}
+	lastReport.allocatedBytes = stats.blockBytes;
+
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+	budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+	if (hasBudgetExtension)
+	{
+		VkPhysicalDeviceMemoryProperties2 memoryProperties2 = {};
+		memoryProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+		memoryProperties2.pNext = &budgetProperties;
+		vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &memoryProperties2);
+	}
+	lastReport.driverBudget = hasBudgetExtension;
+	lastReport.deviceLocalBytes = 0;
+
+	lastReport.heapCount = memoryProperties.memoryHeapCount;
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+	{
+		MemoryHeapReport& heap = lastReport.heaps[i];
+		heap.size = memoryProperties.memoryHeaps[i].size;
+		heap.deviceLocal = (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+		heap.budget = hasBudgetExtension ? budgetProperties.heapBudget[i] : heap.size;
+		heap.usage = hasBudgetExtension ? budgetProperties.heapUsage[i] : stats.heapBytes[i];
+
+		if (heap.deviceLocal)
+		{
+			lastReport.deviceLocalBytes += stats.heapBytes[i];
+		}
+	}
+
+	return lastReport;
+}
+
+void MemoryTelemetry::update()
+{
+	frame++;
+
+	bool logNow = logInterval > 0 && frame % logInterval == 0;
+	bool checkNow = frame % MEMORY_BUDGET_CHECK_FRAMES == 0;
+	if (!logNow && !checkNow) return;
+
+	query();
+	if (logNow)
+	{
+		printReport(lastReport);
+	}
+	checkBudget(lastReport);
+}
+
+void MemoryTelemetry::printReport(const MemoryReport& report)
+{
+	const double MiB = 1024.0 * 1024.0;
+
+	printf("Memory: %.1f MiB allocated (%.1f MiB device local)", report.allocatedBytes / MiB, report.deviceLocalBytes / MiB);
+	for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+	{
+		printf(", %s %.1f", getCategoryName(static_cast<MemoryCategory>(i)), report.categoryBytes[i] / MiB);
+	}
+	printf("\n");
+
+	for (uint32_t i = 0; i < report.heapCount; i++)
+	{
+		const MemoryHeapReport& heap = report.heaps[i];
+		printf("  Heap %u%s: %.1f of %.1f MiB %s (heap %.1f MiB)\n", i, heap.deviceLocal ? " (device local)" : "",
+			heap.usage / MiB, heap.budget / MiB, report.driverBudget ? "budget" : "heap, own allocations only", heap.size / MiB);
+	}
+}
+
+const char* MemoryTelemetry::getCategoryName(MemoryCategory category)
+{
+	switch (category)
+	{
+	case MEMORY_GEOMETRY: return "geometry";
+	case MEMORY_TEXTURES: return "textures";
+	case MEMORY_ATTACHMENTS: return "attachments";
+	case MEMORY_UNIFORMS: return "uniforms";
+	case MEMORY_STAGING: return "staging";
+	default: return "other";
+	}
+}
+
+MemoryTelemetry::~MemoryTelemetry()
+{
+}
+
+void MemoryTelemetry::checkBudget(const MemoryReport& report)
+{
+	const double MiB = 1024.0 * 1024.0;
+
+	bool over = budget > 0 && report.deviceLocalBytes > budget;
+	for (uint32_t i = 0; i < report.heapCount; i++)
+	{
+		over = over || report.heaps[i].usage > report.heaps[i].budget;
+	}
+
+	// Warn on the way over, not every check while staying there.
+	if (over && !overBudget)
+	{
+		if (budget > 0 && report.deviceLocalBytes > budget)
+		{
+			printf("Warning: %.1f MiB of device local memory in use, over the %.1f MiB budget.\n",
+				report.deviceLocalBytes / MiB, budget / MiB);
+		}
+		for (uint32_t i = 0; i < report.heapCount; i++)
+		{
+			if (report.heaps[i].usage > report.heaps[i].budget)
+			{
+				printf("Warning: heap %u uses %.1f MiB, over its %.1f MiB budget. Expect paging or failed allocations.\n",
+					i, report.heaps[i].usage / MiB, report.heaps[i].budget / MiB);
+			}
+		}
+	}
+	overBudget = over;
+}
@@ -1,4 +1,8 @@
+#include <cstring>
+#include <algorithm>
+
 #include "Mesh.h"
+#include "MeshOptimizer.h"
 
 
 
@@ -6,17 +10,56 @@ Mesh::Mesh()
 {
 }
 
-Mesh::Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice,
-	VkQueue transferQueue, VkCommandPool transferCommandPool,
+Mesh::Mesh(GeometryArena* newArena, VertexLayout newLayout,
 	std::vector<Vertex>* vertices, std::vector<uint32_t>* indices,
 	int newTexId)
 {
-	vertexCount = vertices->size();
-	indexCount = indices->size();
-	physicalDevice = newPhysicalDevice;
-	device = newDevice;
-	createVertexBuffer(transferQueue, transferCommandPool, vertices);
-	createIndexBuffer(transferQueue, transferCommandPool, indices);
+	arena = newArena;
+	layout = newLayout;
+
+	// Bounds from the float positions, before any quantization.
+	if (!vertices->empty())
+	{
+		bounds.boundsMin = (*vertices)[0].pos;
+		bounds.boundsMax = (*vertices)[0].pos;
+		for (const Vertex& vertex : *vertices)
+		{
+			bounds.boundsMin = glm::min(bounds.boundsMin, vertex.pos);
+			bounds.boundsMax = glm::max(bounds.boundsMax, vertex.pos);
+		}
+		bounds.sphereCenter = (bounds.boundsMin + bounds.boundsMax) * 0.5f;
+		for (const Vertex& vertex : *vertices)
+		{
+			bounds.sphereRadius = std::max(bounds.sphereRadius, glm::length(vertex.pos - bounds.sphereCenter));
+		}
+	}
+
+	std::vector<uint8_t> packedVertices;
+	dequantize = packVertices(layout, *vertices, &packedVertices);
+
+	// 16 bit indices whenever they can address every vertex.
+	std::vector<uint8_t> packedIndices;
+	uint32_t indexSize;
+	if (useShortIndices(static_cast<uint32_t>(vertices->size())))
+	{
+		indexType = VK_INDEX_TYPE_UINT16;
+		indexSize = sizeof(uint16_t);
+		packedIndices.resize(indices->size() * indexSize);
+		for (size_t i = 0; i < indices->size(); i++)
+		{
+			uint16_t index = static_cast<uint16_t>((*indices)[i]);
+			memcpy(packedIndices.data() + i * indexSize, &index, indexSize);
+		}
+	}
+	else
+	{
+		indexType = VK_INDEX_TYPE_UINT32;
+		indexSize = sizeof(uint32_t);
+		packedIndices.resize(indices->size() * indexSize);
+		memcpy(packedIndices.data(), indices->data(), packedIndices.size());
+	}
+
+	arena->addMesh(packedVertices, getVertexStride(layout), packedIndices, indexSize, &vertexRange, &indexRange);
 
 	model.model = glm::mat4(1.0f);
 	texId = newTexId;
@@ -27,7 +70,7 @@ void Mesh::setModel(glm::mat4 newModel)
 	model.model = newModel;
 }
 
-Model Mesh::getModel()
+const Model& Mesh::getModel()
 {
 	return model;
 }
@@ -37,97 +80,67 @@ int Mesh::getTexId()
 	return texId;
 }
 
-int Mesh::getVertexCount()
+VertexLayout Mesh::getVertexLayout()
 {
-	return vertexCount;
+	return layout;
 }
 
-VkBuffer Mesh::getVertexBuffer()
+const VertexDequantize& Mesh::getDequantize()
 {
-	return vertexBuffer;
+	return dequantize;
 }
 
-int Mesh::getIndexCount()
+int Mesh::getVertexCount()
 {
-	return indexCount;
+	return vertexRange.count / getVertexStride(layout);
 }
 
-VkBuffer Mesh::getIndexBuffer()
+int32_t Mesh::getVertexOffset()
 {
-	return indexBuffer;
+	return static_cast<int32_t>(vertexRange.offset / getVertexStride(layout));
 }
 
-void Mesh::destroyBuffers()
+int Mesh::getIndexCount()
 {
-	vkDestroyBuffer(device, vertexBuffer, nullptr);
-	vkFreeMemory(device, vertexBufferMemory, nullptr);
-	vkDestroyBuffer(device, indexBuffer, nullptr);
-	vkFreeMemory(device, indexBufferMemory, nullptr);
+	return indexRange.count / getIndexSize();
 }
 
-
-Mesh::~Mesh()
+uint32_t Mesh::getFirstIndex()
 {
+	return indexRange.offset / getIndexSize();
 }
 
-void Mesh::createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex>* vertices)
+VkIndexType Mesh::getIndexType()
 {
-	// Get size of buffer needed for vertices
-	VkDeviceSize bufferSize = sizeof(Vertex) * vertices->size();
-
-	// Temporary buffer to "stage" vertex data before transferring to GPU
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-
-	// Create Staging Buffer and Allocate Memory to it
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&stagingBuffer, &stagingBufferMemory);
-
-	// MAP MEMORY TO VERTEX BUFFER
-	void* data;																// 1. Create pointer to a point in normal memory
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);			// 2. "Map" the vertex buffer memory to that point
-	memcpy(data, vertices->data(), (size_t)bufferSize);							// 3. Copy memory from vertices vector to the point
-	vkUnmapMemory(device, stagingBufferMemory);									// 4. Unmap the vertex buffer memory
-
-	// Create buffer with TRANSFER_DST_BIT to mark as recipient of transfer data (also VERTEX_BUFFER)
-	// Buffer memory is to be DEVICE_LOCAL_BIT meaning memory is on the GPU and only accessible by it and not CPU (host)
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vertexBuffer, &vertexBufferMemory);
-
-	// Copy staging buffer to vertex buffer on GPU
-	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, vertexBuffer, bufferSize);
+	return indexType;
+}
 
-	// Clean up staging buffer parts
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+const MeshBounds& Mesh::getBounds()
+{
+	return bounds;
 }
 
-void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t>* indices)
+void Mesh::setMeshlets(std::vector<Meshlet> newMeshlets)
 {
-	// Get size of buffer needed for indices
-	VkDeviceSize bufferSize = sizeof(uint32_t) * indices->size();
+	meshlets = newMeshlets;
+}
 
-	// Temporary buffer to "stage" index data before transferring to GPU
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingBufferMemory);
+const std::vector<Meshlet>& Mesh::getMeshlets()
+{
+	return meshlets;
+}
 
-	// MAP MEMORY TO INDEX BUFFER
-	void* data;
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, indices->data(), (size_t)bufferSize);
-	vkUnmapMemory(device, stagingBufferMemory);
+void Mesh::destroyBuffers()
+{
+	arena->freeMesh(vertexRange, indexRange);
+}
 
-	// Create buffer for INDEX data on GPU access only area
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indexBuffer, &indexBufferMemory);
 
-	// Copy from staging buffer to GPU access buffer
-	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, indexBuffer, bufferSize);
+Mesh::~Mesh()
+{
+}
 
-	// Destroy + Release Staging Buffer resources
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+uint32_t Mesh::getIndexSize()
+{
+	return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
 }
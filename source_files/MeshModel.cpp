@@ -1,4 +1,10 @@
+#include <cstdio>
+
 #include "MeshModel.h"
+#include "MeshOptimizer.h"
+#include "Meshlet.h"
+#include "FrustumCuller.h"
+#include "CpuProfiler.h"
 
 
 
@@ -10,6 +16,7 @@ MeshModel::MeshModel(std::vector<Mesh> newMeshList)
 {
 	meshList = newMeshList;
 	model = glm::mat4(1.0f);
+	instances.push_back(glm::mat4(1.0f));
 }
 
 size_t MeshModel::getMeshCount()
@@ -37,6 +44,67 @@ void MeshModel::setModel(glm::mat4 newModel)
 	model = newModel;
 }
 
+uint32_t MeshModel::addInstance(const glm::mat4& transform)
+{
+	instances.push_back(transform);
+	instanceBoundsDirty = true;
+	return static_cast<uint32_t>(instances.size() - 1);
+}
+
+void MeshModel::setInstance(uint32_t index, const glm::mat4& transform)
+{
+	if (index >= instances.size())
+	{
+		throw std::runtime_error("Attempted to access invalid instance index!");
+	}
+
+	instances[index] = transform;
+	instanceBoundsDirty = true;
+}
+
+const std::vector<glm::mat4>& MeshModel::getInstances()
+{
+	return instances;
+}
+
+uint32_t MeshModel::getInstanceCount()
+{
+	return static_cast<uint32_t>(instances.size());
+}
+
+const MeshBounds& MeshModel::getInstanceBounds(size_t index)
+{
+	if (index >= meshList.size())
+	{
+		throw std::runtime_error("Attempted to access invalid Mesh index!");
+	}
+
+	if (instanceBoundsDirty)
+	{
+		instanceBounds.resize(meshList.size());
+		for (size_t m = 0; m < meshList.size(); m++)
+		{
+			// Union of the instances' boxes. One instance keeps its own (tighter) sphere.
+			MeshBounds bounds = transformBounds(meshList[m].getBounds(), instances[0]);
+			for (size_t i = 1; i < instances.size(); i++)
+			{
+				MeshBounds instance = transformBounds(meshList[m].getBounds(), instances[i]);
+				bounds.boundsMin = glm::min(bounds.boundsMin, instance.boundsMin);
+				bounds.boundsMax = glm::max(bounds.boundsMax, instance.boundsMax);
+			}
+			if (instances.size() > 1)
+			{
+				bounds.sphereCenter = (bounds.boundsMin + bounds.boundsMax) * 0.5f;
+				bounds.sphereRadius = glm::length(bounds.boundsMax - bounds.boundsMin) * 0.5f;
+			}
+			instanceBounds[m] = bounds;
+		}
+		instanceBoundsDirty = false;
+	}
+
+	return instanceBounds[index];
+}
+
 void MeshModel::destroyMeshModel()
 {
 	for (auto& mesh : meshList)
@@ -78,30 +146,34 @@ std::vector<std::string> MeshModel::LoadMaterials(const aiScene* scene)
 	return textureList;
 }
 
-std::vector<Mesh> MeshModel::LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, aiNode* node, const aiScene* scene, std::vector<int> matToTex)
+std::vector<Mesh> MeshModel::LoadNode(GeometryArena* arena, const MeshLoadOptions& options, aiNode* node, const aiScene* scene, std::vector<int> matToTex)
 {
+	PROFILE_ZONE("MeshModel::LoadNode");
+
 	std::vector<Mesh> meshList;
 
 	// Go through each mesh at this node and create it, then add it to our meshList
 	for (size_t i = 0; i < node->mNumMeshes; i++)
 	{
 		meshList.push_back(
-			LoadMesh(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, scene->mMeshes[node->mMeshes[i]], scene, matToTex)
+			LoadMesh(arena, options, scene->mMeshes[node->mMeshes[i]], scene, matToTex)
 		);
 	}
 
 	// Go through each node attached to this node and load it, then append their meshes to this node's mesh list
 	for (size_t i = 0; i < node->mNumChildren; i++)
 	{
-		std::vector<Mesh> newList = LoadNode(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, node->mChildren[i], scene, matToTex);
+		std::vector<Mesh> newList = LoadNode(arena, options, node->mChildren[i], scene, matToTex);
 		meshList.insert(meshList.end(), newList.begin(), newList.end());
 	}
 
 	return meshList;
 }
 
-Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, aiMesh* mesh, const aiScene* scene, std::vector<int> matToTex)
+Mesh MeshModel::LoadMesh(GeometryArena* arena, const MeshLoadOptions& options, aiMesh* mesh, const aiScene* scene, std::vector<int> matToTex)
 {
+	PROFILE_ZONE("MeshModel::LoadMesh");
+
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> indices;
 
@@ -131,8 +203,9 @@ Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice,
 	// Iterate over indices through faces and copy across
 	for (size_t i = 0; i < mesh->mNumFaces; i++)
 	{
-		// Get a face
+		// Get a face. Triangulate leaves lines and points as they are, the pipelines only draw triangle lists.
 		aiFace face = mesh->mFaces[i];
+		if (face.mNumIndices != 3) continue;
 
 		// Go through face's indices and add to list
 		for (size_t j = 0; j < face.mNumIndices; j++)
@@ -141,8 +214,21 @@ Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice,
 		}
 	}
 
+	if (options.optimize)
+	{
+		MeshOptimizeStats stats = optimizeMesh(vertices, indices, getVertexStride(options.vertexLayout));
+		printf("Mesh \"%s\": %u triangles, %u -> %u vertices, ACMR %.3f -> %.3f, %llu -> %llu bytes (%.1f%% saved).\n",
+			mesh->mName.C_Str(), stats.triangles, stats.verticesBefore, stats.verticesAfter, stats.acmrBefore, stats.acmrAfter,
+			(unsigned long long)stats.bytesBefore, (unsigned long long)stats.bytesAfter,
+			stats.bytesBefore > 0 ? 100.0 * (1.0 - double(stats.bytesAfter) / double(stats.bytesBefore)) : 0.0);
+	}
+
 	// Create new mesh with details and return it
-	Mesh newMesh = Mesh(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, &vertices, &indices, matToTex[mesh->mMaterialIndex]);
+	Mesh newMesh = Mesh(arena, options.vertexLayout, &vertices, &indices, matToTex[mesh->mMaterialIndex]);
+	if (options.buildMeshlets)
+	{
+		newMesh.setMeshlets(buildMeshlets(vertices, indices));
+	}
 
 	return newMesh;
 }
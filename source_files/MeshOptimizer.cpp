@@ -0,0 +1,308 @@
+#include <cmath>
+#include <algorithm>
+#include <cassert>
+
+#include "MeshOptimizer.h"
+
+
+
+// Forsyth's vertex score: recently used vertices score high (the last triangle's three a little less, so the
+// next triangle doesn't just reuse all of them), vertices with few triangles left score high so they get finished off.
+static float vertexScore(int cachePosition, uint32_t remainingTriangles)
+{
+	if (remainingTriangles == 0) return -1.0f;
+
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		if (cachePosition < 3)
+		{
+			score = 0.75f;
+		}
+		else
+		{
+			score = powf(1.0f - (cachePosition - 3) / float(VERTEX_CACHE_SIZE - 3), 1.5f);
+		}
+	}
+	return score + 2.0f * powf(float(remainingTriangles), -0.5f);
+}
+
+float computeAcmr(const std::vector<uint32_t>& indices, uint32_t vertexCount)
+{
+	if (indices.size() < 3) return 0.0f;
+
+	// FIFO: a vertex is cached while fewer than VERTEX_CACHE_SIZE misses happened since it was loaded.
+	std::vector<uint32_t> loadedAt(vertexCount, 0);
+	std::vector<bool> loaded(vertexCount, false);
+	uint32_t misses = 0;
+	for (uint32_t index : indices)
+	{
+		if (!loaded[index] || misses - loadedAt[index] >= VERTEX_CACHE_SIZE)
+		{
+			loaded[index] = true;
+			loadedAt[index] = misses++;
+		}
+	}
+
+	return float(misses) / float(indices.size() / 3);
+}
+
+void optimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount)
+{
+	// Triangle lists only, a trailing partial triangle would never be emitted.
+	assert(indices.size() % 3 == 0);
+
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) return;
+
+	// Triangles using each vertex. Emitted triangles are swapped out of the first remaining[v] entries.
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (uint32_t index : indices)
+	{
+		adjacencyOffsets[index + 1]++;
+	}
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+	}
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> remaining(vertexCount, 0);
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		uint32_t v = indices[i];
+		adjacency[adjacencyOffsets[v] + remaining[v]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		vertexScores[v] = vertexScore(-1, remaining[v]);
+	}
+	std::vector<float> triangleScores(triangleCount);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+	}
+	std::vector<bool> emitted(triangleCount, false);
+
+	std::vector<uint32_t> cache;
+	std::vector<uint32_t> newCache;
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+
+	size_t nextUnemitted = 0;
+	int64_t best = -1;
+	while (result.size() < indices.size())
+	{
+		// Nothing in the cache has triangles left, continue with the next triangle in the old order.
+		if (best < 0)
+		{
+			while (emitted[nextUnemitted]) nextUnemitted++;
+			best = static_cast<int64_t>(nextUnemitted);
+		}
+
+		emitted[best] = true;
+		const uint32_t* triangle = &indices[best * 3];
+		result.insert(result.end(), triangle, triangle + 3);
+
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t v = triangle[k];
+			uint32_t* list = &adjacency[adjacencyOffsets[v]];
+			for (uint32_t j = 0; j < remaining[v]; j++)
+			{
+				if (list[j] == static_cast<uint32_t>(best))
+				{
+					list[j] = list[remaining[v] - 1];
+					remaining[v]--;
+					break;
+				}
+			}
+		}
+
+		// The triangle's vertices move to the front, the rest shift back. Past VERTEX_CACHE_SIZE they fall out.
+		newCache.clear();
+		for (int k = 0; k < 3; k++)
+		{
+			if (std::find(newCache.begin(), newCache.end(), triangle[k]) == newCache.end())
+			{
+				newCache.push_back(triangle[k]);
+			}
+		}
+		for (uint32_t v : cache)
+		{
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+			{
+				newCache.push_back(v);
+			}
+		}
+
+		for (size_t i = 0; i < newCache.size(); i++)
+		{
+			uint32_t v = newCache[i];
+			cachePosition[v] = i < VERTEX_CACHE_SIZE ? static_cast<int>(i) : -1;
+			vertexScores[v] = vertexScore(cachePosition[v], remaining[v]);
+		}
+
+		// Rescore the live triangles of everything touched, pick the best one still in reach of the cache.
+		best = -1;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < newCache.size(); i++)
+		{
+			uint32_t v = newCache[i];
+			const uint32_t* list = &adjacency[adjacencyOffsets[v]];
+			for (uint32_t j = 0; j < remaining[v]; j++)
+			{
+				uint32_t t = list[j];
+				triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+				if (i < VERTEX_CACHE_SIZE && triangleScores[t] > bestScore)
+				{
+					bestScore = triangleScores[t];
+					best = t;
+				}
+			}
+		}
+
+		if (newCache.size() > VERTEX_CACHE_SIZE)
+		{
+			newCache.resize(VERTEX_CACHE_SIZE);
+		}
+		cache.swap(newCache);
+	}
+
+	indices.swap(result);
+}
+
+void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) return;
+
+	// Cluster boundaries: triangles that miss the simulated cache on all three vertices. Reordering whole
+	// clusters keeps almost all of the cache order's reuse.
+	std::vector<size_t> clusterStarts;
+	std::vector<uint32_t> loadedAt(vertices.size(), 0);
+	std::vector<bool> loaded(vertices.size(), false);
+	uint32_t misses = 0;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		int triangleMisses = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t v = indices[t * 3 + k];
+			if (!loaded[v] || misses - loadedAt[v] >= VERTEX_CACHE_SIZE)
+			{
+				loaded[v] = true;
+				loadedAt[v] = misses++;
+				triangleMisses++;
+			}
+		}
+		if (t == 0 || triangleMisses == 3)
+		{
+			clusterStarts.push_back(t);
+		}
+	}
+	clusterStarts.push_back(triangleCount);
+
+	// Area weighted centre and normal of the mesh and of each cluster.
+	size_t clusterCount = clusterStarts.size() - 1;
+	std::vector<glm::vec3> clusterCentres(clusterCount, glm::vec3(0.0f));
+	std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0.0f));
+	std::vector<float> clusterAreas(clusterCount, 0.0f);
+	glm::vec3 meshCentre(0.0f);
+	float meshArea = 0.0f;
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+		{
+			const glm::vec3& p0 = vertices[indices[t * 3]].pos;
+			const glm::vec3& p1 = vertices[indices[t * 3 + 1]].pos;
+			const glm::vec3& p2 = vertices[indices[t * 3 + 2]].pos;
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+			glm::vec3 centre = (p0 + p1 + p2) / 3.0f;
+
+			clusterCentres[c] = clusterCentres[c] + centre * area;
+			clusterNormals[c] = clusterNormals[c] + normal;
+			clusterAreas[c] += area;
+		}
+		meshCentre = meshCentre + clusterCentres[c];
+		meshArea += clusterAreas[c];
+	}
+	if (meshArea > 0.0f)
+	{
+		meshCentre = meshCentre / meshArea;
+	}
+
+	// Clusters out on the surface facing away from the centre are likely occluders, draw them first.
+	std::vector<float> sortKeys(clusterCount, 0.0f);
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		float normalLength = glm::length(clusterNormals[c]);
+		if (clusterAreas[c] <= 0.0f || normalLength <= 0.0f) continue;
+
+		glm::vec3 centre = clusterCentres[c] / clusterAreas[c];
+		sortKeys[c] = glm::dot(centre - meshCentre, clusterNormals[c] / normalLength);
+	}
+
+	std::vector<size_t> order(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		order[c] = c;
+	}
+	std::stable_sort(order.begin(), order.end(), [&sortKeys](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+	for (size_t c : order)
+	{
+		result.insert(result.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+	}
+	indices.swap(result);
+}
+
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	const uint32_t UNUSED = ~0u;
+	std::vector<uint32_t> remap(vertices.size(), UNUSED);
+	std::vector<Vertex> result;
+	result.reserve(vertices.size());
+
+	for (uint32_t& index : indices)
+	{
+		if (remap[index] == UNUSED)
+		{
+			remap[index] = static_cast<uint32_t>(result.size());
+			result.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+
+	vertices.swap(result);
+}
+
+MeshOptimizeStats optimizeMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t vertexStride)
+{
+	MeshOptimizeStats stats;
+	stats.triangles = static_cast<uint32_t>(indices.size() / 3);
+	stats.verticesBefore = static_cast<uint32_t>(vertices.size());
+	stats.acmrBefore = computeAcmr(indices, stats.verticesBefore);
+	stats.bytesBefore = uint64_t(vertexStride) * vertices.size() + sizeof(uint32_t) * indices.size();
+
+	optimizeVertexCache(indices, stats.verticesBefore);
+	optimizeOverdraw(indices, vertices);
+	optimizeVertexFetch(vertices, indices);
+
+	stats.verticesAfter = static_cast<uint32_t>(vertices.size());
+	stats.acmrAfter = computeAcmr(indices, stats.verticesAfter);
+	stats.bytesAfter = uint64_t(vertexStride) * vertices.size() +
+		(useShortIndices(stats.verticesAfter) ? sizeof(uint16_t) : sizeof(uint32_t)) * indices.size();
+
+	return stats;
+}
+
+bool useShortIndices(uint32_t vertexCount)
+{
+	return vertexCount < 65536;
+}
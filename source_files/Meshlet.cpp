@@ -0,0 +1,148 @@
+#include <cmath>
+#include <algorithm>
+
+#include "Meshlet.h"
+#include "FrustumCuller.h"
+
+
+
+static Meshlet finishMeshlet(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, size_t firstTriangle, size_t lastTriangle)
+{
+	Meshlet meshlet;
+	meshlet.firstIndex = static_cast<uint32_t>(firstTriangle * 3);
+	meshlet.indexCount = static_cast<uint32_t>((lastTriangle - firstTriangle) * 3);
+
+	// Sphere around the centre of the bounding box.
+	glm::vec3 boundsMin = vertices[indices[firstTriangle * 3]].pos;
+	glm::vec3 boundsMax = boundsMin;
+	for (size_t i = firstTriangle * 3; i < lastTriangle * 3; i++)
+	{
+		boundsMin = glm::min(boundsMin, vertices[indices[i]].pos);
+		boundsMax = glm::max(boundsMax, vertices[indices[i]].pos);
+	}
+	meshlet.center = (boundsMin + boundsMax) * 0.5f;
+	meshlet.radius = 0.0f;
+	for (size_t i = firstTriangle * 3; i < lastTriangle * 3; i++)
+	{
+		meshlet.radius = std::max(meshlet.radius, glm::length(vertices[indices[i]].pos - meshlet.center));
+	}
+
+	// Normal cone: average facing, widened until every triangle's normal is inside.
+	std::vector<glm::vec3> normals;
+	normals.reserve(lastTriangle - firstTriangle);
+	glm::vec3 axis(0.0f);
+	for (size_t t = firstTriangle; t < lastTriangle; t++)
+	{
+		const glm::vec3& p0 = vertices[indices[t * 3]].pos;
+		const glm::vec3& p1 = vertices[indices[t * 3 + 1]].pos;
+		const glm::vec3& p2 = vertices[indices[t * 3 + 2]].pos;
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float area = glm::length(normal);
+		if (area <= 0.0f) continue;
+
+		normals.push_back(normal / area);
+		axis = axis + normals.back();
+	}
+
+	meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+	meshlet.coneCutoff = 1.0f;
+	float axisLength = glm::length(axis);
+	if (axisLength <= 0.0f) return meshlet;
+
+	meshlet.coneAxis = axis / axisLength;
+	float minDot = 1.0f;
+	for (const glm::vec3& normal : normals)
+	{
+		minDot = std::min(minDot, glm::dot(normal, meshlet.coneAxis));
+	}
+
+	// Past 90 degrees some triangle always faces the camera.
+	if (minDot > 0.0f)
+	{
+		meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+	}
+	return meshlet;
+}
+
+std::vector<Meshlet> buildMeshlets(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+	std::vector<Meshlet> meshlets;
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) return meshlets;
+
+	// Meshlet each vertex was last counted in, so shared vertices count once per meshlet.
+	std::vector<uint32_t> countedIn(vertices.size(), ~0u);
+	uint32_t meshletIndex = 0;
+	uint32_t meshletVertices = 0;
+	size_t firstTriangle = 0;
+
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		const uint32_t* triangle = &indices[t * 3];
+		uint32_t newVertices = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			bool repeated = (k > 0 && triangle[k] == triangle[0]) || (k > 1 && triangle[k] == triangle[1]);
+			if (countedIn[triangle[k]] != meshletIndex && !repeated) newVertices++;
+		}
+
+		if (t - firstTriangle == MESHLET_MAX_TRIANGLES || meshletVertices + newVertices > MESHLET_MAX_VERTICES)
+		{
+			meshlets.push_back(finishMeshlet(vertices, indices, firstTriangle, t));
+			firstTriangle = t;
+			meshletIndex++;
+			meshletVertices = 0;
+
+			// Nothing is counted in the new meshlet yet.
+			newVertices = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				bool repeated = (k > 0 && triangle[k] == triangle[0]) || (k > 1 && triangle[k] == triangle[1]);
+				if (!repeated) newVertices++;
+			}
+		}
+
+		for (int k = 0; k < 3; k++)
+		{
+			countedIn[triangle[k]] = meshletIndex;
+		}
+		meshletVertices += newVertices;
+	}
+	meshlets.push_back(finishMeshlet(vertices, indices, firstTriangle, triangleCount));
+
+	return meshlets;
+}
+
+ClusterCullView makeClusterCullView(const glm::mat4& viewProjection, const glm::mat4& model, const glm::vec3& cameraPosition)
+{
+	ClusterCullView view;
+
+	// Planes of the model's clip matrix come out in model space.
+	FrustumCuller::extractPlanes(viewProjection * model, view.planes);
+
+	view.cameraPosition = glm::vec3(glm::inverse(model) * glm::vec4(cameraPosition, 1.0f));
+	return view;
+}
+
+ClusterVisibility testCluster(const Meshlet& meshlet, const ClusterCullView& view)
+{
+	for (const glm::vec4& plane : view.planes)
+	{
+		if (glm::dot(glm::vec3(plane), meshlet.center) + plane.w < -meshlet.radius)
+		{
+			return CLUSTER_OUTSIDE_FRUSTUM;
+		}
+	}
+
+	// Every triangle faces away from every point of the sphere the camera could be looking at.
+	if (meshlet.coneCutoff < 1.0f)
+	{
+		glm::vec3 toCluster = meshlet.center - view.cameraPosition;
+		if (glm::dot(toCluster, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(toCluster) + meshlet.radius)
+		{
+			return CLUSTER_BACKFACING;
+		}
+	}
+
+	return CLUSTER_VISIBLE;
+}
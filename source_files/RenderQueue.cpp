@@ -0,0 +1,78 @@
+#include <cstring>
+#include <utility>
+
+#include "RenderQueue.h"
+
+
+
+static const uint32_t KEY_INDEX_BITS = 27;
+static const uint32_t KEY_DEPTH_BITS = 16;
+static const uint32_t KEY_TEXTURE_BITS = 16;
+
+uint64_t makeDrawKey(VertexLayout layout, VkIndexType indexType, uint32_t texture, float depth, uint32_t draw)
+{
+	// Bits of a non negative float sort like the float, its top bits are a depth with ~1% relative precision.
+	// Coarse on purpose: nearby meshes don't swap places with every small camera move.
+	depth = depth > 0.0f ? depth : 0.0f;
+	uint32_t depthBits;
+	memcpy(&depthBits, &depth, sizeof(depthBits));
+
+	uint64_t key = uint64_t(layout) & 0xF;
+	key = (key << 1) | (indexType == VK_INDEX_TYPE_UINT32 ? 1 : 0);
+	key = (key << KEY_TEXTURE_BITS) | (texture & ((1u << KEY_TEXTURE_BITS) - 1));
+	key = (key << KEY_DEPTH_BITS) | (depthBits >> (32 - KEY_DEPTH_BITS));
+	key = (key << KEY_INDEX_BITS) | (draw & ((1u << KEY_INDEX_BITS) - 1));
+	return key;
+}
+
+uint32_t getDrawKeyIndex(uint64_t key)
+{
+	return static_cast<uint32_t>(key & ((1u << KEY_INDEX_BITS) - 1));
+}
+
+void radixSortKeys(uint64_t* keys, uint64_t* scratch, size_t count)
+{
+	if (count < 2) return;
+
+	// Histograms of all eight bytes in one read of the keys.
+	uint32_t counts[8][256] = {};
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t key = keys[i];
+		for (uint32_t pass = 0; pass < 8; pass++)
+		{
+			counts[pass][(key >> (pass * 8)) & 0xFF]++;
+		}
+	}
+
+	uint64_t* source = keys;
+	uint64_t* destination = scratch;
+	for (uint32_t pass = 0; pass < 8; pass++)
+	{
+		uint32_t* passCounts = counts[pass];
+		uint32_t shift = pass * 8;
+
+		// Every key has the same byte here, the pass wouldn't move anything.
+		if (passCounts[(source[0] >> shift) & 0xFF] == count) continue;
+
+		uint32_t offset = 0;
+		for (uint32_t digit = 0; digit < 256; digit++)
+		{
+			uint32_t digitCount = passCounts[digit];
+			passCounts[digit] = offset;
+			offset += digitCount;
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			uint64_t key = source[i];
+			destination[passCounts[(key >> shift) & 0xFF]++] = key;
+		}
+		std::swap(source, destination);
+	}
+
+	if (source != keys)
+	{
+		memcpy(keys, source, count * sizeof(uint64_t));
+	}
+}
@@ -31,14 +31,28 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
     }
 }
 
-ShaderApplication::ShaderApplication() {
-
+ShaderApplication::ShaderApplication(AppSettings newSettings) {
+    settings = newSettings;
 }
 
 void ShaderApplication::run() {
-    initWindow("Vulkan", 500, 500);
+    // Headless render nodes have no display, so never touch GLFW there.
+    if (!settings.headless) {
+        initWindow("Vulkan", settings.width, settings.height);
+    }
     initVulkan();
     mainLoop();
+
+    if (!settings.gpuProfilePath.empty()) {
+        writeGpuProfile();
+    }
+    if (!settings.cpuProfilePath.empty()) {
+        writeCpuProfile();
+    }
+
+    if (settings.headless && !settings.outputImage.empty()) {
+        saveOffscreenImage(settings.outputImage);
+    }
     cleanup();
 }
 
@@ -59,21 +73,42 @@ int ShaderApplication::initVulkan() {
     try {
         createInstance();
         setupDebugMessenger();
-        createSurface();
+        if (!settings.headless) {
+            createSurface();
+        }
         getPhysicalDevice();
         createLogicalDevice();
-        createSwapChain();
+        deviceAllocator.createDeviceAllocator(mainDevice.physicalDevice, mainDevice.logicalDevice);
+        memoryTelemetry.createMemoryTelemetry(&deviceAllocator, mainDevice.physicalDevice, memoryBudgetSupported,
+            (VkDeviceSize)settings.memoryBudgetMiB * 1024 * 1024, settings.memoryLogInterval);
+        QueueFamilyIndices queueFamilies = getQueueFamilies(mainDevice.physicalDevice);
+        uint32_t transferFamily = queueFamilies.transferFamily >= 0 ? queueFamilies.transferFamily : queueFamilies.graphicsFamily;
+        uploadManager.createUploadManager(&deviceAllocator, mainDevice.physicalDevice, mainDevice.logicalDevice,
+            transferQueue, transferFamily, graphicQueue, queueFamilies.graphicsFamily, STAGING_RING_SIZE);
+        geometryArena.createGeometryArena(&deviceAllocator, &uploadManager, GEOMETRY_ARENA_VERTEX_BYTES, GEOMETRY_ARENA_INDEX_BYTES);
+        if (settings.gpuCulling) {
+            gpuCuller.createGpuCuller(&deviceAllocator, mainDevice.logicalDevice, settings.framesInFlight,
+                drawIndirectCountSupported, multiDrawIndirectSupported, settings.bindlessTextures);
+        }
+        if (settings.headless) {
+            createOffscreenImages();
+        }
+        else {
+            createSwapChain();
+        }
+        createGpuProfiler();
+        checkDynamicResolutionSupport();
         createRenderPass();
         createDescriptorSetLayout();
-        createPushConstantRange();
         createGraphicsPipeline();
         createColourBufferImage();
         createDepthBufferImage();
+        createSceneImages();
         createFramebuffers();
         createCommandPool();
         createCommandBuffers();
+        createRecordThreads();
         createTextureSampler();
-        //allocateDynamicBufferTransferSpace();
         createUniformBuffers();
         createDescriptorPool();
         createDescriptorSets();
@@ -88,6 +123,7 @@ int ShaderApplication::initVulkan() {
 
         // Fallback texture.
         createTexture("RGB_1.1001.png");
+        sceneUploadToken = uploadManager.flush();
 
     }
     catch (const std::runtime_error& e) {
@@ -102,56 +138,169 @@ void ShaderApplication::updateModel(int modelID, glm::mat4 newModel)
 {
     if(modelID >= modelList.size()) return;
 
+    // Transforms are written to the uniform ring every frame, recorded command buffers don't change.
     modelList[modelID].setModel(newModel);
+}
+
+int ShaderApplication::createInstance(int modelID, glm::mat4 transform)
+{
+    if (modelID < 0 || modelID >= modelList.size()) {
+        throw std::runtime_error("Attempted to instance an invalid model!");
+    }
+    if (totalInstances >= MAX_INSTANCES) {
+        throw std::runtime_error("Failed to create an instance, the instance buffer is full!");
+    }
+
+    // Instance counts and first instances are recorded into the draws.
+    int instanceID = static_cast<int>(modelList[modelID].addInstance(transform));
+    for (size_t j = modelID + 1; j < modelList.size(); j++)
+    {
+        modelFirstInstances[j]++;
+    }
+    totalInstances++;
+    instanceVersion++;
+    markSceneDirty();
+
+    return instanceID;
+}
+
+void ShaderApplication::updateInstance(int modelID, int instanceID, glm::mat4 transform)
+{
+    if (modelID >= modelList.size()) return;
+
+    // Only the instance buffer changes, recorded command buffers stay valid.
+    modelList[modelID].setInstance(instanceID, transform);
+    instanceVersion++;
+
+    // The GPU culler only needs this model's bounds refreshed, not a rebuild.
+    if (settings.gpuCulling && modelID < gpuModelBoundsDirty.size() && !gpuModelBoundsDirty[modelID]) {
+        gpuModelBoundsDirty[modelID] = 1;
+        gpuBoundsDirtyModels.push_back(modelID);
+    }
+}
+
+void ShaderApplication::createInstanceGrid(int modelID, uint32_t count)
+{
+    // Square grid on the xz plane starting at the model's first instance, cells as wide as the model.
+    float spacing = 0.0f;
+    for (size_t k = 0; k < modelList[modelID].getMeshCount(); k++)
+    {
+        const MeshBounds& bounds = modelList[modelID].getMesh(k)->getBounds();
+        spacing = std::max(spacing, 2.0f * (glm::length(bounds.sphereCenter) + bounds.sphereRadius));
+    }
+
+    uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(double(count))));
+    for (uint32_t i = 1; i < count; i++)
+    {
+        glm::vec3 offset((i % side) * spacing, 0.0f, (i / side) * spacing);
+        createInstance(modelID, glm::translate(glm::mat4(1.0f), offset));
+    }
+}
 
+void ShaderApplication::markSceneDirty()
+{
+    // Command buffers are re-recorded lazily, the next time their image comes up in draw().
+    sceneVersion++;
 }
 
 void ShaderApplication::draw()
 {
-    // 1. Get next available image to draw to and set something to signal when we`re finished with the image (a semaphore)
-    vkWaitForFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
-    vkResetFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame]);
+    PROFILE_ZONE("draw");
+
+    // 1. Wait until this frame slot's last submit is done, then get next available image to draw to and set something to signal when we`re finished with the image (a semaphore)
+    currentFrame = frameScheduler.getCurrentFrame();
+    frameScheduler.beginFrame();
+
+    // Scratch memory from the last time this frame slot was used is free again.
+    frameArenas[currentFrame].reset();
+
+    // Geometry buffers replaced by growth are free once every frame that could have drawn from them finished.
+    uint64_t frameNumber = frameScheduler.getFrameNumber();
+    uint64_t frameCount = frameScheduler.getFrameCount();
+    geometryArena.destroyRetiredBuffers(frameNumber, frameNumber > frameCount ? frameNumber - frameCount : 0);
+
+    // This slot's last frame finished, so its GPU timestamps can be read and the render scale adjusted.
+    if (gpuProfiler.collect(currentFrame)) {
+        benchmark.addGpuFrame(gpuProfiler.getLastFrameMs());
+        updateResolution();
+    }
 
     uint32_t imageIndex;
-    vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint64_t>::max(), imageAvailable[currentFrame], VK_NULL_HANDLE, &imageIndex);
-
-    recordCommands(imageIndex);
-    updateUniformBuffers(imageIndex);
-
-    // 2. Submit our command buffer to the queue for execution. Mae sure it waits for the image to be signalled as available before drawing. Signals when it is finished rendering.
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &imageAvailable[currentFrame];
-    VkPipelineStageFlags waitStages[] = {
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
-    };
-    submitInfo.pWaitDstStageMask = waitStages;
-    submitInfo.commandBufferCount =1;
-    submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &renderFinished[currentFrame];
-
-    VkResult result = vkQueueSubmit(graphicQueue, 1, &submitInfo, drawFences[currentFrame]);
-    if (result != VK_SUCCESS) {
-        throw std::runtime_error("Failed to submit commandbuffer to queue!");
+    if (settings.headless) {
+        // No swapchain to acquire from, cycle through the offscreen images.
+        imageIndex = static_cast<uint32_t>((frameScheduler.getFrameNumber() - 1) % swapchainImages.size());
+    }
+    else {
+        PROFILE_ZONE("vkAcquireNextImageKHR");
+        VkResult result = vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, FRAME_WAIT_TIMEOUT, frameScheduler.getImageAvailable(), VK_NULL_HANDLE, &imageIndex);
+        if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+            throw std::runtime_error("Failed to acquire a swapchain image!");
+        }
+    }
+    lastImageIndex = imageIndex;
+
+    // An older frame may still be rendering to this image. Wait for it before reusing the image's attachments.
+    frameScheduler.waitForImage(imageIndex);
+
+    // Scene changed since the GPU culler's draw records were built, or instances moved since their bounds were written.
+    if (settings.gpuCulling && gpuDrawVersion != sceneVersion) {
+        buildGpuDraws();
     }
+    else if (settings.gpuCulling && !gpuBoundsDirtyModels.empty()) {
+        updateGpuDrawBounds();
+    }
+
+    // Fill this frame's uniform ring first, recording uses the offsets it hands out.
+    updateUniformBuffers();
+
+    if (settings.frustumCulling) {
+        cullMeshes();
+    }
+    if (settings.sortDraws) {
+        sortDraws();
+    }
+
+    // Only re-record when the scene (or the set of meshes in view, or their order) changed since this command buffer was
+    // last recorded. Cluster culling depends on the camera, so it records every frame.
+    uint32_t commandBufferIndex = getCommandBufferIndex(currentFrame, imageIndex);
+    bool visibilityChanged = settings.frustumCulling && recordedVisibility[commandBufferIndex] != meshVisibility;
+    bool orderChanged = settings.sortDraws && recordedDrawOrder[commandBufferIndex] != drawOrder;
+    if (settings.clusterCulling || visibilityChanged || orderChanged || recordedSceneVersion[commandBufferIndex] != sceneVersion) {
+        recordCommands(imageIndex);
+        recordedSceneVersion[commandBufferIndex] = sceneVersion;
+        if (settings.frustumCulling) {
+            recordedVisibility[commandBufferIndex] = meshVisibility;
+        }
+        if (settings.sortDraws) {
+            recordedDrawOrder[commandBufferIndex] = drawOrder;
+        }
+    }
+
+    // 2. Submit our command buffer to the queue for execution. Waits for the image to be available before drawing, signals the timeline (and present) when finished rendering.
+    frameScheduler.submit(graphicQueue, commandBuffers[commandBufferIndex], imageIndex);
+    gpuProfiler.submitted(currentFrame, commandBufferIndex);
+    memoryTelemetry.update();
 
     // 3. Present image to screen when it has singaled finished rendering.
-    VkPresentInfoKHR presentInfo = {};
-    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = &renderFinished[currentFrame];
-    presentInfo.swapchainCount = 1;
-    presentInfo.pSwapchains = &swapchain;
-    presentInfo.pImageIndices = &imageIndex;
-
-    result = vkQueuePresentKHR(presentationQueue, &presentInfo);
-    if (result != VK_SUCCESS) {
-        throw std::runtime_error("Failed to present image!");
+    if (!settings.headless) {
+        PROFILE_ZONE("vkQueuePresentKHR");
+        VkSemaphore renderFinished = frameScheduler.getRenderFinished();
+
+        VkPresentInfoKHR presentInfo = {};
+        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        presentInfo.waitSemaphoreCount = 1;
+        presentInfo.pWaitSemaphores = &renderFinished;
+        presentInfo.swapchainCount = 1;
+        presentInfo.pSwapchains = &swapchain;
+        presentInfo.pImageIndices = &imageIndex;
+
+        VkResult result = vkQueuePresentKHR(presentationQueue, &presentInfo);
+        if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+            throw std::runtime_error("Failed to present image!");
+        }
     }
 
-    currentFrame = (currentFrame + 1) % MAX_FRAME_DRAWS;
+    frameScheduler.endFrame();
 
 }
 
@@ -161,10 +310,55 @@ void ShaderApplication::mainLoop() {
     float deltaTime = 0.0f;
     float lastTime = 0.0f;
 
+    PROFILE_THREAD("Main");
+
+    if (!settings.benchmarkPath.empty()) {
+        benchmark.reset(settings.benchmarkWarmup, settings.benchmarkFrames);
+    }
+
+    auto loadStart = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < settings.modelFiles.size(); i++) {
+        int modelID = createMeshModel(settings.modelFiles[i], settings.modelVertexLayouts[i]);
+        if (settings.modelInstances > 1) {
+            createInstanceGrid(modelID, settings.modelInstances);
+        }
+    }
+    if (!settings.benchmarkPath.empty()) {
+        // Load time includes the GPU copies.
+        uploadManager.wait(sceneUploadToken);
+    }
+    benchmark.setLoadMs(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count());
+
+    if (settings.recordBenchmark) {
+        benchmarkRecording();
+        return;
+    }
+
+    if (!settings.benchmarkPath.empty()) {
+        runBenchmark();
+        return;
+    }
 
-    createMeshModel("geo/Alfred_Retypology.obj");
+    if (settings.headless) {
+        // No window to close, render a fixed number of frames and finish.
+        for (uint32_t frame = 0; frame < settings.headlessFrameCount; frame++) {
+            PROFILE_ZONE("Frame");
+            AllocationStats frameStart = AllocationCounter::getTotals();
+            draw();
+            trackFrameAllocations(frame, AllocationCounter::since(frameStart));
+        }
+        reportAllocations();
+        reportFrameWaits();
+        reportCulling();
+        reportBinds();
+        return;
+    }
 
+    uint64_t frame = 0;
     while (!glfwWindowShouldClose(window)) {
+        PROFILE_ZONE("Frame");
+        AllocationStats frameStart = AllocationCounter::getTotals();
+
         glfwPollEvents();
         float now = glfwGetTime();
         deltaTime = now - lastTime;
@@ -175,19 +369,192 @@ void ShaderApplication::mainLoop() {
 
 
         draw();
+        trackFrameAllocations(frame++, AllocationCounter::since(frameStart));
     }
+    reportAllocations();
+    reportFrameWaits();
+    reportCulling();
+    reportBinds();
 }
 
-void ShaderApplication::cleanup() {
+void ShaderApplication::runBenchmark()
+{
+    // Same path every run: camera position depends on the frame number only, never on how long frames took.
+    uint32_t totalFrames = settings.benchmarkWarmup + settings.benchmarkFrames;
+
+    for (uint32_t frame = 0; frame < totalFrames; frame++) {
+        PROFILE_ZONE("Frame");
+
+        if (!settings.headless) {
+            glfwPollEvents();
+            if (glfwWindowShouldClose(window)) {
+                printf("Benchmark: window closed after %u of %u frames.\n", frame, totalFrames);
+                break;
+            }
+        }
 
+        updateCamera(frame * BENCHMARK_TIMESTEP);
+
+        auto start = std::chrono::steady_clock::now();
+        draw();
+        double frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        benchmark.addFrame(frameMs, frameMs - frameScheduler.getLastWaitMs());
+    }
+
+    // Last frames' GPU times are still pending in their slots. Collect them oldest first.
     vkDeviceWaitIdle(mainDevice.logicalDevice);
+    for (uint32_t i = 0; i < frameScheduler.getFrameCount(); i++) {
+        if (gpuProfiler.collect((frameScheduler.getCurrentFrame() + i) % frameScheduler.getFrameCount())) {
+            benchmark.addGpuFrame(gpuProfiler.getLastFrameMs());
+        }
+    }
+
+    writeBenchmarkReport();
+    reportFrameWaits();
+    reportCulling();
+    reportBinds();
+}
+
+void ShaderApplication::updateCamera(float time)
+{
+    // Orbit around the origin, starting from the default eye position.
+    glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::mat4 orbit = glm::rotate(glm::mat4(1.0f), glm::radians(BENCHMARK_ORBIT_SPEED * time), up);
+    glm::vec3 eye = glm::vec3(orbit * glm::vec4(10.0f, 0.0f, 20.0f, 1.0f));
+
+    uboViewProjection.view = glm::lookAt(eye, glm::vec3(0.0f, 0.0f, 0.0f), up);
+}
+
+void ShaderApplication::writeBenchmarkReport()
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &properties);
+
+    std::string models;
+    for (size_t i = 0; i < settings.modelFiles.size(); i++) {
+        models += (i > 0 ? ", \"" : "\"") + Benchmark::escapeJson(settings.modelFiles[i]) + "\"";
+    }
+
+    std::string runInfo =
+        "  \"device\": \"" + Benchmark::escapeJson(properties.deviceName) + "\",\n" +
+        "  \"width\": " + std::to_string(swapchainExtent.width) + ",\n" +
+        "  \"height\": " + std::to_string(swapchainExtent.height) + ",\n" +
+        "  \"headless\": " + (settings.headless ? "true" : "false") + ",\n" +
+        "  \"framesInFlight\": " + std::to_string(frameScheduler.getFrameCount()) + ",\n" +
+        "  \"recordThreads\": " + std::to_string(recordThreadPool->getThreadCount()) + ",\n" +
+        "  \"dynamicResolution\": " + (settings.dynamicResolution ? "true" : "false") + ",\n" +
+        "  \"models\": [" + models + "]";
+
+    benchmark.writeReport(settings.benchmarkPath, runInfo);
+    printf("Benchmark report written to %s\n", settings.benchmarkPath.c_str());
+}
+
+void ShaderApplication::trackFrameAllocations(uint64_t frame, const AllocationStats& frameAllocations)
+{
+    if (!settings.allocationStats) return;
+
+    // The first frames record every command buffer and grow the arenas, that's expected to allocate.
+    if (frame < swapchainImages.size() * settings.framesInFlight) return;
+
+    steadyStateAllocations.frames++;
+    steadyStateAllocations.allocations += frameAllocations.allocations;
+    steadyStateAllocations.bytes += frameAllocations.bytes;
+    steadyStateAllocations.maxAllocations = std::max(steadyStateAllocations.maxAllocations, frameAllocations.allocations);
+
+    if (frameAllocations.allocations > 0) {
+        steadyStateAllocations.allocatingFrames++;
+        printf("Frame %llu: %llu heap allocations, %llu bytes\n", (unsigned long long)frame,
+            (unsigned long long)frameAllocations.allocations, (unsigned long long)frameAllocations.bytes);
+    }
+}
+
+void ShaderApplication::reportAllocations()
+{
+    if (!settings.allocationStats) return;
+
+    printf("Steady state heap allocations: %llu frames, %llu allocated, %llu allocations (%llu bytes) total, at most %llu in one frame.\n",
+        (unsigned long long)steadyStateAllocations.frames, (unsigned long long)steadyStateAllocations.allocatingFrames,
+        (unsigned long long)steadyStateAllocations.allocations, (unsigned long long)steadyStateAllocations.bytes,
+        (unsigned long long)steadyStateAllocations.maxAllocations);
+    deviceAllocator.printStats();
+    memoryTelemetry.printReport(memoryTelemetry.query());
+
+    VkDeviceSize attachmentBytes = 0;
+    for (size_t i = 0; i < colourBufferImageMemory.size(); i++)
+    {
+        attachmentBytes += colourBufferImageMemory[i].size + depthBufferImageMemory[i].size;
+    }
+    printf("Intermediate attachments: %zu colour + %zu depth, %.1f MiB%s.\n", colourBufferImageMemory.size(), depthBufferImageMemory.size(),
+        attachmentBytes / (1024.0 * 1024.0),
+        (deviceAllocator.getPropertyFlags(colourBufferImageMemory[0]) & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) ? " lazily allocated" : "");
+    printf("Geometry arena: %.1f of %.1f MiB vertex data, %.1f of %.1f MiB index data in use.\n", geometryArena.getUsedVertexBytes() / (1024.0 * 1024.0),
+        geometryArena.getVertexByteCapacity() / (1024.0 * 1024.0), geometryArena.getUsedIndexBytes() / (1024.0 * 1024.0), geometryArena.getIndexByteCapacity() / (1024.0 * 1024.0));
+
+    UploadStats uploads = uploadManager.getStats();
+    printf("Uploads (%s queue): %llu bytes, %llu uploads in %llu batches, %llu staging ring stalls.\n",
+        uploadManager.usesTransferQueue() ? "transfer" : "graphics", (unsigned long long)uploads.bytes,
+        (unsigned long long)uploads.uploads, (unsigned long long)uploads.batches, (unsigned long long)uploads.ringStalls);
+}
+
+void ShaderApplication::reportFrameWaits()
+{
+    if (!settings.frameStats) return;
+
+    uint64_t frames = frameScheduler.getFrameNumber();
+    if (frames == 0) return;
+
+    printf("CPU waiting on GPU: %u frames in flight, %zu images, %llu frames, %.3f ms average, %.3f ms worst, %.3f ms total.\n",
+        frameScheduler.getFrameCount(), swapchainImages.size(), (unsigned long long)frames,
+        frameScheduler.getTotalWaitMs() / frames, frameScheduler.getMaxWaitMs(), frameScheduler.getTotalWaitMs());
+}
+
+void ShaderApplication::reportBinds()
+{
+    if (bindRecordings == 0) return;
+
+    uint64_t total = bindTotals.binds + bindTotals.skipped;
+    printf("Binds: %.1f per recording, %.1f redundant ones skipped (%.1f%%)%s.\n",
+        double(bindTotals.binds) / bindRecordings, double(bindTotals.skipped) / bindRecordings,
+        total > 0 ? 100.0 * bindTotals.skipped / total : 0.0, settings.sortDraws ? ", draws sorted" : "");
+}
+
+void ShaderApplication::reportCulling()
+{
+    if (settings.gpuCulling) {
+        printf("GPU culling: %zu meshes in %zu indirect draws per frame (%s).\n", gpuCuller.getDrawCount(), gpuCuller.getBatches().size(),
+            gpuCuller.usesDrawCount() ? "indirect count" : multiDrawIndirectSupported ? "multi draw indirect" : "one indirect draw per mesh");
+    }
+
+    if (settings.frustumCulling && frustumCullFrames > 0) {
+        uint64_t meshes = visibleMeshes + culledMeshes;
+        printf("Frustum culling: %llu meshes per frame, %.1f visible, %.1f culled (%.1f%%).\n",
+            (unsigned long long)(meshes / frustumCullFrames), double(visibleMeshes) / frustumCullFrames,
+            double(culledMeshes) / frustumCullFrames, meshes > 0 ? 100.0 * culledMeshes / meshes : 0.0);
+    }
+
+    if (!settings.clusterCulling || clusterCullRecordings == 0) return;
+
+    const ClusterCullStats& totals = clusterCullTotals;
+    uint64_t meshlets = totals.visible + totals.backfacing + totals.outsideFrustum;
+    if (meshlets == 0) return;
+
+    printf("Cluster culling: %llu meshlets per frame, %.1f%% drawn in %.1f draws, %.1f%% back facing, %.1f%% off screen.\n",
+        (unsigned long long)(meshlets / clusterCullRecordings), 100.0 * totals.visible / meshlets,
+        double(totals.draws) / clusterCullRecordings, 100.0 * totals.backfacing / meshlets, 100.0 * totals.outsideFrustum / meshlets);
+}
+
+void ShaderApplication::cleanup() {
 
-    //_aligned_free(modelTransferSpace);
+    vkDeviceWaitIdle(mainDevice.logicalDevice);
 
     for (size_t i = 0; i < modelList.size(); i++)
     {
         modelList[i].destroyMeshModel();
     }
+    geometryArena.destroyGeometryArena();
+    gpuCuller.destroyGpuCuller();
+    uploadManager.destroyUploadManager();
 
     vkDestroyDescriptorPool(mainDevice.logicalDevice, inputDescriptorPool, nullptr);
 
@@ -202,58 +569,80 @@ void ShaderApplication::cleanup() {
     {
         vkDestroyImageView(mainDevice.logicalDevice, textureImageViews[i], nullptr);
         vkDestroyImage(mainDevice.logicalDevice, textureImages[i], nullptr);
-        vkFreeMemory(mainDevice.logicalDevice, textureImageMemory[i], nullptr);
+        deviceAllocator.free(textureImageMemory[i]);
     }
 
     for (size_t i = 0; i < depthBufferImage.size(); i++)
     {
         vkDestroyImageView(mainDevice.logicalDevice, depthBufferImageView[i], nullptr);
         vkDestroyImage(mainDevice.logicalDevice, depthBufferImage[i], nullptr);
-        vkFreeMemory(mainDevice.logicalDevice, depthBufferImageMemory[i], nullptr);
+        deviceAllocator.free(depthBufferImageMemory[i]);
     }
 
     for (size_t i = 0; i < colourBufferImage.size(); i++)
     {
         vkDestroyImageView(mainDevice.logicalDevice, colourBufferImageView[i], nullptr);
         vkDestroyImage(mainDevice.logicalDevice, colourBufferImage[i], nullptr);
-        vkFreeMemory(mainDevice.logicalDevice, colourBufferImageMemory[i], nullptr);
+        deviceAllocator.free(colourBufferImageMemory[i]);
+    }
+
+    for (size_t i = 0; i < sceneImages.size(); i++)
+    {
+        vkDestroyImageView(mainDevice.logicalDevice, sceneImageViews[i], nullptr);
+        vkDestroyImage(mainDevice.logicalDevice, sceneImages[i], nullptr);
+        deviceAllocator.free(sceneImageMemory[i]);
     }
 
+    gpuProfiler.destroyGpuProfiler();
+
 
     vkDestroyDescriptorPool(mainDevice.logicalDevice, descriptorPool, nullptr);
 
     vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, descriptorSetLayout, nullptr);
-    for (size_t i = 0; i < swapchainImages.size(); i++)
+    frameUniformRing.destroyFrameUniformRing();
+    for (size_t i = 0; i < instanceBuffers.size(); i++)
     {
-        vkDestroyBuffer(mainDevice.logicalDevice, vpUniformBuffer[i], nullptr);
-        vkFreeMemory(mainDevice.logicalDevice, vpUniformBufferMemory[i], nullptr);
-        //vkDestroyBuffer(mainDevice.logicalDevice, modelDynUniformBuffer[i], nullptr);
-        //vkFreeMemory(mainDevice.logicalDevice, modelDynUniformBufferMemory[i], nullptr);
+        deviceAllocator.destroyBuffer(instanceBuffers[i], instanceBufferAllocations[i]);
     }
 
 
-    for (size_t i = 0; i < MAX_FRAME_DRAWS; i++) 
-    {
-        vkDestroySemaphore(mainDevice.logicalDevice, renderFinished[i], nullptr);
-        vkDestroySemaphore(mainDevice.logicalDevice, imageAvailable[i], nullptr);
-        vkDestroyFence(mainDevice.logicalDevice, drawFences[i], nullptr);
-    }
+    frameScheduler.destroyFrameScheduler();
 
+    destroyRecordThreads();
     vkDestroyCommandPool(mainDevice.logicalDevice, graphicsCommandPool, nullptr);
     for (auto framebuffer : swapchainFramebuffers) {
         vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
     }
     vkDestroyPipeline(mainDevice.logicalDevice, secondPipeline, nullptr);
     vkDestroyPipelineLayout(mainDevice.logicalDevice, secondPipelineLayout, nullptr);
-    vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline, nullptr);
+    for (VkPipeline pipeline : graphicsPipelines) {
+        vkDestroyPipeline(mainDevice.logicalDevice, pipeline, nullptr);
+    }
     vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout, nullptr);
+    if (settings.gpuCulling) {
+        for (VkPipeline pipeline : indirectPipelines) {
+            vkDestroyPipeline(mainDevice.logicalDevice, pipeline, nullptr);
+        }
+        vkDestroyPipelineLayout(mainDevice.logicalDevice, indirectPipelineLayout, nullptr);
+    }
     vkDestroyRenderPass(mainDevice.logicalDevice, renderPass, nullptr);
 
     for (auto image : swapchainImages) {
         vkDestroyImageView(mainDevice.logicalDevice, image.imageView, nullptr);
     }
-    vkDestroySwapchainKHR(mainDevice.logicalDevice, swapchain, nullptr);
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+
+    if (settings.headless) {
+        for (size_t i = 0; i < swapchainImages.size(); i++)
+        {
+            vkDestroyImage(mainDevice.logicalDevice, swapchainImages[i].image, nullptr);
+            deviceAllocator.free(offscreenImageMemory[i]);
+        }
+    }
+    else {
+        vkDestroySwapchainKHR(mainDevice.logicalDevice, swapchain, nullptr);
+        vkDestroySurfaceKHR(instance, surface, nullptr);
+    }
+    deviceAllocator.destroyDeviceAllocator();
     vkDestroyDevice(mainDevice.logicalDevice, nullptr);
 
     if (enableValidationLayers) {
@@ -262,9 +651,11 @@ void ShaderApplication::cleanup() {
 
     vkDestroyInstance(instance, nullptr);
 
-    glfwDestroyWindow(window);
+    if (!settings.headless) {
+        glfwDestroyWindow(window);
 
-    glfwTerminate();
+        glfwTerminate();
+    }
 }
 
 void ShaderApplication::createInstance() {
@@ -285,6 +676,8 @@ void ShaderApplication::createInstance() {
     createInfo.pApplicationInfo = &appInfo;
 
     auto extensions = getRequiredExtensions();
+    debugUtilsEnabled = std::find_if(extensions.begin(), extensions.end(),
+        [](const char* name) { return strcmp(name, VK_EXT_DEBUG_UTILS_EXTENSION_NAME) == 0; }) != extensions.end();
     createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
     createInfo.ppEnabledExtensionNames = extensions.data();
 
@@ -312,13 +705,19 @@ void ShaderApplication::createLogicalDevice(){
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<int> queueFamilyIndicies = {indicies.graphicsFamily, indicies.presentationFamily };
+    if (settings.headless) {
+        queueFamilyIndicies = { indicies.graphicsFamily };
+    }
+    if (indicies.transferFamily >= 0) {
+        queueFamilyIndicies.insert(indicies.transferFamily);
+    }
 
+    float priority = 1.0f;  // Must outlive vkCreateDevice.
     for (int queueFamilyIndex : queueFamilyIndicies) {
         VkDeviceQueueCreateInfo queueCreateInfo = {};
         queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
         queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
         queueCreateInfo.queueCount = 1; //Number of queues to create.
-        float priority = 1.0f;
         queueCreateInfo.pQueuePriorities = &priority;
 
         queueCreateInfos.push_back(queueCreateInfo);
@@ -330,22 +729,121 @@ void ShaderApplication::createLogicalDevice(){
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
-    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    std::vector<const char*> extensions = getDeviceExtensions();
+    // Optional, memory telemetry falls back to its own accounting.
+    memoryBudgetSupported = hasDeviceExtension(mainDevice.physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (memoryBudgetSupported) {
+        extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+    deviceCreateInfo.ppEnabledExtensionNames = extensions.data();
+
+
+    // GPU culling needs firstInstance in indirect draws and gl_BaseInstance. Indirect count and multi draw are optional, see GpuCuller.h.
+    if (settings.gpuCulling) {
+        VkPhysicalDeviceVulkan11Features supportedVulkan11Features = {};
+        supportedVulkan11Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+        VkPhysicalDeviceVulkan12Features supportedVulkan12Features = {};
+        supportedVulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        supportedVulkan12Features.pNext = &supportedVulkan11Features;
+        VkPhysicalDeviceFeatures2 supportedFeatures = {};
+        supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supportedFeatures.pNext = &supportedVulkan12Features;
+        vkGetPhysicalDeviceFeatures2(mainDevice.physicalDevice, &supportedFeatures);
+
+        if (!supportedFeatures.features.drawIndirectFirstInstance || !supportedVulkan11Features.shaderDrawParameters) {
+            printf("Device has no indirect draws with a first instance or no shader draw parameters, GPU culling disabled.\n");
+            settings.gpuCulling = false;
+        }
+        else {
+            multiDrawIndirectSupported = supportedFeatures.features.multiDrawIndirect == VK_TRUE;
+            drawIndirectCountSupported = supportedVulkan12Features.drawIndirectCount == VK_TRUE;
+        }
+    }
+    // Bindless textures: one partially bound array written while frames using earlier elements are in flight,
+    // indexed per draw (non uniform within an indirect multi draw).
+    if (settings.bindlessTextures) {
+        VkPhysicalDeviceVulkan12Features supportedVulkan12Features = {};
+        supportedVulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceFeatures2 supportedFeatures = {};
+        supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supportedFeatures.pNext = &supportedVulkan12Features;
+        vkGetPhysicalDeviceFeatures2(mainDevice.physicalDevice, &supportedFeatures);
+
+        VkPhysicalDeviceVulkan12Properties vulkan12Properties = {};
+        vulkan12Properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+        VkPhysicalDeviceProperties2 deviceProperties = {};
+        deviceProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        deviceProperties.pNext = &vulkan12Properties;
+        vkGetPhysicalDeviceProperties2(mainDevice.physicalDevice, &deviceProperties);
+
+        bindlessTextureCapacity = std::min({ MAX_BINDLESS_TEXTURES,
+            vulkan12Properties.maxDescriptorSetUpdateAfterBindSampledImages,
+            vulkan12Properties.maxDescriptorSetUpdateAfterBindSamplers,
+            vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+            vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSamplers,
+            vulkan12Properties.maxPerStageUpdateAfterBindResources });
+
+        if (!supportedVulkan12Features.runtimeDescriptorArray || !supportedVulkan12Features.shaderSampledImageArrayNonUniformIndexing ||
+            !supportedVulkan12Features.descriptorBindingPartiallyBound || !supportedVulkan12Features.descriptorBindingSampledImageUpdateAfterBind ||
+            !supportedVulkan12Features.descriptorBindingUpdateUnusedWhilePending || bindlessTextureCapacity == 0) {
+            printf("Device has no descriptor indexing for sampled images, bindless textures disabled.\n");
+            settings.bindlessTextures = false;
+        }
+    }
 
+    // The cull pass replaces both CPU culls.
+    if (settings.gpuCulling && (settings.frustumCulling || settings.clusterCulling)) {
+        printf("GPU culling replaces frustum and cluster culling, both disabled.\n");
+        settings.frustumCulling = false;
+        settings.clusterCulling = false;
+    }
+    // GPU batches are already grouped by state, and there is no CPU draw list to sort.
+    if (settings.gpuCulling && settings.sortDraws) {
+        printf("GPU culling draws in state sorted batches, draw sorting disabled.\n");
+        settings.sortDraws = false;
+    }
 
     VkPhysicalDeviceFeatures deviceFeatures = {};
     deviceFeatures.samplerAnisotropy = VK_TRUE;                     //Enabling anisotropy
+    deviceFeatures.drawIndirectFirstInstance = settings.gpuCulling ? VK_TRUE : VK_FALSE;
+    deviceFeatures.multiDrawIndirect = multiDrawIndirectSupported ? VK_TRUE : VK_FALSE;
 
     deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 
+    // Vulkan 1.1 features
+    VkPhysicalDeviceVulkan11Features vulkan11Features = {};
+    vulkan11Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+    vulkan11Features.shaderDrawParameters = settings.gpuCulling ? VK_TRUE : VK_FALSE;   //gl_BaseInstance in the indirect vertex shader
+
+    // Vulkan 1.2 features
+    VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    vulkan12Features.timelineSemaphore = VK_TRUE;                   //Frame pacing
+    vulkan12Features.drawIndirectCount = drawIndirectCountSupported ? VK_TRUE : VK_FALSE;
+    VkBool32 bindless = settings.bindlessTextures ? VK_TRUE : VK_FALSE;    //Bindless textures
+    vulkan12Features.runtimeDescriptorArray = bindless;
+    vulkan12Features.shaderSampledImageArrayNonUniformIndexing = bindless;
+    vulkan12Features.descriptorBindingPartiallyBound = bindless;
+    vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = bindless;
+    vulkan12Features.descriptorBindingUpdateUnusedWhilePending = bindless;
+    vulkan12Features.pNext = &vulkan11Features;
+
+    deviceCreateInfo.pNext = &vulkan12Features;
+
     VkResult result = vkCreateDevice(mainDevice.physicalDevice, &deviceCreateInfo, nullptr, &mainDevice.logicalDevice);
     if (result != VK_SUCCESS) {
         throw std::runtime_error("Failed to create a logical device!");
     }
 
     vkGetDeviceQueue(mainDevice.logicalDevice, indicies.graphicsFamily, 0, &graphicQueue);
-    vkGetDeviceQueue(mainDevice.logicalDevice, indicies.presentationFamily, 0, &presentationQueue);
+    if (!settings.headless) {
+        vkGetDeviceQueue(mainDevice.logicalDevice, indicies.presentationFamily, 0, &presentationQueue);
+    }
+    transferQueue = graphicQueue;
+    if (indicies.transferFamily >= 0) {
+        vkGetDeviceQueue(mainDevice.logicalDevice, indicies.transferFamily, 0, &transferQueue);
+    }
 }
 
 void ShaderApplication::createSurface(){
@@ -369,6 +867,9 @@ void ShaderApplication::createSwapChain(){
     VkExtent2D extent = chooseSwapExtent(swapChainDetails.surfaceCapabilities);
 
     uint32_t imageCount = swapChainDetails.surfaceCapabilities.minImageCount + 1;
+    if (settings.swapchainImageCount > 0) {
+        imageCount = std::max(settings.swapchainImageCount, swapChainDetails.surfaceCapabilities.minImageCount);
+    }
     if (swapChainDetails.surfaceCapabilities.maxImageCount > 0 && swapChainDetails.surfaceCapabilities.maxImageCount < imageCount) {
         imageCount = swapChainDetails.surfaceCapabilities.maxImageCount;
     }
@@ -384,6 +885,16 @@ void ShaderApplication::createSwapChain(){
     swapChainCreateInfo.minImageCount = imageCount;
     swapChainCreateInfo.imageArrayLayers = 1;
     swapChainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    if (settings.dynamicResolution) {
+        // The upscaled scene is blitted into the swapchain image.
+        if (swapChainDetails.surfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) {
+            swapChainCreateInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        }
+        else {
+            printf("Swapchain images can't be transfer destinations, dynamic resolution disabled.\n");
+            settings.dynamicResolution = false;
+        }
+    }
     swapChainCreateInfo.preTransform = swapChainDetails.surfaceCapabilities.currentTransform;
     swapChainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     swapChainCreateInfo.clipped = VK_TRUE;
@@ -431,6 +942,28 @@ void ShaderApplication::createSwapChain(){
     }
 }
 
+void ShaderApplication::createOffscreenImages()
+{
+    // Headless stand in for the swapchain. Same format and role, so renderPass and pipelines don't change.
+    swapchainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+    swapchainExtent = { settings.width, settings.height };
+
+    // Like a swapchain, default to one more image than frames in flight.
+    uint32_t imageCount = settings.swapchainImageCount > 0 ? settings.swapchainImageCount : settings.framesInFlight + 1;
+    offscreenImageMemory.resize(imageCount);
+
+    for (size_t i = 0; i < imageCount; i++)
+    {
+        SwapchainImage offscreenImage = {};
+        offscreenImage.image = createImage(swapchainExtent.width, swapchainExtent.height, swapchainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_ATTACHMENTS, &offscreenImageMemory[i]);
+        offscreenImage.imageView = createImageView(offscreenImage.image, swapchainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+
+        swapchainImages.push_back(offscreenImage);
+    }
+}
+
 void ShaderApplication::createRenderPass()
 {
     // Array of our subpasses
@@ -457,7 +990,7 @@ void ShaderApplication::createRenderPass()
     //Depth Attachment (Input)
     VkAttachmentDescription depthAttachment = {};
     depthAttachment.format = chooseSupportedFormat(
-        { VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT },
+        { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM },
         VK_IMAGE_TILING_OPTIMAL,
         VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
     depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -499,6 +1032,11 @@ void ShaderApplication::createRenderPass()
     swapchainColourAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     swapchainColourAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     swapchainColourAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    if (settings.headless || settings.dynamicResolution) {
+        // Offscreen images are never presented, leave them ready to be copied out.
+        // With dynamic resolution this is the scene image, copied out by the upscale blit.
+        swapchainColourAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    }
 
     // Swap Chain Colour Attachment Reference
     VkAttachmentReference swapchainColourAttachmentReference = {};
@@ -536,19 +1074,20 @@ void ShaderApplication::createRenderPass()
 
     // Subpass 1 layout
     subpassDependencies[1].srcSubpass = 0;
-    subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
     subpassDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
     subpassDependencies[1].dstSubpass = 1;
     subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
     subpassDependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
     subpassDependencies[1].dependencyFlags = 0;
 
-    subpassDependencies[2].srcSubpass = 0;
+    // Attachment 0 is written by subpass 1, and read after the pass by present or the upscale blit.
+    subpassDependencies[2].srcSubpass = 1;
     subpassDependencies[2].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
     subpassDependencies[2].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
     subpassDependencies[2].dstSubpass = VK_SUBPASS_EXTERNAL;
-    subpassDependencies[2].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-    subpassDependencies[2].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    subpassDependencies[2].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+    subpassDependencies[2].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
     subpassDependencies[2].dependencyFlags = 0;
 
 
@@ -573,23 +1112,32 @@ void ShaderApplication::createRenderPass()
 void ShaderApplication::createDescriptorSetLayout()
 {
     // UNIFORM VALUES DESCRIPTOR SET LAYOUT
+    // Both live in the frame uniform ring, so both are dynamic.
     //UboViewProjection binding info
     VkDescriptorSetLayoutBinding vpLayoutBinding = {};
     vpLayoutBinding.binding = 0;   //Binding in vert shader location for uniform.
-    vpLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    vpLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     vpLayoutBinding.descriptorCount = 1;
     vpLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
     vpLayoutBinding.pImmutableSamplers = nullptr;  //For Textures. None at the moment.
 
     // Model binding info
-    /*VkDescriptorSetLayoutBinding modelLayoutBinding = {};
+    VkDescriptorSetLayoutBinding modelLayoutBinding = {};
     modelLayoutBinding.binding = 1;
     modelLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     modelLayoutBinding.descriptorCount = 1;
     modelLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-    modelLayoutBinding.pImmutableSamplers = nullptr;*/
+    modelLayoutBinding.pImmutableSamplers = nullptr;
 
-    std::vector<VkDescriptorSetLayoutBinding> layoutBindings = {vpLayoutBinding}; //{vpLayoutBinding, modelLayoutBinding}
+    // Instance transforms binding info. Not dynamic, each frame's set points at its own instance buffer.
+    VkDescriptorSetLayoutBinding instanceLayoutBinding = {};
+    instanceLayoutBinding.binding = 2;
+    instanceLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    instanceLayoutBinding.descriptorCount = 1;
+    instanceLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    instanceLayoutBinding.pImmutableSamplers = nullptr;
+
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings = {vpLayoutBinding, modelLayoutBinding, instanceLayoutBinding};
     // Create Descriptor Set Layout with given bindings
     VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
     layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -605,19 +1153,31 @@ void ShaderApplication::createDescriptorSetLayout()
 
     // CREATE TEXTURE SAMPLER DESCRIPTOR SET LAYOUT
 
-    // Texture binding info
+    // Texture binding info. One texture per set, or with bindless textures the array of all of them.
     VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
     samplerLayoutBinding.binding = 0;
     samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    samplerLayoutBinding.descriptorCount = 1;
+    samplerLayoutBinding.descriptorCount = settings.bindlessTextures ? bindlessTextureCapacity : 1;
     samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
     samplerLayoutBinding.pImmutableSamplers = nullptr;
 
+    // Elements past the loaded textures are never written, and new ones are written while frames are in flight.
+    VkDescriptorBindingFlags bindlessFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+        VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCreateInfo = {};
+    bindingFlagsCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlagsCreateInfo.bindingCount = 1;
+    bindingFlagsCreateInfo.pBindingFlags = &bindlessFlags;
+
     // Create a descriptor set layout with given bindings for texture.
     VkDescriptorSetLayoutCreateInfo textureLayoutCreateInfo = {};
     textureLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     textureLayoutCreateInfo.bindingCount = 1;
     textureLayoutCreateInfo.pBindings = &samplerLayoutBinding;
+    if (settings.bindlessTextures) {
+        textureLayoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+        textureLayoutCreateInfo.pNext = &bindingFlagsCreateInfo;
+    }
 
     // Create descriptor set layout.
     result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &textureLayoutCreateInfo, nullptr, &samplerSetLayout);
@@ -657,20 +1217,11 @@ void ShaderApplication::createDescriptorSetLayout()
     }
 }
 
-void ShaderApplication::createPushConstantRange()
-{
-    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-    pushConstantRange.offset = 0;
-    pushConstantRange.size = sizeof(Model);
-}
-
 void ShaderApplication::createGraphicsPipeline()
 {
-    auto vertexShaderCode = readfile("Shaders/vert.spv");
-    auto fragmentShaderCode = readfile("Shaders/frag.spv");
+    auto fragmentShaderCode = readfile(settings.bindlessTextures ? "Shaders/frag_bindless.spv" : "Shaders/frag.spv");
 
-    // Create shader modules
-    VkShaderModule vertexShaderModule = createShaderModule(vertexShaderCode);
+    // Create shader modules. Vertex shaders are per vertex layout, see STAGE 10.
     VkShaderModule fragmentShaderModule = createShaderModule(fragmentShaderCode);
 
     // SHADER STAGE CREATION INFORMATION
@@ -678,7 +1229,6 @@ void ShaderApplication::createGraphicsPipeline()
     VkPipelineShaderStageCreateInfo vertexShaderCreateInfo = {};
     vertexShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     vertexShaderCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertexShaderCreateInfo.module = vertexShaderModule;
     vertexShaderCreateInfo.pName = "main";
 
     // Fragment stage creation information
@@ -688,46 +1238,12 @@ void ShaderApplication::createGraphicsPipeline()
     fragmentShaderCreateInfo.module = fragmentShaderModule;
     fragmentShaderCreateInfo.pName = "main";
 
-    // SHader stage info into array.
-    // Graphics pipeline creation info requires array of shader creates.
-    VkPipelineShaderStageCreateInfo shaderStages[] = { vertexShaderCreateInfo, fragmentShaderCreateInfo };
-
-    //How the data for a single vertex (incl pos, colour, text coord ect) is as a whole.
-    VkVertexInputBindingDescription bindingDescription = {};
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(Vertex);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-    // How the data for an attribute is defined within a vertex
-    std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions;
-
-    // Position attribute
-    attributeDescriptions[0].binding = 0;   //Which binding the data is at.
-    attributeDescriptions[0].location = 0;  //Location in shader where data will be read from.
-    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;   // Format the data will take. Helps define the size og the data.
-    attributeDescriptions[0].offset = offsetof(Vertex, pos);    // Where this attribute is defined in the data for a single vertex.
-
-    // Colour attribute
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[1].offset = offsetof(Vertex, col);
-
-    // Texture attribute
-    attributeDescriptions[2].binding = 0;
-    attributeDescriptions[2].location = 2;
-    attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[2].offset = offsetof(Vertex, tex);
-
 
     //---------CREATE PIPELINE---------------------
     // STAGE 01: Vertex input
+    // Bindings and attributes come from the vertex layout, see STAGE 10.
     VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
     vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
-    vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;
-    vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-    vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
 
     // STAGE 02: Input assembly
@@ -758,13 +1274,15 @@ void ShaderApplication::createGraphicsPipeline()
     viewportStateCrateInfo.pScissors = &scissor;
 
     // STAGE 04: Dynamic States
-    // Dynamic states to enable.
-    /*
+    // Dynamic states to enable. Viewport and scissor follow renderExtent, set in the command buffers.
     std::vector<VkDynamicState> dynamicStateEnables;
     dynamicStateEnables.push_back(VK_DYNAMIC_STATE_VIEWPORT); // Dynamic viewport. Resize in command buffer. vkcmdSetViewport(commandbuffer, 0, 1, &viewport)
     dynamicStateEnables.push_back(VK_DYNAMIC_STATE_SCISSOR); //vkcmdSetScissor(commandbuffer, 0, 1, &scissor)
-    ... See lesson 12.
-    */
+
+    VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = {};
+    dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStateEnables.size());
+    dynamicStateCreateInfo.pDynamicStates = dynamicStateEnables.data();
 
     // STAGE 05: Rasterizer
     // Convert prim to frag on the screen.
@@ -808,12 +1326,18 @@ void ShaderApplication::createGraphicsPipeline()
     // STAGE 08: Pipeline Layout
     std::array<VkDescriptorSetLayout, 2> descriptorSetLayouts = { descriptorSetLayout, samplerSetLayout };
 
+    // Each mesh's dequantization transform followed by its texture index, pushed per draw.
+    VkPushConstantRange dequantizeRange = {};
+    dequantizeRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    dequantizeRange.offset = 0;
+    dequantizeRange.size = sizeof(VertexDequantize) + sizeof(uint32_t);
+
     VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
     pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
     pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts.data();
     pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &dequantizeRange;
 
 
     // Create Pipeline Layout
@@ -836,11 +1360,10 @@ void ShaderApplication::createGraphicsPipeline()
     VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
     pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
     pipelineCreateInfo.stageCount = 2;
-    pipelineCreateInfo.pStages = shaderStages;
     pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
     pipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
     pipelineCreateInfo.pViewportState = &viewportStateCrateInfo;
-    pipelineCreateInfo.pDynamicState = nullptr;
+    pipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
     pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
     pipelineCreateInfo.pMultisampleState = &multisamplingCreateInfo;
     pipelineCreateInfo.pColorBlendState = &colourBlendingCreateInfo;
@@ -852,15 +1375,81 @@ void ShaderApplication::createGraphicsPipeline()
     pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineCreateInfo.basePipelineIndex = -1;
 
-    result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &graphicsPipeline);
-    if (result != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create a graphics pipeline!");
+    // One pipeline per vertex layout. Everything but the vertex input and vertex shader is shared.
+    for (uint32_t layout = 0; layout < VERTEX_LAYOUT_COUNT; layout++)
+    {
+        VkVertexInputBindingDescription bindingDescription = {};
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+        getVertexInputDescription(static_cast<VertexLayout>(layout), &bindingDescription, &attributeDescriptions);
+
+        vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
+        vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+        vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+        auto vertexShaderCode = readfile(getVertexShaderFile(static_cast<VertexLayout>(layout)));
+        VkShaderModule vertexShaderModule = createShaderModule(vertexShaderCode);
+        vertexShaderCreateInfo.module = vertexShaderModule;
+
+        // SHader stage info into array.
+        // Graphics pipeline creation info requires array of shader creates.
+        VkPipelineShaderStageCreateInfo shaderStages[] = { vertexShaderCreateInfo, fragmentShaderCreateInfo };
+        pipelineCreateInfo.pStages = shaderStages;
+
+        result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &graphicsPipelines[layout]);
+        vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create a graphics pipeline!");
+        }
+    }
+
+
+    // GPU culling variants. Transform and dequantization come from the GPU culler's set instead of set 0 and push constants.
+    if (settings.gpuCulling) {
+        std::array<VkDescriptorSetLayout, 3> indirectSetLayouts = { descriptorSetLayout, samplerSetLayout, gpuCuller.getDescriptorSetLayout() };
+
+        VkPipelineLayoutCreateInfo indirectLayoutCreateInfo = {};
+        indirectLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        indirectLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(indirectSetLayouts.size());
+        indirectLayoutCreateInfo.pSetLayouts = indirectSetLayouts.data();
+        indirectLayoutCreateInfo.pushConstantRangeCount = 0;
+        indirectLayoutCreateInfo.pPushConstantRanges = nullptr;
+
+        result = vkCreatePipelineLayout(mainDevice.logicalDevice, &indirectLayoutCreateInfo, nullptr, &indirectPipelineLayout);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create indirect pipeline layout!");
+        }
+        pipelineCreateInfo.layout = indirectPipelineLayout;
+
+        for (uint32_t layout = 0; layout < VERTEX_LAYOUT_COUNT; layout++)
+        {
+            VkVertexInputBindingDescription bindingDescription = {};
+            std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+            getVertexInputDescription(static_cast<VertexLayout>(layout), &bindingDescription, &attributeDescriptions);
+
+            vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
+            vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;
+            vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+            vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+            auto vertexShaderCode = readfile(getVertexShaderFile(static_cast<VertexLayout>(layout), true));
+            VkShaderModule vertexShaderModule = createShaderModule(vertexShaderCode);
+            vertexShaderCreateInfo.module = vertexShaderModule;
+
+            VkPipelineShaderStageCreateInfo shaderStages[] = { vertexShaderCreateInfo, fragmentShaderCreateInfo };
+            pipelineCreateInfo.pStages = shaderStages;
+
+            result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &indirectPipelines[layout]);
+            vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create an indirect graphics pipeline!");
+            }
+        }
     }
 
 
     // Destroy shader modules no longer needed.
     vkDestroyShaderModule(mainDevice.logicalDevice, fragmentShaderModule, nullptr);
-    vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
 
 
 
@@ -921,19 +1510,23 @@ void ShaderApplication::createGraphicsPipeline()
 
 void ShaderApplication::createColourBufferImage()
 {
-    colourBufferImage.resize(swapchainImages.size());
-    colourBufferImageMemory.resize(swapchainImages.size());
-    colourBufferImageView.resize(swapchainImages.size());
+    // Only live inside one render pass, so one per frame in flight is enough (the frame's slot waits for the GPU before reuse).
+    colourBufferImage.resize(settings.framesInFlight);
+    colourBufferImageMemory.resize(settings.framesInFlight);
+    colourBufferImageView.resize(settings.framesInFlight);
 
     VkFormat colourFormat = chooseSupportedFormat(
         { VK_FORMAT_R8G8B8A8_UNORM },
         VK_IMAGE_TILING_OPTIMAL,
         VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
     );
-    for (size_t i = 0; i < swapchainImages.size(); i++)
+    for (size_t i = 0; i < colourBufferImage.size(); i++)
     {
+        // Never stored, tile based GPUs can keep it in tile memory and never back it.
         colourBufferImage[i] = createImage(swapchainExtent.width, swapchainExtent.height, colourFormat, VK_IMAGE_TILING_OPTIMAL,
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &colourBufferImageMemory[i]);
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, MEMORY_ATTACHMENTS,
+            &colourBufferImageMemory[i]);
 
         colourBufferImageView[i] = createImageView(colourBufferImage[i], colourFormat, VK_IMAGE_ASPECT_COLOR_BIT);
     }
@@ -943,34 +1536,60 @@ void ShaderApplication::createColourBufferImage()
 void ShaderApplication::createDepthBufferImage()
 {
 
-    depthBufferImage.resize(swapchainImages.size());
-    depthBufferImageMemory.resize(swapchainImages.size());
-    depthBufferImageView.resize(swapchainImages.size());
+    depthBufferImage.resize(settings.framesInFlight);
+    depthBufferImageMemory.resize(settings.framesInFlight);
+    depthBufferImageView.resize(settings.framesInFlight);
 
+    // No stencil is ever used, so no format carrying one.
     VkFormat depthFormat = chooseSupportedFormat(
-        { VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT },
+        { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM },
         VK_IMAGE_TILING_OPTIMAL,
         VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
 
-    for (size_t i = 0; i < swapchainImages.size(); i++)
+    for (size_t i = 0; i < depthBufferImage.size(); i++)
     {
         depthBufferImage[i] = createImage(swapchainExtent.width, swapchainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL,
-            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthBufferImageMemory[i]);
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, MEMORY_ATTACHMENTS,
+            &depthBufferImageMemory[i]);
 
         depthBufferImageView[i] = createImageView(depthBufferImage[i], depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
     }
 }
 
-void ShaderApplication::createFramebuffers()
+void ShaderApplication::createSceneImages()
 {
-    swapchainFramebuffers.resize(swapchainImages.size());
+    if (!settings.dynamicResolution) return;
+
+    // Full size once, a scale change only changes the region rendered into them.
+    sceneImages.resize(swapchainImages.size());
+    sceneImageMemory.resize(swapchainImages.size());
+    sceneImageViews.resize(swapchainImages.size());
+
+    for (size_t i = 0; i < swapchainImages.size(); i++)
+    {
+        sceneImages[i] = createImage(swapchainExtent.width, swapchainExtent.height, swapchainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_ATTACHMENTS, &sceneImageMemory[i]);
 
-    for (size_t i = 0; i < swapchainFramebuffers.size(); i++) {
+        sceneImageViews[i] = createImageView(sceneImages[i], swapchainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+    }
+}
 
-        std::array<VkImage, 3> attachments = {
-            swapchainImages[i].imageView,
-            colourBufferImageView[i],
-            depthBufferImageView[i]
+void ShaderApplication::createFramebuffers()
+{
+    // Swapchain image and the frame's intermediate attachments, so one for every pair like the command buffers.
+    swapchainFramebuffers.resize(settings.framesInFlight * swapchainImages.size());
+
+    for (size_t index = 0; index < swapchainFramebuffers.size(); index++) {
+        // Same layout as getCommandBufferIndex().
+        size_t frame = index / swapchainImages.size();
+        size_t i = index % swapchainImages.size();
+
+        // Scene image stands in for the swapchain image when the scene gets upscaled afterwards.
+        std::array<VkImageView, 3> attachments = {
+            settings.dynamicResolution ? sceneImageViews[i] : swapchainImages[i].imageView,
+            colourBufferImageView[frame],
+            depthBufferImageView[frame]
         };
 
         VkFramebufferCreateInfo framebufferCreateinfo = {};
@@ -982,7 +1601,7 @@ void ShaderApplication::createFramebuffers()
         framebufferCreateinfo.height = swapchainExtent.height;
         framebufferCreateinfo.layers = 1;
 
-        VkResult result = vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferCreateinfo, nullptr, &swapchainFramebuffers[i]);
+        VkResult result = vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferCreateinfo, nullptr, &swapchainFramebuffers[index]);
 
         if (result != VK_SUCCESS) {
             throw std::runtime_error("Failed to create a framebuffer!");
@@ -1006,8 +1625,49 @@ void ShaderApplication::createCommandPool()
     }
 }
 
+void ShaderApplication::createGpuProfiler()
+{
+    if (!settings.dynamicResolution && settings.gpuProfilePath.empty() && settings.benchmarkPath.empty()) return;
+
+    QueueFamilyIndices indicies = getQueueFamilies(mainDevice.physicalDevice);
+    uint32_t commandBufferCount = settings.framesInFlight * static_cast<uint32_t>(swapchainImages.size());
+
+    if (!gpuProfiler.createGpuProfiler(mainDevice.physicalDevice, mainDevice.logicalDevice, instance, indicies.graphicsFamily,
+        settings.framesInFlight, commandBufferCount, !settings.gpuProfilePath.empty(), debugUtilsEnabled)) {
+        printf("Graphics queue has no timestamps, GPU profiling disabled.\n");
+    }
+}
+
+void ShaderApplication::checkDynamicResolutionSupport()
+{
+    renderExtent = swapchainExtent;
+    if (!settings.dynamicResolution) return;
+
+    // Needs GPU frame times...
+    if (!gpuProfiler.isEnabled()) {
+        printf("No GPU frame times, dynamic resolution disabled.\n");
+        settings.dynamicResolution = false;
+        return;
+    }
+
+    // ...and a linear filtered blit of the swapchain format to upscale.
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice, swapchainImageFormat, &formatProperties);
+    VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+    if ((formatProperties.optimalTilingFeatures & blitFeatures) != blitFeatures) {
+        printf("Swapchain format can't be blitted with linear filtering, dynamic resolution disabled.\n");
+        settings.dynamicResolution = false;
+        return;
+    }
+
+    dynamicResolution = DynamicResolution(settings.targetFrameMs, settings.minResolutionScale, 1.0f);
+}
+
 void ShaderApplication::createCommandBuffers()
 {
+    // Command buffers bake in the frame's uniform ring and the image's framebuffer, so one for every pair.
+    // Framebuffers already exist per pair, indexed the same way (getCommandBufferIndex()).
     commandBuffers.resize(swapchainFramebuffers.size());
 
     VkCommandBufferAllocateInfo cbAllocInfo = {};
@@ -1022,44 +1682,98 @@ void ShaderApplication::createCommandBuffers()
     if (result != VK_SUCCESS) {
         throw std::runtime_error("Failed to allocate commandbuffers!");
     }
+
+    // Nothing recorded yet.
+    recordedSceneVersion.assign(commandBuffers.size(), 0);
+    recordedVisibility.assign(commandBuffers.size(), std::vector<uint8_t>());
+    recordedDrawOrder.assign(commandBuffers.size(), std::vector<uint32_t>());
 }
 
-void ShaderApplication::createSynchronisation()
+void ShaderApplication::createRecordThreads()
 {
+    uint32_t threadCount = settings.recordThreadCount;
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    recordThreadPool.reset(new ThreadPool(threadCount));
+
+    QueueFamilyIndices queueFamilyIndecies = getQueueFamilies(mainDevice.physicalDevice);
+
+    // One pool per thread per primary command buffer. A thread only ever touches its own pools, and a pool is only reset
+    // once the frame using it is no longer in flight.
+    VkCommandPoolCreateInfo poolCreateInfo = {};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolCreateInfo.queueFamilyIndex = queueFamilyIndecies.graphicsFamily;
 
-    imageAvailable.resize(MAX_FRAME_DRAWS);
-    renderFinished.resize(MAX_FRAME_DRAWS);
-    drawFences.resize(MAX_FRAME_DRAWS);
+    secondaryCommandPools.resize(commandBuffers.size());
+    secondaryCommandBuffers.resize(commandBuffers.size());
 
-    // Semaphore creation information
-    VkSemaphoreCreateInfo semaphoreCreateInfo = {};
-    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    for (size_t i = 0; i < commandBuffers.size(); i++)
+    {
+        secondaryCommandPools[i].resize(threadCount);
+        secondaryCommandBuffers[i].resize(threadCount);
+
+        for (uint32_t t = 0; t < threadCount; t++)
+        {
+            VkResult result = vkCreateCommandPool(mainDevice.logicalDevice, &poolCreateInfo, nullptr, &secondaryCommandPools[i][t]);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create a secondary command pool!");
+            }
 
-    VkFenceCreateInfo fenceCreateInfo = {};
-    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+            VkCommandBufferAllocateInfo cbAllocInfo = {};
+            cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            cbAllocInfo.commandPool = secondaryCommandPools[i][t];
+            cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            cbAllocInfo.commandBufferCount = 1;
 
-    for (size_t i = 0; i < MAX_FRAME_DRAWS; i++) {
-        if (vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &imageAvailable[i]) != VK_SUCCESS ||
-            vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &renderFinished[i]) != VK_SUCCESS ||
-            vkCreateFence(mainDevice.logicalDevice, &fenceCreateInfo, nullptr, &drawFences[i]) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to create a semaphore and/or fence!");
+            result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &cbAllocInfo, &secondaryCommandBuffers[i][t]);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Failed to allocate secondary commandbuffers!");
+            }
         }
     }
 }
 
-void ShaderApplication::createTextureSampler()
+void ShaderApplication::destroyRecordThreads()
 {
-    VkSamplerCreateInfo samplerCreateInfo = {};
-    samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-    samplerCreateInfo.magFilter = VK_FILTER_LINEAR;                                 //How to render when image is magnified on screen.
-    samplerCreateInfo.minFilter = VK_FILTER_LINEAR;                                 // WHen image is minified.
-    samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;                // How to handle texture wrap in U (x) direction.
-    samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;                // How to handle texture wrap in V (y) direction.
-    samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;                // How to handle texture wrap in W (z) direction.
-    samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-    samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;                           // The coordinates are normalized (between 0 and 1). unnormalized will be 0 - size of image.
-    samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    for (auto& commandBufferPools : secondaryCommandPools)
+    {
+        for (VkCommandPool pool : commandBufferPools)
+        {
+            vkDestroyCommandPool(mainDevice.logicalDevice, pool, nullptr);
+        }
+    }
+    secondaryCommandPools.clear();
+    secondaryCommandBuffers.clear();
+
+    recordThreadPool.reset();
+
+    // Primaries still reference the destroyed secondaries.
+    markSceneDirty();
+}
+
+void ShaderApplication::createSynchronisation()
+{
+    frameArenas.assign(settings.framesInFlight, FrameArena(FRAME_ARENA_SIZE));
+
+    frameScheduler.createFrameScheduler(mainDevice.logicalDevice, settings.framesInFlight,
+        static_cast<uint32_t>(swapchainImages.size()), !settings.headless);
+}
+
+void ShaderApplication::createTextureSampler()
+{
+    VkSamplerCreateInfo samplerCreateInfo = {};
+    samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerCreateInfo.magFilter = VK_FILTER_LINEAR;                                 //How to render when image is magnified on screen.
+    samplerCreateInfo.minFilter = VK_FILTER_LINEAR;                                 // WHen image is minified.
+    samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;                // How to handle texture wrap in U (x) direction.
+    samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;                // How to handle texture wrap in V (y) direction.
+    samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;                // How to handle texture wrap in W (z) direction.
+    samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;                           // The coordinates are normalized (between 0 and 1). unnormalized will be 0 - size of image.
+    samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerCreateInfo.mipLodBias = 0.0f;
     samplerCreateInfo.minLod = 0.0f;
     samplerCreateInfo.maxLod = 0.0f;
@@ -1078,26 +1792,19 @@ void ShaderApplication::createTextureSampler()
 
 void ShaderApplication::createUniformBuffers()
 {
-    VkDeviceSize vpBufferSize= sizeof(UboViewProjection);
-    //VkDeviceSize modelBufferSize = modelUniformAlignment * MAX_OBJECTS;
-
-
-    // One uniform buffer for each image (and by extension, command buffer)
-    vpUniformBuffer.resize(swapchainImages.size());
-    vpUniformBufferMemory.resize(swapchainImages.size());
-    //modelDynUniformBuffer.resize(swapchainImages.size());
-    //modelDynUniformBufferMemory.resize(swapchainImages.size());
-
-    // Create uniform buffer.
-    for (size_t i = 0; i < swapchainImages.size(); i++) 
+    // One ring per frame in flight, large enough for the view projection and every model's transform.
+    frameUniformRing.createFrameUniformRing(&deviceAllocator, mainDevice.physicalDevice, FRAME_UNIFORM_RING_SIZE,
+        settings.framesInFlight, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+
+    // Instance transforms. Kept apart from the ring, they are only rewritten when an instance changed.
+    instanceBuffers.resize(settings.framesInFlight);
+    instanceBufferAllocations.resize(settings.framesInFlight);
+    instanceBufferVersions.assign(settings.framesInFlight, 0);
+    for (size_t i = 0; i < settings.framesInFlight; i++)
     {
-        createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, vpBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &vpUniformBuffer[i], &vpUniformBufferMemory[i]);
-
-        //createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, modelBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            //VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &modelDynUniformBuffer[i], &modelDynUniformBufferMemory[i]);
+        deviceAllocator.createBuffer(MAX_INSTANCES * sizeof(glm::mat4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MEMORY_UNIFORMS, &instanceBuffers[i], &instanceBufferAllocations[i]);
     }
-
 }
 
 void ShaderApplication::createDescriptorPool()
@@ -1106,21 +1813,23 @@ void ShaderApplication::createDescriptorPool()
     // CREATE UNIFORM DESCRIPTOR POOL.
 
     // Types of descriptors and how many descriptors (not descriptor sets)
-    VkDescriptorPoolSize vpPoolSize = {};
-    vpPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    vpPoolSize.descriptorCount = static_cast<uint32_t>(vpUniformBuffer.size());
+    // View projection and model, per frame in flight.
+    VkDescriptorPoolSize uniformPoolSize = {};
+    uniformPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    uniformPoolSize.descriptorCount = 2 * settings.framesInFlight;
 
-    VkDescriptorPoolSize modelPoolSize = {};
-    modelPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-    modelPoolSize.descriptorCount = static_cast<uint32_t>(modelDynUniformBuffer.size());
+    // Instance transforms, per frame in flight.
+    VkDescriptorPoolSize instancePoolSize = {};
+    instancePoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    instancePoolSize.descriptorCount = settings.framesInFlight;
 
     //List of Pool Sizes
-    std::vector<VkDescriptorPoolSize> descriptorPoolSizes = {vpPoolSize}; //{vpPoolSize, modelPoolSize} when enabling dynamic uniform buffer.
+    std::vector<VkDescriptorPoolSize> descriptorPoolSizes = {uniformPoolSize, instancePoolSize};
 
     // Data to create Descriptor Pool
     VkDescriptorPoolCreateInfo poolCreateInfo = {};
     poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolCreateInfo.maxSets = static_cast<uint32_t>(swapchainImages.size());
+    poolCreateInfo.maxSets = settings.framesInFlight;
     poolCreateInfo.poolSizeCount = static_cast<uint32_t>(descriptorPoolSizes.size());
     poolCreateInfo.pPoolSizes = descriptorPoolSizes.data();
 
@@ -1132,14 +1841,15 @@ void ShaderApplication::createDescriptorPool()
     }
 
     // CREATE SAMPLER DESCRIPTOR POOL
-    // Texture sampler pool
+    // Texture sampler pool. A set per texture, or the one bindless set.
     VkDescriptorPoolSize samplerPoolSize = {};
     samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    samplerPoolSize.descriptorCount = MAX_OBJECTS;
+    samplerPoolSize.descriptorCount = settings.bindlessTextures ? bindlessTextureCapacity : MAX_TEXTURES;
 
     VkDescriptorPoolCreateInfo samlerPoolCreateInfo = {};
     samlerPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    samlerPoolCreateInfo.maxSets = MAX_OBJECTS;
+    samlerPoolCreateInfo.flags = settings.bindlessTextures ? VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT : 0;
+    samlerPoolCreateInfo.maxSets = settings.bindlessTextures ? 1 : MAX_TEXTURES;
     samlerPoolCreateInfo.poolSizeCount = 1;
     samlerPoolCreateInfo.pPoolSizes = &samplerPoolSize;
 
@@ -1150,6 +1860,20 @@ void ShaderApplication::createDescriptorPool()
         throw std::runtime_error("Failed to create a sampler descriptor pool!");
     }
 
+    if (settings.bindlessTextures) {
+        VkDescriptorSetAllocateInfo bindlessAllocInfo = {};
+        bindlessAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        bindlessAllocInfo.descriptorPool = samplerDescriptorPool;
+        bindlessAllocInfo.descriptorSetCount = 1;
+        bindlessAllocInfo.pSetLayouts = &samplerSetLayout;
+
+        result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &bindlessAllocInfo, &bindlessDescriptorSet);
+        if (result != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate the bindless texture descriptor set!");
+        }
+    }
+
     // Create Input Attachment Descriptor Pool
     // Color Attachment Pool Size.
     VkDescriptorPoolSize colourInputPoolSize = {};
@@ -1166,7 +1890,7 @@ void ShaderApplication::createDescriptorPool()
     // Ctreate input attachment pool
     VkDescriptorPoolCreateInfo inputPoolCreateInfo = {};
     inputPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    inputPoolCreateInfo.maxSets = swapchainImages.size();
+    inputPoolCreateInfo.maxSets = settings.framesInFlight;
     inputPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(inputPoolSizes.size());
     inputPoolCreateInfo.pPoolSizes = inputPoolSizes.data();
 
@@ -1181,15 +1905,15 @@ void ShaderApplication::createDescriptorPool()
 
 void ShaderApplication::createDescriptorSets()
 {
-    // Resize Descriptor Set list, so one for every buffer.
-    descriptorSets.resize(swapchainImages.size());
+    // Resize Descriptor Set list, so one for every frame in flight.
+    descriptorSets.resize(settings.framesInFlight);
 
-    std::vector<VkDescriptorSetLayout> setLayouts(swapchainImages.size(), descriptorSetLayout);
+    std::vector<VkDescriptorSetLayout> setLayouts(settings.framesInFlight, descriptorSetLayout);
 
     VkDescriptorSetAllocateInfo setAllocInfo = {};
     setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     setAllocInfo.descriptorPool = descriptorPool;
-    setAllocInfo.descriptorSetCount = static_cast<uint32_t>(swapchainImages.size());
+    setAllocInfo.descriptorSetCount = settings.framesInFlight;
     setAllocInfo.pSetLayouts = setLayouts.data();
 
     //Allocate descriptos sets (multiple)
@@ -1200,12 +1924,13 @@ void ShaderApplication::createDescriptorSets()
     }
 
     // Updatte all of descriptor set buffer bindings.
-    for (size_t i = 0; i < swapchainImages.size(); i++)
+    // Both point at the start of the frame's ring, the dynamic offsets pick the region when binding.
+    for (size_t i = 0; i < settings.framesInFlight; i++)
     {
 
         //VIEW PROJECTION DESCRIPTOR
         VkDescriptorBufferInfo vpBufferInfo = {};
-        vpBufferInfo.buffer = vpUniformBuffer[i];
+        vpBufferInfo.buffer = frameUniformRing.getBuffer(i);
         vpBufferInfo.offset = 0;
         vpBufferInfo.range = sizeof(UboViewProjection);
 
@@ -1214,15 +1939,15 @@ void ShaderApplication::createDescriptorSets()
         vpSetWrite.dstSet = descriptorSets[i];
         vpSetWrite.dstBinding = 0;
         vpSetWrite.dstArrayElement = 0;
-        vpSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        vpSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         vpSetWrite.descriptorCount = 1;
         vpSetWrite.pBufferInfo = &vpBufferInfo;
 
         // MODEL DESCRIPTOR
-        /*VkDescriptorBufferInfo modelBufferInfo = {};
-        modelBufferInfo.buffer = modelDynUniformBuffer[i];
+        VkDescriptorBufferInfo modelBufferInfo = {};
+        modelBufferInfo.buffer = frameUniformRing.getBuffer(i);
         modelBufferInfo.offset = 0;
-        modelBufferInfo.range = modelUniformAlignment;
+        modelBufferInfo.range = sizeof(Model);
 
         VkWriteDescriptorSet modelSetWrite = {};
         modelSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -1231,10 +1956,25 @@ void ShaderApplication::createDescriptorSets()
         modelSetWrite.dstArrayElement = 0;
         modelSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         modelSetWrite.descriptorCount = 1;
-        modelSetWrite.pBufferInfo = &modelBufferInfo;*/
+        modelSetWrite.pBufferInfo = &modelBufferInfo;
+
+        // INSTANCE DESCRIPTOR
+        VkDescriptorBufferInfo instanceBufferInfo = {};
+        instanceBufferInfo.buffer = instanceBuffers[i];
+        instanceBufferInfo.offset = 0;
+        instanceBufferInfo.range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet instanceSetWrite = {};
+        instanceSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        instanceSetWrite.dstSet = descriptorSets[i];
+        instanceSetWrite.dstBinding = 2;
+        instanceSetWrite.dstArrayElement = 0;
+        instanceSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        instanceSetWrite.descriptorCount = 1;
+        instanceSetWrite.pBufferInfo = &instanceBufferInfo;
 
         // List of descriptor set writes
-        std::vector<VkWriteDescriptorSet> setWrites = {vpSetWrite}; //{vpSetWrite, modelSetWrite}
+        std::vector<VkWriteDescriptorSet> setWrites = {vpSetWrite, modelSetWrite, instanceSetWrite};
 
         vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
     }
@@ -1243,16 +1983,16 @@ void ShaderApplication::createDescriptorSets()
 
 void ShaderApplication::createInputDescriptorSets()
 {
-    // Resize array to hold descriptor set for each swap chain image.
-    inputDescriptorSets.resize(swapchainImages.size());
+    // Resize array to hold descriptor set for each frame in flight, like the attachments they point at.
+    inputDescriptorSets.resize(settings.framesInFlight);
 
     // Fill Array of layouts ready for set creation
-    std::vector<VkDescriptorSetLayout> setLayouts(swapchainImages.size(), inputSetLayout);
+    std::vector<VkDescriptorSetLayout> setLayouts(settings.framesInFlight, inputSetLayout);
 
     VkDescriptorSetAllocateInfo setAllocInfo = {};
     setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     setAllocInfo.descriptorPool  = inputDescriptorPool;
-    setAllocInfo.descriptorSetCount = static_cast<uint32_t>(swapchainImages.size());
+    setAllocInfo.descriptorSetCount = settings.framesInFlight;
     setAllocInfo.pSetLayouts = setLayouts.data();
 
     //Allocate descriptr sets
@@ -1263,7 +2003,7 @@ void ShaderApplication::createInputDescriptorSets()
     }
 
     // Update each descriptor set with inout attachment.
-    for (size_t i = 0; i < swapchainImages.size(); i++)
+    for (size_t i = 0; i < inputDescriptorSets.size(); i++)
     {
         // Colour Attachment Descriptor
         VkDescriptorImageInfo colourAttachmentDescriptor = {};
@@ -1305,38 +2045,312 @@ void ShaderApplication::createInputDescriptorSets()
     }
 }
 
-void ShaderApplication::updateUniformBuffers(uint32_t imageIndex)
+void ShaderApplication::updateUniformBuffers()
 {
+    PROFILE_ZONE("updateUniformBuffers");
+
+    // This frame is no longer in flight, start its ring from the beginning.
+    frameUniformRing.beginFrame(currentFrame);
+
     // copy vp data
-    void * data;
-    vkMapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex], 0, sizeof(UboViewProjection), 0, &data);
-    memcpy(data, &uboViewProjection, sizeof(UboViewProjection));
-    vkUnmapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex]);
+    vpUniformOffset = frameUniformRing.allocate(sizeof(UboViewProjection));
+    memcpy(frameUniformRing.getMapped(vpUniformOffset), &uboViewProjection, sizeof(UboViewProjection));
 
     // copy model data
-    /*for (size_t i = 0; i < meshList.size(); i++)
+    for (size_t i = 0; i < modelList.size(); i++)
+    {
+        Model model = { modelList[i].getModel() };
+
+        modelUniformOffsets[i] = frameUniformRing.allocate(sizeof(Model));
+        memcpy(frameUniformRing.getMapped(modelUniformOffsets[i]), &model, sizeof(Model));
+    }
+
+    updateInstanceBuffer();
+
+    // The cull pass and the indirect vertex shader read frustum and transforms from the GPU culler's frame buffer.
+    if (settings.gpuCulling) {
+        gpuCuller.beginFrame(currentFrame, uboViewProjection.projection * uboViewProjection.view);
+        for (size_t i = 0; i < modelList.size(); i++)
+        {
+            gpuCuller.setTransform(static_cast<uint32_t>(i), modelList[i].getModel());
+        }
+    }
+}
+
+void ShaderApplication::updateInstanceBuffer()
+{
+    // Set dressing rarely moves. A frame's copy is only rewritten when it's older than the last instance change.
+    if (instanceBufferVersions[currentFrame] == instanceVersion) return;
+
+    PROFILE_ZONE("updateInstanceBuffer");
+
+    // Models' instances back to back, in model order.
+    glm::mat4* instances = static_cast<glm::mat4*>(instanceBufferAllocations[currentFrame].mapped);
+    for (size_t i = 0; i < modelList.size(); i++)
+    {
+        const std::vector<glm::mat4>& modelInstances = modelList[i].getInstances();
+        memcpy(instances + modelFirstInstances[i], modelInstances.data(), modelInstances.size() * sizeof(glm::mat4));
+    }
+
+    instanceBufferVersions[currentFrame] = instanceVersion;
+}
+
+void ShaderApplication::cullMeshes()
+{
+    PROFILE_ZONE("cullMeshes");
+
+    // World boxes of every mesh (around all of its model's instances), in draw list order, against this frame's view projection.
+    frustumCuller.begin(uboViewProjection.projection * uboViewProjection.view);
+    for (size_t j = 0; j < modelList.size(); j++)
+    {
+        glm::mat4 model = modelList[j].getModel();
+        for (size_t k = 0; k < modelList[j].getMeshCount(); k++)
+        {
+            frustumCuller.addBox(modelList[j].getInstanceBounds(k), model);
+        }
+    }
+
+    meshVisibility.resize(frustumCuller.getBoxCount());
+    size_t visible = frustumCuller.cull(meshVisibility.data());
+
+    visibleMeshes += visible;
+    culledMeshes += meshVisibility.size() - visible;
+    frustumCullFrames++;
+}
+
+void ShaderApplication::sortDraws()
+{
+    PROFILE_ZONE("sortDraws");
+
+    size_t meshCount = 0;
+    for (size_t j = 0; j < modelList.size(); j++)
+    {
+        meshCount += modelList[j].getMeshCount();
+    }
+    if (meshCount > RENDER_QUEUE_MAX_DRAWS) {
+        throw std::runtime_error("Failed to fit the scene into the render queue!");
+    }
+    bool skipCulled = settings.frustumCulling && meshVisibility.size() == meshCount;
+
+    // One key per visible mesh. Depth is the view depth of the nearest point of the mesh's world bounding sphere
+    // (around all of its model's instances). With bindless textures a texture switch is only a push constant, so draws
+    // group by model instead, whose transform offset rebinds set 0.
+    uint64_t* keys = frameArenas[currentFrame].allocateArray<uint64_t>(meshCount);
+    uint64_t* scratch = frameArenas[currentFrame].allocateArray<uint64_t>(meshCount);
+    size_t keyCount = 0;
+    size_t meshIndex = 0;
+    for (size_t j = 0; j < modelList.size(); j++)
+    {
+        glm::mat4 model = modelList[j].getModel();
+        for (size_t k = 0; k < modelList[j].getMeshCount(); k++, meshIndex++)
+        {
+            if (skipCulled && !meshVisibility[meshIndex]) continue;
+
+            Mesh* mesh = modelList[j].getMesh(k);
+            MeshBounds bounds = transformBounds(modelList[j].getInstanceBounds(k), model);
+            float depth = -(uboViewProjection.view * glm::vec4(bounds.sphereCenter, 1.0f)).z - bounds.sphereRadius;
+            uint32_t texture = settings.bindlessTextures ? static_cast<uint32_t>(j) : static_cast<uint32_t>(mesh->getTexId());
+            keys[keyCount++] = makeDrawKey(mesh->getVertexLayout(), mesh->getIndexType(), texture, depth, static_cast<uint32_t>(meshIndex));
+        }
+    }
+
+    radixSortKeys(keys, scratch, keyCount);
+
+    drawOrder.resize(keyCount);
+    for (size_t i = 0; i < keyCount; i++)
+    {
+        drawOrder[i] = getDrawKeyIndex(keys[i]);
+    }
+}
+
+void ShaderApplication::buildGpuDraws()
+{
+    PROFILE_ZONE("buildGpuDraws");
+
+    // Only when meshes or instances are added, not per frame. Each mesh is culled by the bounds of all its instances.
+    gpuCuller.clearDraws();
+    gpuModelFirstDraws.resize(modelList.size());
+    uint32_t draw = 0;
+    for (size_t j = 0; j < modelList.size(); j++)
+    {
+        gpuModelFirstDraws[j] = draw;
+        for (size_t k = 0; k < modelList[j].getMeshCount(); k++)
+        {
+            gpuCuller.addDraw(modelList[j].getMesh(k), modelList[j].getInstanceBounds(k), static_cast<uint32_t>(j),
+                modelFirstInstances[j], modelList[j].getInstanceCount());
+            draw++;
+        }
+    }
+    gpuCuller.finishDraws();
+    gpuDrawVersion = sceneVersion;
+
+    // Built from the current bounds, nothing left to refresh.
+    gpuModelBoundsDirty.assign(modelList.size(), 0);
+    gpuBoundsDirtyModels.clear();
+    gpuBoundsDirtyModels.reserve(modelList.size());
+}
+
+void ShaderApplication::updateGpuDrawBounds()
+{
+    PROFILE_ZONE("updateGpuDrawBounds");
+
+    // Instances moved: only the moved models' spheres change, batches and command slots stay as they are.
+    for (uint32_t modelID : gpuBoundsDirtyModels)
+    {
+        for (size_t k = 0; k < modelList[modelID].getMeshCount(); k++)
+        {
+            gpuCuller.setDrawBounds(gpuModelFirstDraws[modelID] + static_cast<uint32_t>(k), modelList[modelID].getInstanceBounds(k));
+        }
+        gpuModelBoundsDirty[modelID] = 0;
+    }
+    gpuBoundsDirtyModels.clear();
+}
+
+void ShaderApplication::updateResolution()
+{
+    if (!settings.dynamicResolution) return;
+
+    double lastGpuFrameMs = gpuProfiler.getLastFrameMs();
+    if (dynamicResolution.update(lastGpuFrameMs)) {
+        // Render area is baked into the command buffers.
+        markSceneDirty();
+
+        VkExtent2D extent = dynamicResolution.getExtent(swapchainExtent);
+        printf("Dynamic resolution: GPU %.2f ms, scale %.2f (%ux%u)\n", lastGpuFrameMs, dynamicResolution.getScale(),
+            extent.width, extent.height);
+    }
+}
+
+void ShaderApplication::writeGpuProfile()
+{
+    // Collect the frames still waiting for their slot to come round again.
+    vkDeviceWaitIdle(mainDevice.logicalDevice);
+    for (uint32_t i = 0; i < settings.framesInFlight; i++)
     {
-        UboModel * thisModel = (UboModel *)((uint64_t)modelTransferSpace  + (i * modelUniformAlignment));
-        * thisModel = meshList[i].getModel();
+        gpuProfiler.collect(i);
     }
 
-    // Map the list of model data.
-    vkMapMemory(mainDevice.logicalDevice, modelDynUniformBufferMemory[imageIndex], 0, modelUniformAlignment * meshList.size(), 0, &data);
-    memcpy(data, modelTransferSpace, modelUniformAlignment * meshList.size());
-    vkUnmapMemory(mainDevice.logicalDevice, modelDynUniformBufferMemory[imageIndex]);*/
+    gpuProfiler.writeCsv(settings.gpuProfilePath + ".csv");
+    gpuProfiler.writeChromeTrace(settings.gpuProfilePath + ".json");
+    printf("GPU profile written to %s.csv and %s.json\n", settings.gpuProfilePath.c_str(), settings.gpuProfilePath.c_str());
+}
+
+void ShaderApplication::writeCpuProfile()
+{
+    if (!CpuProfiler::isCompiledIn()) {
+        printf("CPU profiler not compiled in, define ENABLE_CPU_PROFILER to record zones.\n");
+        return;
+    }
 
+    CpuProfiler::writeChromeTrace(settings.cpuProfilePath);
+    printf("CPU profile written to %s\n", settings.cpuProfilePath.c_str());
+}
+
+void ShaderApplication::saveOffscreenImage(std::string fileName)
+{
+    vkDeviceWaitIdle(mainDevice.logicalDevice);
+
+    VkImage image = swapchainImages[lastImageIndex].image;
+    VkDeviceSize imageSize = swapchainExtent.width * swapchainExtent.height * 4;
+
+    // Host visible buffer to copy the final frame into.
+    VkBuffer readbackBuffer;
+    DeviceAllocation readbackBufferAllocation;
+    deviceAllocator.createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MEMORY_STAGING, &readbackBuffer, &readbackBufferAllocation);
+
+    VkCommandBuffer commandBuffer = beginCommandBuffer(mainDevice.logicalDevice, graphicsCommandPool);
+
+    // Render pass (or upscale blit) left the image in TRANSFER_SRC, only need to make its writes visible to the copy.
+    VkImageMemoryBarrier imageBarrier = {};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    imageBarrier.image = image;
+    imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageBarrier.subresourceRange.baseMipLevel = 0;
+    imageBarrier.subresourceRange.levelCount = 1;
+    imageBarrier.subresourceRange.baseArrayLayer = 0;
+    imageBarrier.subresourceRange.layerCount = 1;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+    VkBufferImageCopy imageRegion = {};
+    imageRegion.bufferOffset = 0;
+    imageRegion.bufferRowLength = 0;
+    imageRegion.bufferImageHeight = 0;
+    imageRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageRegion.imageSubresource.mipLevel = 0;
+    imageRegion.imageSubresource.baseArrayLayer = 0;
+    imageRegion.imageSubresource.layerCount = 1;
+    imageRegion.imageOffset = { 0, 0, 0 };
+    imageRegion.imageExtent = { swapchainExtent.width, swapchainExtent.height, 1 };
+
+    vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &imageRegion);
+
+    // Make the copy visible to the host before mapping.
+    VkBufferMemoryBarrier bufferBarrier = {};
+    bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.buffer = readbackBuffer;
+    bufferBarrier.offset = 0;
+    bufferBarrier.size = imageSize;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+        0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+    endSubmitDestroyCommandBuffer(mainDevice.logicalDevice, graphicsCommandPool, graphicQueue, commandBuffer);
+
+    // Write out as binary PPM, dropping alpha. Readback memory is mapped by the allocator.
+    const uint8_t * pixels = static_cast<const uint8_t *>(readbackBufferAllocation.mapped);
+
+    std::ofstream file(fileName, std::ios::binary);
+    if (!file.is_open()) {
+        deviceAllocator.destroyBuffer(readbackBuffer, readbackBufferAllocation);
+        throw std::runtime_error("Failed to open output image! (" + fileName + ")");
+    }
+
+    file << "P6\n" << swapchainExtent.width << " " << swapchainExtent.height << "\n255\n";
+    for (size_t i = 0; i < (size_t)swapchainExtent.width * swapchainExtent.height; i++)
+    {
+        file.write(reinterpret_cast<const char *>(&pixels[i * 4]), 3);
+    }
+    file.close();
+
+    deviceAllocator.destroyBuffer(readbackBuffer, readbackBufferAllocation);
+}
+
+uint32_t ShaderApplication::getCommandBufferIndex(uint32_t frame, uint32_t image)
+{
+    return frame * static_cast<uint32_t>(swapchainImages.size()) + image;
 }
 
 void ShaderApplication::recordCommands(uint32_t currentImage)
 {
+    PROFILE_ZONE("recordCommands");
+
+    uint32_t commandBufferIndex = getCommandBufferIndex(currentFrame, currentImage);
+    VkCommandBuffer commandBuffer = commandBuffers[commandBufferIndex];
+
     VkCommandBufferBeginInfo bufferBeginInfo = {};
     bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
     VkRenderPassBeginInfo renderpassBeginInfo = {}; //Only need this info struct for graphical applications.
     renderpassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderpassBeginInfo.renderPass = renderPass;
+    // Only the scaled region is rendered, targets stay full size.
+    renderExtent = settings.dynamicResolution ? dynamicResolution.getExtent(swapchainExtent) : swapchainExtent;
+
     renderpassBeginInfo.renderArea.offset = {0,0};
-    renderpassBeginInfo.renderArea.extent = swapchainExtent;
+    renderpassBeginInfo.renderArea.extent = renderExtent;
 
     std::array<VkClearValue, 3> clearValues = {};
     clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f};
@@ -1346,77 +2360,530 @@ void ShaderApplication::recordCommands(uint32_t currentImage)
     renderpassBeginInfo.pClearValues = clearValues.data();
     renderpassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
 
-    renderpassBeginInfo.framebuffer = swapchainFramebuffers[currentImage];
-    VkResult result = vkBeginCommandBuffer(commandBuffers[currentImage], &bufferBeginInfo);
-    if (result != VK_SUCCESS) {
-        throw std::runtime_error("Failes to start recording a commandbuffer!");
+    renderpassBeginInfo.framebuffer = swapchainFramebuffers[commandBufferIndex];
+
+    // Flatten the scene so it can be split evenly between the recording threads, however meshes are spread over models.
+    // Only needed while recording, so it goes in this frame's arena. Meshes the frustum cull rejected are left out.
+    size_t meshCount = 0;
+    for (size_t j = 0; j < modelList.size(); j++)
+    {
+        meshCount += modelList[j].getMeshCount();
+    }
+    // With GPU culling subpass 0 draws the GPU culler's batches instead.
+    if (settings.gpuCulling) {
+        meshCount = 0;
     }
+    bool skipCulled = settings.frustumCulling && meshVisibility.size() == meshCount;
 
-    // Begin renderpass
-    vkCmdBeginRenderPass(commandBuffers[currentImage], &renderpassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    drawCount = 0;
+    for (size_t m = 0; m < meshCount; m++)
+    {
+        drawCount += skipCulled ? meshVisibility[m] : 1;
+    }
 
-    // Bind pipeline to be used in renderpass
-    vkCmdBindPipeline(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+    drawList = frameArenas[currentFrame].allocateArray<DrawItem>(drawCount);
+    if (settings.sortDraws && drawOrder.size() == drawCount) {
+        // Sorted: drawOrder holds the same visible meshes, as indices into every mesh of every model.
+        DrawItem* meshItems = frameArenas[currentFrame].allocateArray<DrawItem>(meshCount);
+        size_t meshIndex = 0;
+        for (size_t j = 0; j < modelList.size(); j++)
+        {
+            for (size_t k = 0; k < modelList[j].getMeshCount(); k++, meshIndex++)
+            {
+                meshItems[meshIndex] = { static_cast<uint32_t>(j), static_cast<uint32_t>(k) };
+            }
+        }
+        for (size_t i = 0; i < drawCount; i++)
+        {
+            drawList[i] = meshItems[drawOrder[i]];
+        }
+    }
+    else {
+        size_t drawIndex = 0;
+        size_t meshIndex = 0;
+        for (size_t j = 0; j < modelList.size(); j++)
+        {
+            for (size_t k = 0; k < modelList[j].getMeshCount(); k++, meshIndex++)
+            {
+                if (skipCulled && !meshVisibility[meshIndex]) continue;
+                drawList[drawIndex++] = { static_cast<uint32_t>(j), static_cast<uint32_t>(k) };
+            }
+        }
+    }
 
-    for (size_t j = 0; j < modelList.size(); j++)
+    // Cluster culling views, model space, so the threads test meshlets without transforming their bounds.
+    // Meshlets are only tested for models with a single instance, more are drawn whole.
+    size_t threadCount = secondaryCommandBuffers[commandBufferIndex].size();
+    threadBindStats = frameArenas[currentFrame].allocateArray<BindStats>(threadCount);
+    for (size_t t = 0; t < threadCount; t++)
     {
+        threadBindStats[t] = BindStats();
+    }
+    modelCullViews = nullptr;
+    threadCullStats = nullptr;
+    if (settings.clusterCulling) {
+        glm::mat4 viewProjection = uboViewProjection.projection * uboViewProjection.view;
+        glm::vec3 cameraPosition = glm::vec3(glm::inverse(uboViewProjection.view)[3]);
 
+        modelCullViews = frameArenas[currentFrame].allocateArray<ClusterCullView>(modelList.size());
+        for (size_t j = 0; j < modelList.size(); j++)
+        {
+            modelCullViews[j] = makeClusterCullView(viewProjection, modelList[j].getModel() * modelList[j].getInstances()[0], cameraPosition);
+        }
 
-        MeshModel thisModel = modelList[j];
+        threadCullStats = frameArenas[currentFrame].allocateArray<ClusterCullStats>(threadCount);
+        for (size_t t = 0; t < threadCount; t++)
+        {
+            threadCullStats[t] = ClusterCullStats();
+        }
+    }
 
-        glm::mat4 matModel = thisModel.getModel(); // no pointer
+    // GPU scopes. Reserved here, before the threads start, so every thread knows its own scope indices.
+    gpuProfiler.beginRecording(commandBufferIndex);
+    uint32_t frameScope = gpuProfiler.reserveScopes(commandBufferIndex, 1);
+    uint32_t aovScope = GpuProfiler::NO_SCOPE;
+    uint32_t cullScope = GpuProfiler::NO_SCOPE;
+    subpassScope = GpuProfiler::NO_SCOPE;
+    threadModelScopes = nullptr;
 
-        vkCmdPushConstants(
-            commandBuffers[currentImage],
-            pipelineLayout,
-            VK_SHADER_STAGE_VERTEX_BIT,
-            0,
-            sizeof(Model),
-            &matModel);
+    if (gpuProfiler.isCapturing()) {
+        subpassScope = gpuProfiler.reserveScopes(commandBufferIndex, 1);
+        aovScope = gpuProfiler.reserveScopes(commandBufferIndex, 1);
+        if (settings.gpuCulling) {
+            cullScope = gpuProfiler.reserveScopes(commandBufferIndex, 1);
+        }
 
-        for (size_t k = 0; k < thisModel.getMeshCount(); k++)
+        // One scope per run of a model's meshes in a thread's share of the draw list.
+        threadModelScopes = frameArenas[currentFrame].allocateArray<uint32_t>(threadCount);
+        for (size_t t = 0; t < threadCount; t++)
         {
-  
+            size_t firstDraw = drawCount * t / threadCount;
+            size_t lastDraw = drawCount * (t + 1) / threadCount;
 
-            VkBuffer vertexBuffers[] = { thisModel.getMesh(k)->getVertexBuffer() };   // Buffers to bind
-            VkDeviceSize offsets[] = { 0 };     //Offsets into buffers being bound.
-            vkCmdBindVertexBuffers(commandBuffers[currentImage], 0, 1, vertexBuffers, offsets);    //Command to bind vertex buffer before drawing with them.
+            uint32_t groupCount = 0;
+            for (size_t i = firstDraw; i < lastDraw; i++)
+            {
+                if (i == firstDraw || drawList[i].model != drawList[i - 1].model) {
+                    groupCount++;
+                }
+            }
+            threadModelScopes[t] = gpuProfiler.reserveScopes(commandBufferIndex, groupCount);
+        }
+    }
 
-            // Bind mesh index buffer with 0 offset and using uint32 type.
-            vkCmdBindIndexBuffer(commandBuffers[currentImage], thisModel.getMesh(k)->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+    // Record subpass 0 into the secondary command buffers, one per thread.
+    RecordContext recordContext = { this, currentImage };
+    recordThreadPool->dispatch(recordSceneDrawsJob, &recordContext);
 
-            // Dynamic Offset Amount
-            //uint32_t dynamicOffset = static_cast<uint32_t>(modelUniformAlignment) * j;
+    if (drawCount > 0) {
+        for (size_t t = 0; t < threadCount; t++)
+        {
+            bindTotals.binds += threadBindStats[t].binds;
+            bindTotals.skipped += threadBindStats[t].skipped;
+        }
+        bindRecordings++;
+    }
+
+    if (threadCullStats) {
+        for (size_t t = 0; t < threadCount; t++)
+        {
+            clusterCullTotals.visible += threadCullStats[t].visible;
+            clusterCullTotals.backfacing += threadCullStats[t].backfacing;
+            clusterCullTotals.outsideFrustum += threadCullStats[t].outsideFrustum;
+            clusterCullTotals.draws += threadCullStats[t].draws;
+        }
+        clusterCullRecordings++;
+    }
 
-            std::array<VkDescriptorSet, 2> descriptorSetGroup = { descriptorSets[currentImage],
-                samplerDescriptorSets[thisModel.getMesh(k)->getTexId()] };
+    VkResult result = vkBeginCommandBuffer(commandBuffer, &bufferBeginInfo);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failes to start recording a commandbuffer!");
+    }
 
-            // Bind Descriptor Sets
-            vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
-                0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 0, nullptr);
+    gpuProfiler.resetQueries(commandBuffer, currentFrame, commandBufferIndex);
+    gpuProfiler.beginScope(commandBuffer, currentFrame, commandBufferIndex, frameScope, "Frame");
 
-            // Execute our pipeline
-            vkCmdDrawIndexed(commandBuffers[currentImage], thisModel.getMesh(k)->getIndexCount(), 1, 0, 0, 0);
-        }
+    // Indirect draws of subpass 0 are written before the render pass starts.
+    if (settings.gpuCulling) {
+        gpuProfiler.beginScope(commandBuffer, currentFrame, commandBufferIndex, cullScope, "GPU cull");
+        gpuCuller.recordCull(commandBuffer, currentFrame);
+        gpuProfiler.endScope(commandBuffer, currentFrame, cullScope);
     }
 
+    // Begin renderpass. Subpass 0 content comes from the secondary command buffers.
+    vkCmdBeginRenderPass(commandBuffer, &renderpassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaryCommandBuffers[commandBufferIndex].size()),
+        secondaryCommandBuffers[commandBufferIndex].data());
+
     //Start second subpass
-    vkCmdNextSubpass(commandBuffers[currentImage], VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+    gpuProfiler.beginScope(commandBuffer, currentFrame, commandBufferIndex, aovScope, "AOV subpass");
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipeline);
 
-    vkCmdBindPipeline(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipeline);
+    VkViewport viewport = { 0.0f, 0.0f, (float)renderExtent.width, (float)renderExtent.height, 0.0f, 1.0f };
+    VkRect2D scissor = { {0, 0}, renderExtent };
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-    vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipelineLayout, 0, 1, &inputDescriptorSets[currentImage], 0, nullptr);
-    vkCmdDraw(commandBuffers[currentImage], 3, 1, 0, 0);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipelineLayout, 0, 1, &inputDescriptorSets[currentFrame], 0, nullptr);
+    vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+    gpuProfiler.endScope(commandBuffer, currentFrame, aovScope);
 
     // End render pass
-    vkCmdEndRenderPass(commandBuffers[currentImage]);
+    vkCmdEndRenderPass(commandBuffer);
+
+    if (settings.dynamicResolution) {
+        recordUpscale(commandBuffer, currentImage);
+    }
+    gpuProfiler.endScope(commandBuffer, currentFrame, frameScope);
 
-    result = vkEndCommandBuffer(commandBuffers[currentImage]);
+    result = vkEndCommandBuffer(commandBuffer);
     if (result != VK_SUCCESS) {
         throw std::runtime_error("Failed to stop recording a commandbuffer!");
     }
 }
 
+void ShaderApplication::recordSceneDrawsJob(void* context, uint32_t threadIndex)
+{
+    RecordContext* recordContext = static_cast<RecordContext*>(context);
+    recordContext->app->recordSceneDraws(recordContext->currentImage, threadIndex);
+}
+
+void ShaderApplication::recordSceneDraws(uint32_t currentImage, uint32_t threadIndex)
+{
+    PROFILE_ZONE("recordSceneDraws");
+
+    uint32_t commandBufferIndex = getCommandBufferIndex(currentFrame, currentImage);
+    VkCommandBuffer commandBuffer = secondaryCommandBuffers[commandBufferIndex][threadIndex];
+
+    // This thread's share of the draw list.
+    size_t threadCount = secondaryCommandBuffers[commandBufferIndex].size();
+    size_t firstDraw = drawCount * threadIndex / threadCount;
+    size_t lastDraw = drawCount * (threadIndex + 1) / threadCount;
+
+    // Frame is not in flight any more, so everything recorded from this pool can go.
+    vkResetCommandPool(mainDevice.logicalDevice, secondaryCommandPools[commandBufferIndex][threadIndex], 0);
+
+    // Secondaries continue subpass 0 of the primary's render pass.
+    VkCommandBufferInheritanceInfo inheritanceInfo = {};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = swapchainFramebuffers[commandBufferIndex];
+
+    VkCommandBufferBeginInfo bufferBeginInfo = {};
+    bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    bufferBeginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    VkResult result = vkBeginCommandBuffer(commandBuffer, &bufferBeginInfo);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to start recording a secondary commandbuffer!");
+    }
+
+    // Secondaries don't inherit dynamic state from the primary.
+    VkViewport viewport = { 0.0f, 0.0f, (float)renderExtent.width, (float)renderExtent.height, 0.0f, 1.0f };
+    VkRect2D scissor = { {0, 0}, renderExtent };
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    // Subpass 0 runs from the start of the first secondary to the end of the last. Labels can't span command buffers,
+    // so each secondary gets its own.
+    if (threadIndex == 0) {
+        gpuProfiler.writeBeginTimestamp(commandBuffer, currentFrame, commandBufferIndex, subpassScope, "Subpass 0");
+    }
+    gpuProfiler.beginLabel(commandBuffer, "Subpass 0");
+
+    // Every mesh lives in the geometry arena, bind its vertex buffer once. The index buffer is bound per index type below.
+    VkBuffer vertexBuffers[] = { geometryArena.getVertexBuffer() };   // Buffers to bind
+    VkDeviceSize offsets[] = { 0 };     //Offsets into buffers being bound.
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+
+    uint32_t modelScope = threadModelScopes ? threadModelScopes[threadIndex] : GpuProfiler::NO_SCOPE;
+    bool modelScopeOpen = false;
+    VertexLayout boundLayout = VERTEX_LAYOUT_COUNT;
+    VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+
+    // GPU culling: this thread's share of the batches, one indirect draw each. The draw list is empty.
+    if (settings.gpuCulling) {
+        const std::vector<GpuDrawBatch>& batches = gpuCuller.getBatches();
+        size_t firstBatch = batches.size() * threadIndex / threadCount;
+        size_t lastBatch = batches.size() * (threadIndex + 1) / threadCount;
+        int boundTexture = -1;
+
+        for (size_t b = firstBatch; b < lastBatch; b++)
+        {
+            const GpuDrawBatch& batch = batches[b];
+            if (batch.layout != boundLayout) {
+                boundLayout = batch.layout;
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, indirectPipelines[boundLayout]);
+            }
+            if (batch.indexType != boundIndexType) {
+                boundIndexType = batch.indexType;
+                vkCmdBindIndexBuffer(commandBuffer, geometryArena.getIndexBuffer(), 0, boundIndexType);
+            }
+
+            // Sets 0 and 2 are the same for every batch. So is set 1 with bindless textures, batches have texId -1 then.
+            if (b == firstBatch) {
+                boundTexture = batch.texId;
+                std::array<VkDescriptorSet, 3> descriptorSetGroup = { descriptorSets[currentFrame],
+                    settings.bindlessTextures ? bindlessDescriptorSet : samplerDescriptorSets[batch.texId],
+                    gpuCuller.getDescriptorSet(currentFrame) };
+
+                // The model binding isn't read by the indirect shader, any valid offset will do.
+                std::array<uint32_t, 2> dynamicOffsets = { vpUniformOffset, vpUniformOffset };
+
+                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, indirectPipelineLayout,
+                    0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(),
+                    static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
+            }
+            else if (batch.texId != boundTexture) {
+                boundTexture = batch.texId;
+                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, indirectPipelineLayout,
+                    1, 1, &samplerDescriptorSets[boundTexture], 0, nullptr);
+            }
+
+            gpuCuller.recordBatch(commandBuffer, currentFrame, static_cast<uint32_t>(b));
+        }
+    }
+
+    // Set 0 is rebound when the model (its transform's offset) changes, set 1 when the texture does. With bindless
+    // textures set 1 holds all of them and is bound once, the texture index is pushed with the dequantization.
+    uint32_t boundModel = UINT32_MAX;
+    int boundTexture = -1;
+    uint64_t binds = firstDraw < lastDraw ? 1 : 0;     // The vertex buffer above.
+    if (settings.bindlessTextures && firstDraw < lastDraw) {
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+            1, 1, &bindlessDescriptorSet, 0, nullptr);
+        binds++;
+    }
+
+    for (size_t i = firstDraw; i < lastDraw; i++)
+    {
+        MeshModel& thisModel = modelList[drawList[i].model];
+        Mesh* thisMesh = thisModel.getMesh(drawList[i].mesh);
+
+        // Scope per run of the same model's meshes.
+        if (threadModelScopes && (i == firstDraw || drawList[i].model != drawList[i - 1].model)) {
+            if (modelScopeOpen) {
+                gpuProfiler.endScope(commandBuffer, currentFrame, modelScope);
+                modelScope = modelScope == GpuProfiler::NO_SCOPE ? modelScope : modelScope + 1;
+            }
+            gpuProfiler.beginScope(commandBuffer, currentFrame, commandBufferIndex, modelScope, "MeshModel", drawList[i].model);
+            modelScopeOpen = true;
+        }
+
+        // Bind pipeline to be used in renderpass. Only changes between models of different vertex layouts.
+        if (thisMesh->getVertexLayout() != boundLayout) {
+            boundLayout = thisMesh->getVertexLayout();
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelines[boundLayout]);
+            binds++;
+        }
+        if (thisMesh->getIndexType() != boundIndexType) {
+            boundIndexType = thisMesh->getIndexType();
+            vkCmdBindIndexBuffer(commandBuffer, geometryArena.getIndexBuffer(), 0, boundIndexType);
+            binds++;
+        }
+
+        if (drawList[i].model != boundModel) {
+            boundModel = drawList[i].model;
+
+            // Dynamic Offset Amount. View projection and this model's transform in the frame's uniform ring.
+            std::array<uint32_t, 2> dynamicOffsets = { vpUniformOffset, modelUniformOffsets[boundModel] };
+
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+                0, 1, &descriptorSets[currentFrame], static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
+            binds++;
+        }
+        if (!settings.bindlessTextures && thisMesh->getTexId() != boundTexture) {
+            boundTexture = thisMesh->getTexId();
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+                1, 1, &samplerDescriptorSets[boundTexture], 0, nullptr);
+            binds++;
+        }
+
+        uint32_t texture = static_cast<uint32_t>(thisMesh->getTexId());
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(VertexDequantize), &thisMesh->getDequantize());
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, sizeof(VertexDequantize), sizeof(uint32_t), &texture);
+
+        // Every instance of the model in one draw, their transforms start at the model's first instance.
+        uint32_t instanceCount = thisModel.getInstanceCount();
+        uint32_t firstInstance = modelFirstInstances[drawList[i].model];
+
+        const std::vector<Meshlet>& meshlets = thisMesh->getMeshlets();
+        if (!modelCullViews || meshlets.empty() || instanceCount > 1) {
+            // Execute our pipeline. Mesh is a range of the shared buffers.
+            vkCmdDrawIndexed(commandBuffer, thisMesh->getIndexCount(), instanceCount, thisMesh->getFirstIndex(), thisMesh->getVertexOffset(), firstInstance);
+            continue;
+        }
+
+        // Only visible meshlets. Neighbouring ones are neighbouring index ranges, so each run of them is one draw.
+        const ClusterCullView& cullView = modelCullViews[drawList[i].model];
+        ClusterCullStats& cullStats = threadCullStats[threadIndex];
+        uint32_t runFirst = 0;
+        uint32_t runCount = 0;
+        for (const Meshlet& meshlet : meshlets)
+        {
+            ClusterVisibility visibility = testCluster(meshlet, cullView);
+            if (visibility == CLUSTER_VISIBLE) {
+                cullStats.visible++;
+                if (runCount == 0) {
+                    runFirst = meshlet.firstIndex;
+                }
+                runCount += meshlet.indexCount;
+                continue;
+            }
+
+            if (visibility == CLUSTER_BACKFACING) {
+                cullStats.backfacing++;
+            }
+            else {
+                cullStats.outsideFrustum++;
+            }
+            if (runCount > 0) {
+                vkCmdDrawIndexed(commandBuffer, runCount, 1, thisMesh->getFirstIndex() + runFirst, thisMesh->getVertexOffset(), firstInstance);
+                cullStats.draws++;
+                runCount = 0;
+            }
+        }
+        if (runCount > 0) {
+            vkCmdDrawIndexed(commandBuffer, runCount, 1, thisMesh->getFirstIndex() + runFirst, thisMesh->getVertexOffset(), firstInstance);
+            cullStats.draws++;
+        }
+    }
+
+    // Binding everything every draw would be pipeline, vertex buffer, index buffer and sets 0 and 1. The rest were skipped.
+    threadBindStats[threadIndex].binds = binds;
+    threadBindStats[threadIndex].skipped = (lastDraw - firstDraw) * 5 - binds;
+
+    if (modelScopeOpen) {
+        gpuProfiler.endScope(commandBuffer, currentFrame, modelScope);
+    }
+    gpuProfiler.endLabel(commandBuffer);
+    if (threadIndex == threadCount - 1) {
+        gpuProfiler.writeEndTimestamp(commandBuffer, currentFrame, subpassScope);
+    }
+
+    result = vkEndCommandBuffer(commandBuffer);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to stop recording a secondary commandbuffer!");
+    }
+}
+
+void ShaderApplication::recordUpscale(VkCommandBuffer commandBuffer, uint32_t currentImage)
+{
+    VkImage targetImage = swapchainImages[currentImage].image;
+
+    // Previous contents don't matter, the blit overwrites all of it.
+    VkImageMemoryBarrier imageBarrier = {};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.srcAccessMask = 0;
+    imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    imageBarrier.image = targetImage;
+    imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageBarrier.subresourceRange.baseMipLevel = 0;
+    imageBarrier.subresourceRange.levelCount = 1;
+    imageBarrier.subresourceRange.baseArrayLayer = 0;
+    imageBarrier.subresourceRange.layerCount = 1;
+
+    // Transfer stage is what the acquire semaphore waits at.
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+    // Rendered region of the scene image -> whole swapchain image.
+    VkImageBlit blitRegion = {};
+    blitRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blitRegion.srcSubresource.mipLevel = 0;
+    blitRegion.srcSubresource.baseArrayLayer = 0;
+    blitRegion.srcSubresource.layerCount = 1;
+    blitRegion.srcOffsets[0] = { 0, 0, 0 };
+    blitRegion.srcOffsets[1] = { (int32_t)renderExtent.width, (int32_t)renderExtent.height, 1 };
+    blitRegion.dstSubresource = blitRegion.srcSubresource;
+    blitRegion.dstOffsets[0] = { 0, 0, 0 };
+    blitRegion.dstOffsets[1] = { (int32_t)swapchainExtent.width, (int32_t)swapchainExtent.height, 1 };
+
+    vkCmdBlitImage(commandBuffer, sceneImages[currentImage], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        targetImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blitRegion, VK_FILTER_LINEAR);
+
+    // Ready to present (or to be copied out when headless).
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    imageBarrier.newLayout = settings.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    imageBarrier.dstAccessMask = 0;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+}
+
+void ShaderApplication::benchmarkRecording()
+{
+    // Nothing may be in flight while we record over image 0 again and again.
+    vkDeviceWaitIdle(mainDevice.logicalDevice);
+
+    const int iterations = 50;
+    uint32_t originalThreadCount = settings.recordThreadCount;
+    uint32_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    // 1, 2, 4 ... threads, always ending on every hardware thread.
+    std::vector<uint32_t> threadCounts;
+    for (uint32_t threads = 1; threads < maxThreads; threads *= 2)
+    {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    size_t drawCount = 0;
+    for (auto& model : modelList)
+    {
+        drawCount += model.getMeshCount();
+    }
+    printf("Recording benchmark: %zu draws, %d recordings per thread count.\n", drawCount, iterations);
+
+    double singleThreadMs = 0.0;
+    for (uint32_t threads : threadCounts)
+    {
+        destroyRecordThreads();
+        settings.recordThreadCount = threads;
+        createRecordThreads();
+
+        // Warm up pools and caches first.
+        if (settings.gpuCulling && gpuDrawVersion != sceneVersion) {
+            buildGpuDraws();
+        }
+        updateUniformBuffers();
+        frameArenas[currentFrame].reset();
+        if (settings.sortDraws) {
+            sortDraws();
+        }
+        recordCommands(0);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++)
+        {
+            frameArenas[currentFrame].reset();
+            recordCommands(0);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double ms = std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+        if (threads == 1) {
+            singleThreadMs = ms;
+        }
+
+        printf("  %3u threads: %8.3f ms per recording (%.2fx)\n", threads, ms, singleThreadMs / ms);
+    }
+
+    // Back to what was asked for on the command line.
+    destroyRecordThreads();
+    settings.recordThreadCount = originalThreadCount;
+    createRecordThreads();
+}
 
 void ShaderApplication::getPhysicalDevice(){
     uint32_t deviceCount = 0;
@@ -1436,11 +2903,6 @@ void ShaderApplication::getPhysicalDevice(){
         }
     }
 
-    // Get properties of our new device.
-    VkPhysicalDeviceProperties deviceProperties;
-    vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &deviceProperties);
-
-    //minUniformBufferOffset = deviceProperties.limits.minUniformBufferOffsetAlignment;
 }
 
 QueueFamilyIndices ShaderApplication::getQueueFamilies(VkPhysicalDevice device){
@@ -1460,6 +2922,16 @@ QueueFamilyIndices ShaderApplication::getQueueFamilies(VkPhysicalDevice device){
             indicies.graphicsFamily = i;
         }
 
+        // No surface to present to when headless.
+        if (settings.headless) {
+            if (indicies.isValidHeadless())
+            {
+                break;
+            }
+            i++;
+            continue;
+        }
+
         VkBool32 presentationSupport = false;
         vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
         if (queueFamily.queueCount > 0 && presentationSupport) {
@@ -1474,6 +2946,17 @@ QueueFamilyIndices ShaderApplication::getQueueFamilies(VkPhysicalDevice device){
         i++;
     }
 
+    // Copy engine for uploads: a family without graphics, ideally without compute too (pure DMA).
+    for (uint32_t family = 0; family < queueFamilyCount; family++) {
+        VkQueueFlags flags = queueFamilyList[family].queueFlags;
+        if (queueFamilyList[family].queueCount == 0 || (flags & VK_QUEUE_GRAPHICS_BIT) || !(flags & VK_QUEUE_TRANSFER_BIT)) {
+            continue;
+        }
+        if (indicies.transferFamily < 0 || !(flags & VK_QUEUE_COMPUTE_BIT)) {
+            indicies.transferFamily = static_cast<int>(family);
+        }
+    }
+
     return indicies;
 
 }
@@ -1501,12 +2984,14 @@ SwapChainDetails ShaderApplication::getSwapChainDetails(VkPhysicalDevice device)
     return swapChainDetails;
 }
 
-void ShaderApplication::allocateDynamicBufferTransferSpace()
+std::vector<const char*> ShaderApplication::getDeviceExtensions()
 {
-    /*modelUniformAlignment = (sizeof(UboModel) + minUniformBufferOffset - 1) & ~(minUniformBufferOffset -1);
+    // Swapchain extension is only needed when presenting. Software ICDs on render nodes may not even expose it.
+    if (settings.headless) {
+        return {};
+    }
 
-    // Create space in memory to hold dynamic buffer that is alligned to our requires alignment and holds MAX_OBJECTS.
-    modelTransferSpace = (UboModel *)_aligned_malloc(modelUniformAlignment * MAX_OBJECTS, modelUniformAlignment);*/
+    return deviceExtensions;
 }
 
 void ShaderApplication::populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
@@ -1529,31 +3014,70 @@ void ShaderApplication::setupDebugMessenger() {
 }
 
 std::vector<const char*> ShaderApplication::getRequiredExtensions() {
-    uint32_t glfwExtensionCount = 0;
-    const char** glfwExtensions;
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    std::vector<const char*> extensions;
 
-    std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    // Surface extensions come from GLFW, which is never initialised headless.
+    if (!settings.headless) {
+        uint32_t glfwExtensionCount = 0;
+        const char** glfwExtensions;
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-    if (enableValidationLayers) {
+        extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    }
+
+    // Debug utils for the validation messenger, and to label GPU profiler scopes for external tools.
+    if (enableValidationLayers || (!settings.gpuProfilePath.empty() && checkInstanceExtensionSupport(VK_EXT_DEBUG_UTILS_EXTENSION_NAME))) {
         extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
     }
 
     return extensions;
 }
 
+bool ShaderApplication::checkInstanceExtensionSupport(const char* extensionName){
+    uint32_t extensionCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+
+    for (const auto& extension : extensions) {
+        if (strcmp(extension.extensionName, extensionName) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ShaderApplication::hasDeviceExtension(VkPhysicalDevice device, const char* extensionName)
+{
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
+
+    for (const auto& extension : extensions) {
+        if (strcmp(extensionName, extension.extensionName) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool ShaderApplication::checkDeviceExtensionSupport(VkPhysicalDevice device){
+    std::vector<const char*> requiredExtensions = getDeviceExtensions();
+
     uint32_t extensionCount = 0;
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
 
     if (extensionCount == 0) {
-        return false;
+        return requiredExtensions.empty();
     }
 
     std::vector<VkExtensionProperties> extensions(extensionCount);
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
 
-    for (const auto &deviceExtension : deviceExtensions) {
+    for (const auto &deviceExtension : requiredExtensions) {
         bool hasExtension = false;
         for (const auto& extension : extensions)
         {
@@ -1597,16 +3121,36 @@ bool ShaderApplication::checkValidationLayerSupport() {
 }
 
 bool ShaderApplication::checkDeviceSuitable(VkPhysicalDevice device){
-    /*
     VkPhysicalDeviceProperties deviceProperties;
-    vkGetPhysicalDeviceProperties(device, &deviceProperties);*/
+    vkGetPhysicalDeviceProperties(device, &deviceProperties);
 
     VkPhysicalDeviceFeatures deviceFeatures;
     vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
 
+    // Frame pacing needs timeline semaphores (core in 1.2).
+    if (deviceProperties.apiVersion < VK_API_VERSION_1_2) {
+        return false;
+    }
+
+    VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+    VkPhysicalDeviceFeatures2 deviceFeatures2 = {};
+    deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    deviceFeatures2.pNext = &vulkan12Features;
+    vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
+
+    if (!vulkan12Features.timelineSemaphore) {
+        return false;
+    }
+
     QueueFamilyIndices indicies = getQueueFamilies(device);
     bool extensionsSupported = checkDeviceExtensionSupport(device);
 
+    if (settings.headless) {
+        return indicies.isValidHeadless() && extensionsSupported && deviceFeatures.samplerAnisotropy;
+    }
+
     bool swapChainValid = false;
 
     if (extensionsSupported) {
@@ -1686,7 +3230,8 @@ VkFormat ShaderApplication::chooseSupportedFormat(const std::vector<VkFormat>& f
 
 }
 
-VkImage ShaderApplication::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory* imageMemory)
+VkImage ShaderApplication::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags,
+    MemoryCategory category, DeviceAllocation* imageAllocation)
 {
     // CREATE  THE IMAGE
     VkImageCreateInfo imageCreateInfo = {};
@@ -1717,19 +3262,21 @@ VkImage ShaderApplication::createImage(uint32_t width, uint32_t height, VkFormat
     vkGetImageMemoryRequirements(mainDevice.logicalDevice, image, &memoryRequirements);
 
 
-    VkMemoryAllocateInfo memoryAllocInfo = {};
-    memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    memoryAllocInfo.allocationSize = memoryRequirements.size;
-    memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(mainDevice.physicalDevice, memoryRequirements.memoryTypeBits, propFlags);
+    // Lazily allocated memory is optional, where there is none plain device local memory does the same job.
+    if ((propFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) && !deviceAllocator.hasMemoryType(memoryRequirements.memoryTypeBits, propFlags))
+    {
+        propFlags &= ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+    }
+
+    // Sub-allocated, linear tiled images may share blocks with buffers.
+    *imageAllocation = deviceAllocator.allocate(memoryRequirements, propFlags, tiling == VK_IMAGE_TILING_LINEAR, category);
 
-    result = vkAllocateMemory(mainDevice.logicalDevice, &memoryAllocInfo, nullptr, imageMemory);
+    result = vkBindImageMemory(mainDevice.logicalDevice, image, imageAllocation->memory, imageAllocation->offset);
     if (result != VK_SUCCESS)
     {
-        throw std::runtime_error("Failed to allocate memory for image!");
+        throw std::runtime_error("Failed to bind image memory!");
     }
 
-    vkBindImageMemory(mainDevice.logicalDevice, image, *imageMemory, 0);
-
     return image;
 
 }
@@ -1780,53 +3327,29 @@ VkShaderModule ShaderApplication::createShaderModule(const std::vector<char> &co
 
 int ShaderApplication::createTextureImage(std::string fileName)
 {
+    PROFILE_ZONE("createTextureImage");
+
     // Load image file
     int width, height;
     VkDeviceSize imageSize;
     stbi_uc * imageData = loadTextureFile(fileName, &width, &height, &imageSize);
 
-    // Create staging buffer to hold loaded data, ready to copy to device.
-    VkBuffer imageStagingBuffer;
-    VkDeviceMemory imageStagingBufferMemory;
-    createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-                    &imageStagingBuffer, &imageStagingBufferMemory);
-
-    // Copy Image data to staging buffer.
-    void *data;
-    vkMapMemory(mainDevice.logicalDevice, imageStagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, imageData, static_cast<size_t>(imageSize));
-    vkUnmapMemory(mainDevice.logicalDevice, imageStagingBufferMemory);
-
-    // Free oriuginal image data.
-    stbi_image_free(imageData);
-
     // Create image to hold final texture.
     VkImage texImage;
-    VkDeviceMemory texImageMemory;
+    DeviceAllocation texImageAllocation;
     texImage = createImage(width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
                             VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 
-                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texImageMemory);
-
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_TEXTURES, &texImageAllocation);
 
-    //Copy data to image
-    // Transition image to be DST for copy operation
-    transitionImageLayout(mainDevice.logicalDevice, graphicQueue, graphicsCommandPool, texImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-    // copy image data
-    copyImageBuffer(mainDevice.logicalDevice, graphicQueue, graphicsCommandPool, imageStagingBuffer, texImage, width, height);
-
-    // transition image to be shader readable for shader usage
-    transitionImageLayout(mainDevice.logicalDevice, graphicQueue, graphicsCommandPool, texImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // Copy through the staging ring. Leaves the image shader readable once the batch ran.
+    uploadManager.uploadImage(texImage, width, height, 4, imageData);
 
+    // Free oriuginal image data, the ring holds a copy.
+    stbi_image_free(imageData);
 
     // add texture data to vector for reference.
     textureImages.push_back(texImage);
-    textureImageMemory.push_back(texImageMemory);
-
-    // destroy staging buffers
-    vkDestroyBuffer(mainDevice.logicalDevice, imageStagingBuffer, nullptr);
-    vkFreeMemory(mainDevice.logicalDevice, imageStagingBufferMemory, nullptr);
+    textureImageMemory.push_back(texImageAllocation);
 
     return textureImages.size() - 1;
 
@@ -1840,12 +3363,17 @@ int ShaderApplication::createTexture(std::string fileName)
     textureImageViews.push_back(imageView);
 
     int descriptorLoc = createTextureDescriptor(imageView);
+    markSceneDirty();
 
     return descriptorLoc;
 }
 
 int ShaderApplication::createTextureDescriptor(VkImageView textureImage)
 {
+    if (settings.bindlessTextures) {
+        return createBindlessTextureDescriptor(textureImage);
+    }
+
     VkDescriptorSet descriptorSet;
 
     // Descriptor set allocation info
@@ -1890,8 +3418,43 @@ int ShaderApplication::createTextureDescriptor(VkImageView textureImage)
 
 }
 
-int ShaderApplication::createMeshModel(std::string modelFile)
+int ShaderApplication::createBindlessTextureDescriptor(VkImageView textureImage)
 {
+    if (bindlessTextureCount >= bindlessTextureCapacity)
+    {
+        throw std::runtime_error("Failed to fit the texture into the bindless texture array!");
+    }
+
+    VkDescriptorImageInfo imageInfo = {};
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfo.imageView = textureImage;
+    imageInfo.sampler = textureSampler;
+
+    // The next free element. Earlier ones may be in use by frames in flight, this one isn't.
+    VkWriteDescriptorSet descriptorWrite = {};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = bindlessDescriptorSet;
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.dstArrayElement = bindlessTextureCount;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &descriptorWrite, 0, nullptr);
+
+    // The array index is the texture's id.
+    return bindlessTextureCount++;
+}
+
+int ShaderApplication::createMeshModel(std::string modelFile, VertexLayout layout)
+{
+    PROFILE_ZONE("createMeshModel");
+
+    // Before anything is uploaded, a model that can't get an instance slot must not hold arena ranges or textures.
+    if (totalInstances >= MAX_INSTANCES) {
+        throw std::runtime_error("Failed to add a model, the instance buffer is full!");
+    }
+
     // Import model scene
     Assimp::Importer importer;
     const aiScene *scene = importer.ReadFile(modelFile, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
@@ -1920,13 +3483,26 @@ int ShaderApplication::createMeshModel(std::string modelFile)
     }
 
     // Load in all our  meshes
-    std::vector<Mesh> modelMeshes = MeshModel::LoadNode(mainDevice.physicalDevice, mainDevice.logicalDevice, graphicQueue, graphicsCommandPool, 
-        scene->mRootNode, scene, matToTex);
+    MeshLoadOptions loadOptions;
+    loadOptions.vertexLayout = layout;
+    loadOptions.optimize = settings.optimizeMeshes;
+    loadOptions.buildMeshlets = settings.clusterCulling;
+    std::vector<Mesh> modelMeshes = MeshModel::LoadNode(&geometryArena, loadOptions, scene->mRootNode, scene, matToTex);
+
+    // One submit for the whole model. Later frames are ordered behind its acquire on the graphics queue, which waits on the
+    // upload timeline (without a transfer queue the copies run on the graphics queue itself), so the host doesn't wait here.
+    sceneUploadToken = uploadManager.flush();
 
 
-    // Create mesh model and add to list.
+    // Create mesh model and add to list. It starts with one instance.
     MeshModel meshModel = MeshModel(modelMeshes);
     modelList.push_back(meshModel);
+    modelUniformOffsets.push_back(0);
+    modelFirstInstances.push_back(totalInstances);
+    totalInstances++;
+    instanceVersion++;
+    gpuProfiler.setModelCount(static_cast<uint32_t>(modelList.size()));
+    markSceneDirty();
 
     return modelList.size() - 1;
 }
@@ -0,0 +1,126 @@
+#include "ThreadPool.h"
+#include "CpuProfiler.h"
+
+
+
+ThreadPool::ThreadPool(uint32_t newThreadCount)
+{
+	threadCount = newThreadCount > 0 ? newThreadCount : 1;
+
+	// Calling thread is index 0, only start the rest.
+	for (uint32_t i = 1; i < threadCount; i++)
+	{
+		workers.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+}
+
+uint32_t ThreadPool::getThreadCount()
+{
+	return threadCount;
+}
+
+void ThreadPool::dispatch(Job job, void* context)
+{
+	if (workers.empty())
+	{
+		job(context, 0);
+		return;
+	}
+
+	// Hand the job to the workers.
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		currentJob = job;
+		currentContext = context;
+		pending = static_cast<uint32_t>(workers.size());
+		workerError = nullptr;
+		generation++;
+	}
+	startCondition.notify_all();
+
+	// Calling thread does its share too. Still wait for the workers if it throws.
+	std::exception_ptr callerError;
+	try
+	{
+		job(context, 0);
+	}
+	catch (...)
+	{
+		callerError = std::current_exception();
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCondition.wait(lock, [this] { return pending == 0; });
+
+	if (callerError)
+	{
+		std::rethrow_exception(callerError);
+	}
+	if (workerError)
+	{
+		std::rethrow_exception(workerError);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	startCondition.notify_all();
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::workerLoop(uint32_t threadIndex)
+{
+	PROFILE_THREAD("Record worker");
+
+	uint64_t seenGeneration = 0;
+
+	while (true)
+	{
+		Job job;
+		void* context;
+
+		// Sleep until there is a new dispatch (or we are shutting down)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			startCondition.wait(lock, [&] { return stopping || generation != seenGeneration; });
+			if (stopping)
+			{
+				return;
+			}
+
+			seenGeneration = generation;
+			job = currentJob;
+			context = currentContext;
+		}
+
+		std::exception_ptr error;
+		try
+		{
+			job(context, threadIndex);
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+
+		// Report back. Last worker to finish wakes up dispatch().
+		std::lock_guard<std::mutex> lock(mutex);
+		if (error && !workerError)
+		{
+			workerError = error;
+		}
+		pending--;
+		if (pending == 0)
+		{
+			doneCondition.notify_one();
+		}
+	}
+}
@@ -0,0 +1,618 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+#include "UploadManager.h"
+
+
+
+UploadManager::UploadManager()
+{
+}
+
+void UploadManager::createUploadManager(DeviceAllocator* newAllocator, VkPhysicalDevice physicalDevice, VkDevice newDevice,
+	VkQueue newTransferQueue, uint32_t newTransferFamily, VkQueue newGraphicsQueue, uint32_t newGraphicsFamily,
+	VkDeviceSize newRingSize)
+{
+	allocator = newAllocator;
+	device = newDevice;
+	queue = newTransferQueue;
+	queueFamily = newTransferFamily;
+	graphicsQueue = newGraphicsQueue;
+	graphicsFamily = newGraphicsFamily;
+	ownershipTransfer = queueFamily != graphicsFamily;
+	ringSize = newRingSize;
+
+	// Image copies need offsets aligned to the texel size, 16 covers every colour format. Some devices want more for speed.
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+	alignment = std::max((VkDeviceSize)16, deviceProperties.limits.optimalBufferCopyOffsetAlignment);
+
+	// Transfer only families may restrict where image copies start (graphics families always allow 1x1x1).
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilyList(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilyList.data());
+	rowGranularity = queueFamily < queueFamilyCount ? queueFamilyList[queueFamily].minImageTransferGranularity.height : 1;
+
+	allocator->createBuffer(ringSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MEMORY_STAGING, &ringBuffer, &ringAllocation);
+
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = queueFamily;
+
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the upload command pool!");
+	}
+
+	if (ownershipTransfer)
+	{
+		poolInfo.queueFamilyIndex = graphicsFamily;
+		if (vkCreateCommandPool(device, &poolInfo, nullptr, &acquireCommandPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create the upload acquire command pool!");
+		}
+	}
+
+	VkSemaphoreTypeCreateInfo timelineCreateInfo = {};
+	timelineCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	timelineCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineCreateInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreCreateInfo.pNext = &timelineCreateInfo;
+
+	if (vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &timeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the upload timeline semaphore!");
+	}
+
+	head = 0;
+	tail = 0;
+	submittedValue = 0;
+}
+
+void UploadManager::uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+{
+	stats.uploads++;
+
+	const uint8_t* source = static_cast<const uint8_t*>(data);
+	uint8_t* ring = static_cast<uint8_t*>(ringAllocation.mapped);
+	VkDeviceSize maxChunk = ringSize / 4;
+
+	for (VkDeviceSize done = 0; done < size;)
+	{
+		VkDeviceSize chunk = std::min(size - done, maxChunk);
+		VkDeviceSize offset = reserve(chunk);
+		memcpy(ring + offset, source + done, (size_t)chunk);
+
+		VkBufferCopy bufferCopyRegion = {};
+		bufferCopyRegion.srcOffset = offset;
+		bufferCopyRegion.dstOffset = dstOffset + done;
+		bufferCopyRegion.size = chunk;
+		vkCmdCopyBuffer(openBatch.commandBuffer, ringBuffer, dstBuffer, 1, &bufferCopyRegion);
+		addBufferRange(dstBuffer, dstOffset + done, chunk);
+
+		done += chunk;
+		stats.bytes += chunk;
+	}
+}
+
+void UploadManager::uploadImage(VkImage image, uint32_t width, uint32_t height, uint32_t texelSize, const void* data)
+{
+	stats.uploads++;
+
+	const uint8_t* source = static_cast<const uint8_t*>(data);
+	uint8_t* ring = static_cast<uint8_t*>(ringAllocation.mapped);
+	VkDeviceSize rowSize = (VkDeviceSize)width * texelSize;
+	uint32_t rowsPerChunk = static_cast<uint32_t>(std::max((VkDeviceSize)1, (ringSize / 4) / rowSize));
+	if (rowGranularity == 0)
+	{
+		rowsPerChunk = height;
+	}
+	else if (rowGranularity > 1)
+	{
+		rowsPerChunk = std::max(rowGranularity, rowsPerChunk - rowsPerChunk % rowGranularity);
+	}
+
+	VkImageMemoryBarrier imageMemoryBarrier = {};
+	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageMemoryBarrier.image = image;
+	imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
+	imageMemoryBarrier.subresourceRange.levelCount = 1;
+	imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
+	imageMemoryBarrier.subresourceRange.layerCount = 1;
+
+	// Bands of rows. Bands may end up in different batches, they are still executed in submit order.
+	for (uint32_t row = 0; row < height;)
+	{
+		uint32_t rows = std::min(rowsPerChunk, height - row);
+		VkDeviceSize chunk = rows * rowSize;
+		VkDeviceSize offset = reserve(chunk);
+		memcpy(ring + offset, source + row * rowSize, (size_t)chunk);
+
+		if (row == 0)
+		{
+			imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			imageMemoryBarrier.srcAccessMask = 0;
+			imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+			vkCmdPipelineBarrier(openBatch.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+		}
+
+		VkBufferImageCopy imageRegion = {};
+		imageRegion.bufferOffset = offset;
+		imageRegion.bufferRowLength = 0;
+		imageRegion.bufferImageHeight = 0;
+		imageRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		imageRegion.imageSubresource.mipLevel = 0;
+		imageRegion.imageSubresource.baseArrayLayer = 0;
+		imageRegion.imageSubresource.layerCount = 1;
+		imageRegion.imageOffset = { 0, static_cast<int32_t>(row), 0 };
+		imageRegion.imageExtent = { width, rows, 1 };
+
+		vkCmdCopyBufferToImage(openBatch.commandBuffer, ringBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageRegion);
+
+		row += rows;
+		stats.bytes += chunk;
+	}
+
+	// Ready for sampling.
+	imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	// Other family: the layout change happens as part of the release/acquire pair at flush.
+	if (ownershipTransfer)
+	{
+		imageMemoryBarrier.srcQueueFamilyIndex = queueFamily;
+		imageMemoryBarrier.dstQueueFamilyIndex = graphicsFamily;
+		openBatch.imageBarriers.push_back(imageMemoryBarrier);
+		return;
+	}
+
+	vkCmdPipelineBarrier(openBatch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+}
+
+void UploadManager::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, const std::vector<VkBufferCopy>& regions)
+{
+	if (regions.empty()) return;
+
+	// Source data uploaded so far has to be submitted (and acquired) before the copy reads it.
+	flush();
+
+	// Its own batch on the graphics queue, which owns the source. Holds no ring space.
+	Batch batch;
+	VkCommandBuffer commandBuffer;
+	if (ownershipTransfer)
+	{
+		batch.acquireCommandBuffer = takeCommandBuffer(device, acquireCommandPool, freeAcquireCommandBuffers);
+		commandBuffer = batch.acquireCommandBuffer;
+	}
+	else
+	{
+		batch.commandBuffer = takeCommandBuffer(device, commandPool, freeCommandBuffers);
+		commandBuffer = batch.commandBuffer;
+	}
+
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, static_cast<uint32_t>(regions.size()), regions.data());
+
+	// Visible to the frames submitted after this, like a flush on one queue.
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to stop recording a buffer copy commandbuffer!");
+	}
+
+	submit(graphicsQueue, commandBuffer, 0, 0, submittedValue + 1);
+	submittedValue += 1;
+
+	// Sits at the current head, so the ring tail never moves back past data of later batches.
+	batch.value = submittedValue;
+	batch.ringBegin = head;
+	batch.ringEnd = head;
+	pendingBatches.push_back(batch);
+	stats.batches++;
+}
+
+UploadToken UploadManager::flush()
+{
+	UploadToken token;
+	token.value = submittedValue;
+	if (!batchOpen) return token;
+
+	// Every later submit on the graphics queue that reads geometry, uniforms or textures.
+	const VkAccessFlags readAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	const VkPipelineStageFlags readStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+	if (!ownershipTransfer)
+	{
+		// Same queue: one barrier makes the buffer copies visible to the frames submitted after this.
+		VkMemoryBarrier memoryBarrier = {};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = readAccess;
+
+		vkCmdPipelineBarrier(openBatch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, readStages,
+			0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+		if (vkEndCommandBuffer(openBatch.commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to stop recording an upload commandbuffer!");
+		}
+
+		submit(queue, openBatch.commandBuffer, 0, 0, submittedValue + 1);
+		submittedValue += 1;
+	}
+	else
+	{
+		// Release on the transfer queue. Destination access is ignored here, the acquire below makes the writes visible.
+		for (auto& barrier : openBatch.bufferBarriers)
+		{
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = 0;
+		}
+		for (auto& barrier : openBatch.imageBarriers)
+		{
+			barrier.dstAccessMask = 0;
+		}
+
+		vkCmdPipelineBarrier(openBatch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0, 0, nullptr, static_cast<uint32_t>(openBatch.bufferBarriers.size()), openBatch.bufferBarriers.data(),
+			static_cast<uint32_t>(openBatch.imageBarriers.size()), openBatch.imageBarriers.data());
+
+		if (vkEndCommandBuffer(openBatch.commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to stop recording an upload commandbuffer!");
+		}
+
+		submit(queue, openBatch.commandBuffer, 0, 0, submittedValue + 1);
+
+		// Matching acquire on the graphics queue, once the copies are done. Same barriers, source access ignored.
+		for (auto& barrier : openBatch.bufferBarriers)
+		{
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = readAccess;
+		}
+		for (auto& barrier : openBatch.imageBarriers)
+		{
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		}
+
+		openBatch.acquireCommandBuffer = takeCommandBuffer(device, acquireCommandPool, freeAcquireCommandBuffers);
+		vkCmdPipelineBarrier(openBatch.acquireCommandBuffer, readStages, readStages,
+			0, 0, nullptr, static_cast<uint32_t>(openBatch.bufferBarriers.size()), openBatch.bufferBarriers.data(),
+			static_cast<uint32_t>(openBatch.imageBarriers.size()), openBatch.imageBarriers.data());
+
+		if (vkEndCommandBuffer(openBatch.acquireCommandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to stop recording an upload acquire commandbuffer!");
+		}
+
+		submit(graphicsQueue, openBatch.acquireCommandBuffer, submittedValue + 1, readStages, submittedValue + 2);
+		submittedValue += 2;
+	}
+
+	openBatch.value = submittedValue;
+	openBatch.bufferBarriers.clear();
+	openBatch.imageBarriers.clear();
+	pendingBatches.push_back(openBatch);
+	openBatch = Batch();
+	batchOpen = false;
+	stats.batches++;
+
+	token.value = submittedValue;
+	return token;
+}
+
+bool UploadManager::isComplete(UploadToken token)
+{
+	retireFinishedBatches();
+	return pendingBatches.empty() || pendingBatches.front().value > token.value;
+}
+
+void UploadManager::wait(UploadToken token)
+{
+	if (token.value > submittedValue)
+	{
+		throw std::runtime_error("Waited on an upload that was never flushed!");
+	}
+	if (isComplete(token)) return;
+
+	waitForValue(token.value);
+	retireFinishedBatches();
+}
+
+void UploadManager::waitIdle()
+{
+	while (!pendingBatches.empty())
+	{
+		retireOldestBatch();
+	}
+}
+
+UploadStats UploadManager::getStats()
+{
+	return stats;
+}
+
+bool UploadManager::usesTransferQueue()
+{
+	return ownershipTransfer;
+}
+
+void UploadManager::destroyUploadManager()
+{
+	flush();
+	waitIdle();
+
+	vkDestroyCommandPool(device, commandPool, nullptr);
+	freeCommandBuffers.clear();
+	if (acquireCommandPool != VK_NULL_HANDLE)
+	{
+		vkDestroyCommandPool(device, acquireCommandPool, nullptr);
+		acquireCommandPool = VK_NULL_HANDLE;
+		freeAcquireCommandBuffers.clear();
+	}
+	vkDestroySemaphore(device, timeline, nullptr);
+	allocator->destroyBuffer(ringBuffer, ringAllocation);
+}
+
+UploadManager::~UploadManager()
+{
+}
+
+VkCommandBuffer UploadManager::getCommandBuffer()
+{
+	if (batchOpen) return openBatch.commandBuffer;
+
+	openBatch = Batch();
+	openBatch.commandBuffer = takeCommandBuffer(device, commandPool, freeCommandBuffers);
+	batchOpen = true;
+	return openBatch.commandBuffer;
+}
+
+VkCommandBuffer UploadManager::takeCommandBuffer(VkDevice device, VkCommandPool pool, std::vector<VkCommandBuffer>& freeList)
+{
+	VkCommandBuffer commandBuffer;
+	if (!freeList.empty())
+	{
+		commandBuffer = freeList.back();
+		freeList.pop_back();
+	}
+	else
+	{
+		VkCommandBufferAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandPool = pool;
+		allocateInfo.commandBufferCount = 1;
+
+		if (vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate an upload commandbuffer!");
+		}
+	}
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to start recording an upload commandbuffer!");
+	}
+
+	return commandBuffer;
+}
+
+void UploadManager::addBufferRange(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+	if (!ownershipTransfer) return;
+
+	// Chunks of one upload (and meshes packed back to back) extend the previous range of the same buffer.
+	for (auto& barrier : openBatch.bufferBarriers)
+	{
+		if (barrier.buffer == buffer && barrier.offset + barrier.size == offset)
+		{
+			barrier.size += size;
+			return;
+		}
+	}
+
+	VkBufferMemoryBarrier bufferMemoryBarrier = {};
+	bufferMemoryBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	bufferMemoryBarrier.srcQueueFamilyIndex = queueFamily;
+	bufferMemoryBarrier.dstQueueFamilyIndex = graphicsFamily;
+	bufferMemoryBarrier.buffer = buffer;
+	bufferMemoryBarrier.offset = offset;
+	bufferMemoryBarrier.size = size;
+	openBatch.bufferBarriers.push_back(bufferMemoryBarrier);
+}
+
+void UploadManager::submit(VkQueue submitQueue, VkCommandBuffer commandBuffer, uint64_t waitValue, VkPipelineStageFlags waitStages, uint64_t signalValue)
+{
+	VkTimelineSemaphoreSubmitInfo timelineSubmitInfo = {};
+	timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineSubmitInfo.signalSemaphoreValueCount = 1;
+	timelineSubmitInfo.pSignalSemaphoreValues = &signalValue;
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineSubmitInfo;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &timeline;
+
+	// Waits on the same timeline, an earlier value signalled by the transfer queue.
+	if (waitValue > 0)
+	{
+		timelineSubmitInfo.waitSemaphoreValueCount = 1;
+		timelineSubmitInfo.pWaitSemaphoreValues = &waitValue;
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &timeline;
+		submitInfo.pWaitDstStageMask = &waitStages;
+	}
+
+	if (vkQueueSubmit(submitQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to submit an upload batch!");
+	}
+}
+
+VkDeviceSize UploadManager::reserve(VkDeviceSize size)
+{
+	retireFinishedBatches();
+
+	// Out of space: submit what we have and wait for the oldest batch to give its space back.
+	VkDeviceSize offset;
+	while (!tryReserve(size, &offset))
+	{
+		stats.ringStalls++;
+		if (batchOpen && openBatch.hasData)
+		{
+			flush();
+		}
+		if (pendingBatches.empty())
+		{
+			throw std::runtime_error("Upload does not fit in the staging ring!");
+		}
+		retireOldestBatch();
+	}
+
+	getCommandBuffer();
+	if (!openBatch.hasData)
+	{
+		openBatch.ringBegin = offset;
+		openBatch.hasData = true;
+	}
+	openBatch.ringEnd = offset + size;
+
+	head = offset + size;
+	updateTail();
+	return offset;
+}
+
+bool UploadManager::tryReserve(VkDeviceSize size, VkDeviceSize* offset)
+{
+	VkDeviceSize start = (head + alignment - 1) & ~(alignment - 1);
+
+	if (head >= tail)
+	{
+		// Used: [tail, head). Free: the end of the ring, then the start up to (not touching) tail.
+		if (start + size <= ringSize)
+		{
+			*offset = start;
+			return true;
+		}
+		if (size < tail)
+		{
+			*offset = 0;
+			return true;
+		}
+		return false;
+	}
+
+	// Wrapped. Used: [tail, end) and [0, head).
+	if (start + size < tail)
+	{
+		*offset = start;
+		return true;
+	}
+	return false;
+}
+
+void UploadManager::waitForValue(uint64_t value)
+{
+	VkSemaphoreWaitInfo waitInfo = {};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &timeline;
+	waitInfo.pValues = &value;
+
+	VkResult result = vkWaitSemaphores(device, &waitInfo, FRAME_WAIT_TIMEOUT);
+	if (result == VK_TIMEOUT)
+	{
+		throw std::runtime_error("Timed out waiting for an upload batch!");
+	}
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to wait for the upload timeline semaphore!");
+	}
+}
+
+void UploadManager::retireOldestBatch()
+{
+	waitForValue(pendingBatches.front().value);
+	retireFinishedBatches();
+}
+
+void UploadManager::retireFinishedBatches()
+{
+	if (pendingBatches.empty()) return;
+
+	uint64_t completedValue = 0;
+	vkGetSemaphoreCounterValue(device, timeline, &completedValue);
+
+	while (!pendingBatches.empty() && pendingBatches.front().value <= completedValue)
+	{
+		if (pendingBatches.front().commandBuffer != VK_NULL_HANDLE)
+		{
+			vkResetCommandBuffer(pendingBatches.front().commandBuffer, 0);
+			freeCommandBuffers.push_back(pendingBatches.front().commandBuffer);
+		}
+		if (pendingBatches.front().acquireCommandBuffer != VK_NULL_HANDLE)
+		{
+			vkResetCommandBuffer(pendingBatches.front().acquireCommandBuffer, 0);
+			freeAcquireCommandBuffers.push_back(pendingBatches.front().acquireCommandBuffer);
+		}
+		pendingBatches.pop_front();
+	}
+
+	updateTail();
+}
+
+void UploadManager::updateTail()
+{
+	// Oldest batch still holding ring space. Nothing in use: start over at 0, keeps uploads contiguous.
+	if (!pendingBatches.empty())
+	{
+		tail = pendingBatches.front().ringBegin;
+	}
+	else if (batchOpen && openBatch.hasData)
+	{
+		tail = openBatch.ringBegin;
+	}
+	else
+	{
+		head = 0;
+		tail = 0;
+	}
+}
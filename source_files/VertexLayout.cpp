@@ -0,0 +1,163 @@
+#include <cstring>
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+
+#include "VertexLayout.h"
+
+
+
+static int16_t quantizeSnorm16(float value)
+{
+	return static_cast<int16_t>(std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f));
+}
+
+static uint16_t quantizeUnorm16(float value)
+{
+	return static_cast<uint16_t>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f));
+}
+
+static uint8_t quantizeUnorm8(float value)
+{
+	return static_cast<uint8_t>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 255.0f));
+}
+
+uint32_t getVertexStride(VertexLayout layout)
+{
+	switch (layout)
+	{
+	case VERTEX_LAYOUT_COMPACT: return sizeof(CompactVertex);
+	case VERTEX_LAYOUT_COMPACT_NO_COLOUR: return sizeof(CompactVertexNoColour);
+	default: return sizeof(Vertex);
+	}
+}
+
+void getVertexInputDescription(VertexLayout layout, VkVertexInputBindingDescription* binding,
+	std::vector<VkVertexInputAttributeDescription>* attributes)
+{
+	binding->binding = 0;
+	binding->stride = getVertexStride(layout);
+	binding->inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	// Location, format, offset.
+	attributes->clear();
+	switch (layout)
+	{
+	case VERTEX_LAYOUT_COMPACT:
+		attributes->push_back({ 0, 0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(CompactVertex, pos) });
+		attributes->push_back({ 1, 0, VK_FORMAT_R8G8B8A8_UNORM, offsetof(CompactVertex, col) });
+		attributes->push_back({ 2, 0, VK_FORMAT_R16G16_UNORM, offsetof(CompactVertex, tex) });
+		break;
+	case VERTEX_LAYOUT_COMPACT_NO_COLOUR:
+		attributes->push_back({ 0, 0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(CompactVertexNoColour, pos) });
+		attributes->push_back({ 2, 0, VK_FORMAT_R16G16_UNORM, offsetof(CompactVertexNoColour, tex) });
+		break;
+	default:
+		attributes->push_back({ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos) });
+		attributes->push_back({ 1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, col) });
+		attributes->push_back({ 2, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, tex) });
+		break;
+	}
+}
+
+const char* getVertexShaderFile(VertexLayout layout, bool indirect)
+{
+	if (indirect)
+	{
+		return layout == VERTEX_LAYOUT_COMPACT_NO_COLOUR ? "Shaders/vert_indirect_no_colour.spv" : "Shaders/vert_indirect.spv";
+	}
+	return layout == VERTEX_LAYOUT_COMPACT_NO_COLOUR ? "Shaders/vert_no_colour.spv" : "Shaders/vert.spv";
+}
+
+VertexDequantize packVertices(VertexLayout layout, const std::vector<Vertex>& vertices, std::vector<uint8_t>* packed)
+{
+	VertexDequantize dequantize;
+	dequantize.positionScale = glm::vec4(1.0f);
+	dequantize.positionOffset = glm::vec4(0.0f);
+	dequantize.texScaleOffset = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);
+
+	packed->resize(vertices.size() * getVertexStride(layout));
+	if (vertices.empty()) return dequantize;
+
+	if (layout == VERTEX_LAYOUT_FULL)
+	{
+		memcpy(packed->data(), vertices.data(), packed->size());
+		return dequantize;
+	}
+
+	// Quantize over the mesh's own bounds so precision follows its size, not the scene's.
+	glm::vec3 posMin = vertices[0].pos;
+	glm::vec3 posMax = vertices[0].pos;
+	glm::vec2 texMin = vertices[0].tex;
+	glm::vec2 texMax = vertices[0].tex;
+	for (const Vertex& vertex : vertices)
+	{
+		posMin = glm::min(posMin, vertex.pos);
+		posMax = glm::max(posMax, vertex.pos);
+		texMin = glm::min(texMin, vertex.tex);
+		texMax = glm::max(texMax, vertex.tex);
+	}
+
+	// Flat axes get a scale of 1 so nothing divides by zero.
+	glm::vec3 halfExtent = (posMax - posMin) * 0.5f;
+	glm::vec3 centre = (posMax + posMin) * 0.5f;
+	glm::vec2 texRange = texMax - texMin;
+	for (int i = 0; i < 3; i++)
+	{
+		if (halfExtent[i] <= 0.0f) halfExtent[i] = 1.0f;
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		if (texRange[i] <= 0.0f) texRange[i] = 1.0f;
+	}
+
+	dequantize.positionScale = glm::vec4(halfExtent, 1.0f);
+	dequantize.positionOffset = glm::vec4(centre, 0.0f);
+	dequantize.texScaleOffset = glm::vec4(texRange, texMin);
+
+	uint32_t stride = getVertexStride(layout);
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		glm::vec3 pos = (vertices[i].pos - centre) / halfExtent;
+		glm::vec2 tex = (vertices[i].tex - texMin) / texRange;
+
+		// Both compact layouts start with pos and tex, colour follows when there is one.
+		CompactVertex vertex = {};
+		vertex.pos[0] = quantizeSnorm16(pos.x);
+		vertex.pos[1] = quantizeSnorm16(pos.y);
+		vertex.pos[2] = quantizeSnorm16(pos.z);
+		vertex.tex[0] = quantizeUnorm16(tex.x);
+		vertex.tex[1] = quantizeUnorm16(tex.y);
+		vertex.col[0] = quantizeUnorm8(vertices[i].col.r);
+		vertex.col[1] = quantizeUnorm8(vertices[i].col.g);
+		vertex.col[2] = quantizeUnorm8(vertices[i].col.b);
+		vertex.col[3] = 255;
+
+		memcpy(packed->data() + i * stride, &vertex, stride);
+	}
+
+	return dequantize;
+}
+
+const char* getVertexLayoutName(VertexLayout layout)
+{
+	switch (layout)
+	{
+	case VERTEX_LAYOUT_COMPACT: return "compact";
+	case VERTEX_LAYOUT_COMPACT_NO_COLOUR: return "compact-no-colour";
+	default: return "full";
+	}
+}
+
+bool parseVertexLayout(const std::string& name, VertexLayout* layout)
+{
+	for (uint32_t i = 0; i < VERTEX_LAYOUT_COUNT; i++)
+	{
+		if (name == getVertexLayoutName(static_cast<VertexLayout>(i)))
+		{
+			*layout = static_cast<VertexLayout>(i);
+			return true;
+		}
+	}
+	return false;
+}
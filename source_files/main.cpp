@@ -5,11 +5,136 @@
 #include "ShaderApplication.h"
 
 
+// Reads command line flags into settings. Unknown flags are an error so typos in batch jobs don't go unnoticed.
+static AppSettings parseArguments(int argc, char** argv)
+{
+    AppSettings settings;
+    VertexLayout vertexLayout = VERTEX_LAYOUT_FULL;     // For the --model flags that follow.
 
-int main() {
-    ShaderApplication app;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--headless") {
+            settings.headless = true;
+        }
+        else if (arg == "--frames" && hasValue) {
+            settings.headlessFrameCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--width" && hasValue) {
+            settings.width = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--height" && hasValue) {
+            settings.height = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--output" && hasValue) {
+            settings.outputImage = argv[++i];
+        }
+        else if (arg == "--record-threads" && hasValue) {
+            settings.recordThreadCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--record-bench") {
+            settings.recordBenchmark = true;
+        }
+        else if (arg == "--alloc-stats") {
+            settings.allocationStats = true;
+        }
+        else if (arg == "--frames-in-flight" && hasValue) {
+            settings.framesInFlight = static_cast<uint32_t>(std::stoul(argv[++i]));
+            if (settings.framesInFlight < 1) {
+                throw std::runtime_error("Frames in flight must be at least 1! (" + std::string(argv[i]) + ")");
+            }
+        }
+        else if (arg == "--swapchain-images" && hasValue) {
+            settings.swapchainImageCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--frame-stats") {
+            settings.frameStats = true;
+        }
+        else if (arg == "--dynamic-res") {
+            settings.dynamicResolution = true;
+        }
+        else if (arg == "--target-ms" && hasValue) {
+            settings.targetFrameMs = std::stof(argv[++i]);
+            if (!(settings.targetFrameMs > 0.0f)) {
+                throw std::runtime_error("Target frame time must be above 0! (" + std::string(argv[i]) + ")");
+            }
+        }
+        else if (arg == "--min-scale" && hasValue) {
+            settings.minResolutionScale = std::stof(argv[++i]);
+            if (!(settings.minResolutionScale > 0.0f && settings.minResolutionScale <= 1.0f)) {
+                throw std::runtime_error("Minimum render scale must be above 0 and at most 1! (" + std::string(argv[i]) + ")");
+            }
+        }
+        else if (arg == "--gpu-profile" && hasValue) {
+            settings.gpuProfilePath = argv[++i];
+        }
+        else if (arg == "--cpu-profile" && hasValue) {
+            settings.cpuProfilePath = argv[++i];
+        }
+        else if (arg == "--model" && hasValue) {
+            settings.modelFiles.push_back(argv[++i]);
+            settings.modelVertexLayouts.push_back(vertexLayout);
+        }
+        else if (arg == "--optimize-meshes") {
+            settings.optimizeMeshes = true;
+        }
+        else if (arg == "--frustum-culling") {
+            settings.frustumCulling = true;
+        }
+        else if (arg == "--cluster-culling") {
+            settings.clusterCulling = true;
+        }
+        else if (arg == "--gpu-culling") {
+            settings.gpuCulling = true;
+        }
+        else if (arg == "--sort-draws") {
+            settings.sortDraws = true;
+        }
+        else if (arg == "--bindless-textures") {
+            settings.bindlessTextures = true;
+        }
+        else if (arg == "--instances" && hasValue) {
+            settings.modelInstances = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+        }
+        else if (arg == "--vertex-layout" && hasValue) {
+            if (!parseVertexLayout(argv[++i], &vertexLayout)) {
+                throw std::runtime_error("Unknown vertex layout! (" + std::string(argv[i]) + ")");
+            }
+        }
+        else if (arg == "--benchmark" && hasValue) {
+            settings.benchmarkPath = argv[++i];
+        }
+        else if (arg == "--bench-frames" && hasValue) {
+            settings.benchmarkFrames = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--bench-warmup" && hasValue) {
+            settings.benchmarkWarmup = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--memory-budget" && hasValue) {
+            settings.memoryBudgetMiB = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--memory-log" && hasValue) {
+            settings.memoryLogInterval = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else {
+            throw std::runtime_error("Unknown or incomplete argument! (" + arg + ")");
+        }
+    }
+
+    if (settings.modelFiles.empty()) {
+        settings.modelFiles.push_back("geo/Alfred_Retypology.obj");
+        settings.modelVertexLayouts.push_back(vertexLayout);
+    }
+
+    return settings;
+}
+
+int main(int argc, char** argv) {
 
     try {
+        ShaderApplication app(parseArguments(argc, argv));
         app.run();
     }
     catch (const std::exception& e) {
@@ -18,4 +143,4 @@ int main() {
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}